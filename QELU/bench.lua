@@ -0,0 +1,330 @@
+#!/usr/bin/env luajit
+--[[
+    QELUP Benchmarks
+    Measures the overhead of crossing the Lua/Python bridge
+
+    Run with: luajit bench.lua [iterations] [output]   (or: make bench)
+    Each result is printed and written as one JSON object per line to
+    `output` (default bench_output.txt), so runs can be diffed across builds.
+]]
+
+local py = require("qelup")
+local json = require("qeluj")
+
+local ITERATIONS = tonumber(arg and arg[1]) or 200000
+local OUTPUT = arg and arg[2] or "bench_output.txt"
+
+py.initialize()
+
+local PYTHON_VERSION = py.version().string:match("^%S+")
+local LUA_VERSION = jit and jit.version or _VERSION
+
+local out = assert(io.open(OUTPUT, "w"))
+
+-- ============================================================================
+-- Harness
+-- ============================================================================
+
+--- Print one result and append it to the output file
+--- @param group string Benchmark group
+--- @param name string Benchmark name
+--- @param n number Iterations
+--- @param ns number Wall-clock nanoseconds per iteration
+--- @param size number|nil Elements or bytes handled per iteration
+local function record(group, name, n, ns, size)
+    print(string.format("%-40s %10d iters %12.1f ns/op", name, n, ns))
+
+    out:write(json.encode({
+        group = group,
+        name = name,
+        iterations = n,
+        size = size,
+        ns_per_op = ns,
+        python = PYTHON_VERSION,
+        lua = LUA_VERSION,
+    }), "\n")
+end
+
+--- Time `fn` over `n` iterations, print ns per iteration and record it
+--- @param group string Benchmark group
+--- @param name string Benchmark name
+--- @param n number Iterations
+--- @param fn function Body, receives the iteration number
+--- @param size number|nil Elements or bytes handled per iteration
+local function bench(group, name, n, fn, size)
+    n = math.max(math.floor(n), 10)
+
+    -- Warm up so JIT traces and Python caches settle
+    for i = 1, math.min(n, 1000) do
+        fn(i)
+    end
+    collectgarbage("collect")
+
+    -- Wall clock: os.clock() is CPU time and misses work done elsewhere
+    local start = py.now()
+    for i = 1, n do
+        fn(i)
+    end
+    local elapsed = py.now() - start
+    record(group, name, n, elapsed * 1e9 / n, size)
+end
+
+--- Time a single run of a long job, with no warm-up
+--- @param group string Benchmark group
+--- @param name string Benchmark name
+--- @param fn function Body
+--- @param size number|nil Elements handled by the run
+local function once(group, name, fn, size)
+    collectgarbage("collect")
+    local start = py.now()
+    fn()
+    record(group, name, 1, (py.now() - start) * 1e9, size)
+end
+
+local function section(title)
+    print("")
+    print(title)
+    print(string.rep("-", 76))
+end
+
+print("QELUP benchmarks (Python " .. PYTHON_VERSION .. ", " .. LUA_VERSION .. ")")
+
+-- ============================================================================
+-- Call Overhead
+-- ============================================================================
+
+py.exec([[
+def f0():
+    return None
+
+def f1(a):
+    return a
+
+def f3(a, b, c):
+    return a
+
+def f10(a, b, c, d, e, f, g, h, i, j):
+    return a
+
+def fkw(a, b=0, c=0):
+    return a
+
+def sink(a):
+    return None
+
+class Point:
+    def __init__(self):
+        self.x = 1
+]])
+
+local f0, f1, f3, f10, fkw = py.eval("f0"), py.eval("f1"), py.eval("f3"), py.eval("f10"), py.eval("fkw")
+local sink = py.eval("sink")
+local len = py.builtins().len
+local kw = py.kwargs({b = 1, c = 2})
+
+section("Call overhead")
+
+bench("call", "call 0 args", ITERATIONS, function() f0() end)
+bench("call", "call 1 arg", ITERATIONS, function(i) f1(i) end)
+bench("call", "call 3 args", ITERATIONS, function(i) f3(i, i, i) end)
+bench("call", "call 10 args (heap path)", ITERATIONS, function(i) f10(i, i, i, i, i, i, i, i, i, i) end)
+bench("call", "call 1 arg + 2 kwargs", ITERATIONS, function(i) fkw(i, kw) end)
+bench("call", "builtin len(str)", ITERATIONS, function() len("hello") end)
+
+-- ============================================================================
+-- Attribute Access and Evaluation
+-- ============================================================================
+
+local os_path = py.import("os.path")
+local point = py.eval("Point()")
+
+section("Attribute access and eval")
+
+bench("attr", "module attr (cached)", ITERATIONS, function() return os_path.join end)
+bench("attr", "module attr + call", ITERATIONS, function() os_path.basename("a/b") end)
+bench("attr", "instance attr", ITERATIONS, function() return point.x end)
+bench("eval", "eval constant", ITERATIONS, function() py.eval("1") end)
+bench("eval", "eval name lookup", ITERATIONS, function() py.eval("f0") end)
+
+-- ============================================================================
+-- Container Conversion
+-- ============================================================================
+
+local SIZES = {10, 1000, 100000}
+
+local function int_array(n)
+    local t = {}
+    for i = 1, n do t[i] = i end
+    return t
+end
+
+local function float_array(n)
+    local t = {}
+    for i = 1, n do t[i] = i + 0.5 end
+    return t
+end
+
+local function string_array(n)
+    local t = {}
+    for i = 1, n do t[i] = "item" .. i end
+    return t
+end
+
+local function records(n)
+    local t = {}
+    for i = 1, n do
+        t[i] = {id = i, name = "user" .. i, score = i * 0.25, tags = {"a", "b"}}
+    end
+    return t
+end
+
+-- Python-side copies of the same data, fetched by key for the reverse direction
+py.exec([[
+_bench_data = {}
+
+def _bench_store(key, value):
+    _bench_data[key] = value
+
+def _bench_get(key):
+    return _bench_data[key]
+]])
+
+local store, get = py.eval("_bench_store"), py.eval("_bench_get")
+
+local builders = {
+    {"ints", int_array},
+    {"floats", float_array},
+    {"strings", string_array},
+    {"records", records},
+}
+
+section("Conversion Lua -> Python")
+
+for _, builder in ipairs(builders) do
+    local kind, build = builder[1], builder[2]
+    for _, n in ipairs(SIZES) do
+        local data = build(n)
+        bench("to_python", string.format("%s[%d] -> python", kind, n), ITERATIONS / n,
+              function() sink(data) end, n)
+        store(kind .. n, data)
+    end
+end
+
+section("Conversion Python -> Lua")
+
+for _, builder in ipairs(builders) do
+    local kind = builder[1]
+    for _, n in ipairs(SIZES) do
+        local key = kind .. n
+        bench("to_lua", string.format("%s[%d] -> lua", kind, n), ITERATIONS / n,
+              function() get(key) end, n)
+    end
+end
+
+-- ============================================================================
+-- Large Strings
+-- ============================================================================
+
+section("String round trips")
+
+for _, size in ipairs({1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024}) do
+    local str = string.rep("x", size)
+    bench("string", string.format("string %d bytes round trip", size), ITERATIONS * 64 / size,
+          function() f1(str) end, size)
+end
+
+-- ============================================================================
+-- FFI Fast Path
+-- ============================================================================
+
+py.exec([[
+def add2(a, b):
+    return a + b
+]])
+
+local add2 = py.eval("add2")
+local PATH = py.hasFFI() and "ffi" or "C API fallback"
+
+section("FFI fast path (" .. PATH .. ")")
+
+local fast_f1_double = py.fastCall(f1, "double")
+local fast_f1_int = py.fastCall(f1, "int")
+local fast_f1_string = py.fastCall(f1, "string")
+local fast_add2 = py.fastCall(add2, "double")
+
+bench("ffi", "call 1 double arg (C API)", ITERATIONS, function(i) f1(i + 0.5) end)
+bench("ffi", "call 1 double arg (" .. PATH .. ")", ITERATIONS, function(i) fast_f1_double(i + 0.5) end)
+bench("ffi", "call 1 int arg (C API)", ITERATIONS, function(i) f1(i) end)
+bench("ffi", "call 1 int arg (" .. PATH .. ")", ITERATIONS, function(i) fast_f1_int(i) end)
+bench("ffi", "call 2 double args (C API)", ITERATIONS, function(i) add2(i, 0.5) end)
+bench("ffi", "call 2 double args (" .. PATH .. ")", ITERATIONS, function(i) fast_add2(i, 0.5) end)
+bench("ffi", "call 1 string arg (C API)", ITERATIONS, function() f1("hello") end)
+bench("ffi", "call 1 string arg (" .. PATH .. ")", ITERATIONS, function() fast_f1_string("hello") end)
+
+-- ============================================================================
+-- Wrapper Collection
+-- ============================================================================
+
+section("Wrapper collection")
+
+local make_object = py.eval("object")
+local WRAPPERS = 10000
+
+for _, batch in ipairs({0, 16384}) do
+    py.config({decref_batch = batch})
+    bench("gc", string.format("collect %d wrappers (decref_batch %d)", WRAPPERS, batch), ITERATIONS / WRAPPERS,
+          function()
+              local keep = {}
+              for i = 1, WRAPPERS do keep[i] = make_object() end
+              keep = nil
+              collectgarbage("collect")
+              py.collect()
+          end, WRAPPERS)
+end
+py.config({decref_batch = 16384})
+
+-- ============================================================================
+-- Worker Pool
+-- ============================================================================
+
+section("Worker pool (CPU-bound)")
+
+-- LuaJIT passes every number as a float, which range() rejects
+local BURN = "def burn(n):\n    total = 0\n    for i in range(int(n)):\n        total += i * i\n    return total\n"
+py.exec(BURN)
+local burn = py.eval("burn")
+
+local jobs = {}
+for i = 1, 64 do jobs[i] = 20000 end
+
+-- Each run takes long enough to time on its own
+once("workers", "burn x64 in process", function()
+    for i = 1, #jobs do burn(jobs[i]) end
+end, #jobs)
+
+for _, n in ipairs({2, 4, 8}) do
+    local pool = py.workers(n)
+    pool:exec(BURN)
+    local remote_burn = pool:import("__main__").burn
+    once("workers", string.format("burn x64 on %d workers", n), function()
+        pool:map(remote_burn, jobs)
+    end, #jobs)
+    pool:close()
+end
+
+for _, n in ipairs({2, 4, 8}) do
+    local pool = py.pool(n)
+    if not pool.isolated then
+        pool:close()
+        break
+    end
+    pool:exec(BURN)
+    once("workers", string.format("burn x64 on %d subinterpreters", n), function()
+        pool:map("burn", jobs)
+    end, #jobs)
+    pool:close()
+end
+
+out:close()
+print("")
+print("Results written to " .. OUTPUT)
@@ -18,6 +18,24 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <pthread.h>
+#endif
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
 
 /* Compatibility macros for Python 2/3 */
 #if PY_MAJOR_VERSION >= 3
@@ -28,20 +46,488 @@
     #define PyString_Check PyUnicode_Check
     #define PyString_AsString PyUnicode_AsUTF8
     #define PyString_FromString PyUnicode_FromString
+    #define PyString_FromFormat PyUnicode_FromFormat
+    #define PyString_FromStringAndSize PyUnicode_FromStringAndSize
+    #define PyString_InternInPlace PyUnicode_InternInPlace
+#endif
+
+/* Vectorcall is public from 3.9 and provisional in 3.8 */
+#if PY_VERSION_HEX >= 0x03090000
+    #define QELUP_HAVE_VECTORCALL
+    #define qelup_Vectorcall PyObject_Vectorcall
+#elif PY_VERSION_HEX >= 0x03080000
+    #define QELUP_HAVE_VECTORCALL
+    #define qelup_Vectorcall _PyObject_Vectorcall
+#endif
+
+/* Registry access by lightuserdata key across Lua versions */
+#if LUA_VERSION_NUM >= 502
+    #define qelup_getregistry(L, key) lua_rawgetp(L, LUA_REGISTRYINDEX, (key))
+    #define qelup_setregistry(L, key) lua_rawsetp(L, LUA_REGISTRYINDEX, (key))
+#else
+    #define qelup_getregistry(L, key) \
+        (lua_pushlightuserdata(L, (void*)(key)), lua_rawget(L, LUA_REGISTRYINDEX))
+    #define qelup_setregistry(L, key) \
+        (lua_pushlightuserdata(L, (void*)(key)), lua_insert(L, -2), lua_rawset(L, LUA_REGISTRYINDEX))
 #endif
 
+/* Raw length of a table across Lua versions */
+#if LUA_VERSION_NUM >= 502
+    #define qelup_rawlen(L, i) ((lua_Integer)lua_rawlen(L, (i)))
+#else
+    #define qelup_rawlen(L, i) ((lua_Integer)lua_objlen(L, (i)))
+#endif
+
+/* Calls with up to this many arguments avoid heap allocation */
+#define QELUP_STACK_ARGS 8
+
 /* Metatable names */
 #define QELUP_PYOBJECT_MT "qelup.pyobject"
+#define QELUP_PYPROXY_MT "qelup.pyproxy"
+#define QELUP_KWARGS_MT "qelup.kwargs"
+#define QELUP_CODE_MT "qelup.code"
+#define QELUP_ITER_MT "qelup.iterator"
+#define QELUP_BUFFER_MT "qelup.buffer"
+#define QELUP_NDARRAY_MT "qelup.ndarray"
+#define QELUP_ARROW_MT "qelup.arrow"
+#define QELUP_ARROWCOL_MT "qelup.arrowcolumn"
+#define QELUP_ARROWSTREAM_MT "qelup.arrowstream"
+#define QELUP_WORKERS_MT "qelup.workers"
+#define QELUP_INTERPPOOL_MT "qelup.pool"
+#define QELUP_FUTURE_MT "qelup.future"
 
 /* Python object wrapper for Lua */
 typedef struct {
     PyObject *obj;
+    int generation;     /* interpreter the reference belongs to */
+    int attrcache;      /* attribute caching: -1 auto, 0 off, 1 on */
 } qelup_PyObject;
 
+/* Compiled code object handle (obj and generation first, as pyobject_gc reads them) */
+typedef struct {
+    PyObject *obj;
+    int generation;
+    int start;          /* Py_eval_input, Py_file_input or Py_single_input */
+} qelup_Code;
+
+/* Python iterator driven from Lua (obj and generation first, as pyobject_gc reads them) */
+typedef struct {
+    PyObject *obj;
+    int generation;
+    int batch;          /* elements pulled per GIL acquisition */
+    int pos;            /* next buffered element */
+    int count;          /* elements in the buffer */
+    lua_Integer index;  /* elements produced so far */
+    PyObject *error[3]; /* exception raised after the buffered elements, if any */
+} qelup_Iterator;
+
+/* A Py_buffer held open so Lua can read the exporter's memory in place */
+typedef struct {
+    Py_buffer view;
+    int held;           /* view still needs PyBuffer_Release */
+    int generation;     /* interpreter the memory belongs to */
+    int kind;           /* QELUP_ITEM_* decoded from view.format */
+} qelup_Buffer;
+
+/* The view is unusable once released or once its interpreter is finalized */
+#define qelup_bufferlive(buf) ((buf)->held && (buf)->generation == qelup_generation)
+
+/* Deepest ndarray view supported (NumPy allows 32 or 64) */
+#define QELUP_MAXDIM 64
+
+/* A strided window onto a held buffer; the buffer is its Lua user value */
+typedef struct {
+    qelup_Buffer *owner;    /* kept alive by the user value */
+    char *data;             /* first element of this view */
+    int ndim;
+    Py_ssize_t dims[1];     /* shape[ndim] then strides[ndim] (allocated to fit) */
+} qelup_NDArray;
+
+#define QELUP_SHAPE(a) ((a)->dims)
+#define QELUP_STRIDES(a) ((a)->dims + (a)->ndim)
+
+/* Bridge-wide settings, changed through core.config() */
+typedef struct {
+    int proxy;          /* return lists, tuples and dicts as lazy views */
+    int bytes;          /* pass Lua strings to Python as bytes instead of str */
+    int views;          /* pass Lua tables to Python as lazy views */
+    int maxdepth;       /* deepest container nesting a conversion will copy */
+    int attrcache;      /* reuse attribute wrappers of modules and classes */
+    int stats;          /* collect counters and timings for core.stats() */
+    int histograms;     /* also keep per-callable latency histograms */
+    int async;          /* run coroutines returned by calls on the bridge event loop */
+    int decref_batch;   /* queued decrefs that force a drain (0 releases at once) */
+    double timeout;     /* default deadline in ms for calls, exec and eval (0: none) */
+} qelup_Config;
+
+static qelup_Config qelup_config = { 0, 0, 0, 1000, 1, 0, 0, 1, 16384, 0 };
+
+/*
+    Attribute lookups reuse interned Python names: each Lua state keeps a
+    table from Lua string to PyObject* (lightuserdata), and qelup_attrnames
+    owns the names for all states. qelup_generation invalidates the Lua
+    tables when the interpreter is restarted.
+*/
+#define QELUP_ATTRNAMES_MAX 4096
+
+static char qelup_attrnames_key;    /* registry: Lua string -> interned name */
+static char qelup_attrcache_key;    /* registry: wrapper -> {name = value} (weak keys) */
+static char qelup_wrappers_key;     /* registry: PyObject* -> wrapper (weak values) */
+static char qelup_pyobject_mt_key;  /* registry: the qelup.pyobject metatable */
+static PyObject *qelup_attrnames = NULL;
+static int qelup_generation = 0;
+
+/* Thread state saved after initialization so other OS threads can take the GIL */
+static PyThreadState *qelup_main_tstate = NULL;
+
+/* Thread-local storage */
+#if defined(_MSC_VER)
+    #define QELUP_THREAD_LOCAL __declspec(thread)
+#else
+    #define QELUP_THREAD_LOCAL __thread
+#endif
+
+/* Lua state currently inside a bridge call on this OS thread, if any */
+static QELUP_THREAD_LOCAL lua_State *qelup_current_L = NULL;
+
+/* Saved GIL state plus the Lua state it displaced, restored on release */
+typedef struct {
+    PyGILState_STATE state;
+    lua_State *prev;
+} qelup_Gil;
+
+static void qelup_drain_pending(void);
+static void qelup_drain_unrefs(lua_State *L);
+
+/* Registry references dropped by Python while their Lua state was busy (GIL held) */
+static int qelup_unref_pending = 0;
+
+/* Take the GIL without releasing anything queued (for callers inside LuaJIT FFI calls) */
+static qelup_Gil qelup_gil_acquire_nodrain(lua_State *L) {
+    qelup_Gil gil;
+    gil.state = PyGILState_Ensure();
+    gil.prev = qelup_current_L;
+    qelup_current_L = L;
+    return gil;
+}
+
+static qelup_Gil qelup_gil_acquire(lua_State *L) {
+    qelup_Gil gil;
+    gil.state = PyGILState_Ensure();
+    /* Release wrappers Lua collected since the last call, before Lua is reachable */
+    qelup_drain_pending();
+    gil.prev = qelup_current_L;
+    qelup_current_L = L;
+    if (L != NULL && qelup_unref_pending > 0) {
+        qelup_drain_unrefs(L);
+    }
+    return gil;
+}
+
+static void qelup_gil_release(qelup_Gil gil) {
+    qelup_current_L = gil.prev;
+    PyGILState_Release(gil.state);
+}
+
+/*
+    GIL handling: every entry point that touches Python brackets its work with
+    QELUP_GIL_ACQUIRE / QELUP_GIL_RELEASE. Lua argument checks that may raise
+    should happen before acquiring, and errors must release before lua_error.
+    While held, qelup_current_L tells Python-side Lua views which state to use.
+*/
+#define QELUP_GIL_ACQUIRE() qelup_Gil qelup_gil = qelup_gil_acquire(L)
+#define QELUP_GIL_RELEASE() qelup_gil_release(qelup_gil)
+
+/* ========================================================================== */
+/* Instrumentation */
+/* ========================================================================== */
+
+/*
+    Counters behind core.stats(). They are only updated with the GIL held, so
+    plain increments suffice. While config.stats is off each probe is a single
+    branch marked unlikely; building with -DQELUP_NO_STATS removes them.
+*/
+
+/* Monotonic clock in nanoseconds; also times interpreter start-up */
+static unsigned long long qelup_now(void) {
+    #ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+    #endif
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define QELUP_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+    #define QELUP_UNLIKELY(x) (x)
+#endif
+
+#ifndef QELUP_NO_STATS
+
+enum {
+    QELUP_STAT_TOPY,        /* lua_to_python */
+    QELUP_STAT_TOLUA,       /* python_to_lua */
+    QELUP_STAT_CALL,        /* the Python call made by pyobject_call, map, starmap */
+    QELUP_STAT_EVAL,        /* eval and compiled eval code */
+    QELUP_STAT_EXEC,        /* exec and compiled exec code */
+    QELUP_STAT_TIMERS
+};
+
+static const char *const qelup_stat_names[QELUP_STAT_TIMERS] = {
+    "lua_to_python", "python_to_lua", "call", "eval", "exec"
+};
+
+/* Latency histogram buckets: bucket k counts calls taking [2^k, 2^(k+1)) ns */
+#define QELUP_HIST_BUCKETS 32
+#define QELUP_HIST_SLOTS 64
+
+typedef struct {
+    PyObject *callable;     /* strong reference, so the address stays unique */
+    unsigned long long count;
+    unsigned long long ns;
+    unsigned long long buckets[QELUP_HIST_BUCKETS];
+} qelup_Histogram;
+
+typedef struct {
+    unsigned long long count[QELUP_STAT_TIMERS];
+    unsigned long long ns[QELUP_STAT_TIMERS];
+    unsigned long long wrappers;        /* userdata wrappers created */
+    unsigned long long wrapper_hits;    /* live wrappers reused for the same object */
+    unsigned long long decrefs;         /* references released by __gc */
+    unsigned long long errors;          /* Python exceptions raised into Lua */
+    unsigned long long bytes_topy;      /* string bytes copied Lua -> Python */
+    unsigned long long bytes_tolua;     /* string bytes copied Python -> Lua */
+    unsigned long long hist_dropped;    /* calls not recorded, table full */
+    qelup_Histogram hist[QELUP_HIST_SLOTS];
+} qelup_Stats;
+
+static qelup_Stats qelup_stats;
+
+/* Record one timed sample for kind, started at qelup_now() time start */
+static void qelup_stat_time(int kind, unsigned long long start) {
+    qelup_stats.count[kind]++;
+    qelup_stats.ns[kind] += qelup_now() - start;
+}
+
+/* Record one call in the callable's histogram (open addressing by address) */
+static void qelup_stat_call(PyObject *callable, unsigned long long start) {
+    unsigned long long ns = qelup_now() - start;
+    qelup_stats.count[QELUP_STAT_CALL]++;
+    qelup_stats.ns[QELUP_STAT_CALL] += ns;
+    
+    if (!qelup_config.histograms) {
+        return;
+    }
+    
+    size_t slot = ((size_t)callable >> 4) % QELUP_HIST_SLOTS;
+    for (int probe = 0; probe < QELUP_HIST_SLOTS; probe++) {
+        qelup_Histogram *h = &qelup_stats.hist[slot];
+        if (h->callable == NULL) {
+            Py_INCREF(callable);
+            h->callable = callable;
+        }
+        if (h->callable == callable) {
+            int bucket = 0;
+            while (bucket < QELUP_HIST_BUCKETS - 1 && (ns >> (bucket + 1)) != 0) {
+                bucket++;
+            }
+            h->count++;
+            h->ns += ns;
+            h->buckets[bucket]++;
+            return;
+        }
+        slot = (slot + 1) % QELUP_HIST_SLOTS;
+    }
+    qelup_stats.hist_dropped++;
+}
+
+/* Zero every counter; releases histogram references when Python is running */
+static void qelup_stat_reset(void) {
+    for (int i = 0; i < QELUP_HIST_SLOTS; i++) {
+        if (Py_IsInitialized()) {
+            Py_XDECREF(qelup_stats.hist[i].callable);
+        }
+    }
+    memset(&qelup_stats, 0, sizeof(qelup_stats));
+}
+
+#define QELUP_STAT_START(t) \
+    unsigned long long t = QELUP_UNLIKELY(qelup_config.stats) ? qelup_now() : 0
+#define QELUP_STAT_STOP(t, kind) \
+    do { if (QELUP_UNLIKELY(t != 0)) qelup_stat_time((kind), t); } while (0)
+#define QELUP_STAT_CALL(t, callable) \
+    do { if (QELUP_UNLIKELY(t != 0)) qelup_stat_call((callable), t); } while (0)
+#define QELUP_STAT_ADD(field, n) \
+    do { if (QELUP_UNLIKELY(qelup_config.stats)) qelup_stats.field += (n); } while (0)
+
+#else
+
+#define QELUP_STAT_START(t) do { } while (0)
+#define QELUP_STAT_STOP(t, kind) do { } while (0)
+#define QELUP_STAT_CALL(t, callable) do { } while (0)
+#define QELUP_STAT_ADD(field, n) do { } while (0)
+
+#endif /* QELUP_NO_STATS */
+
+/* ========================================================================== */
+/* Deferred Decrefs */
+/* ========================================================================== */
+
+/*
+    Wrapper finalizers normally do not touch Python: __gc pushes the
+    reference onto a lock-free stack (from any thread, without the GIL) and
+    the next bridge call releases the whole batch under the GIL it takes
+    anyway. core.collect() drains on demand. To keep memory bounded when Lua
+    never calls in, the finalizer that brings the queue to
+    config.decref_batch takes the GIL and drains it, so Python destructors
+    do run inside that one __gc. Draining swaps the whole stack out, so
+    pushes never race with pops.
+*/
+
+typedef struct qelup_Decref {
+    struct qelup_Decref *next;
+    PyObject *obj;
+} qelup_Decref;
+
+#if defined(_MSC_VER)
+    #define QELUP_ATOMIC_LOAD(p) InterlockedCompareExchangePointer((PVOID volatile*)(p), NULL, NULL)
+    #define QELUP_ATOMIC_CAS(p, old, new) \
+        (InterlockedCompareExchangePointer((PVOID volatile*)(p), (new), (old)) == (old))
+    #define QELUP_ATOMIC_XCHG(p, v) InterlockedExchangePointer((PVOID volatile*)(p), (v))
+    #define QELUP_ATOMIC_ADD(p, n) (InterlockedExchangeAdd((LONG volatile*)(p), (n)) + (n))
+#else
+    #define QELUP_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define QELUP_ATOMIC_CAS(p, old, new) \
+        __atomic_compare_exchange_n((p), &(old), (new), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+    #define QELUP_ATOMIC_XCHG(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+    #define QELUP_ATOMIC_ADD(p, n) __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#endif
+
+static qelup_Decref *qelup_decref_head = NULL;
+static long qelup_decref_pending = 0;
+
+/* Batch counters, kept even without config.stats (updated with the GIL held) */
+static unsigned long long qelup_decref_batches = 0;
+static unsigned long long qelup_decref_released = 0;
+static unsigned long long qelup_decref_largest = 0;
+
+/* Release every queued reference; the GIL must be held */
+static size_t qelup_drain_decrefs(void) {
+    qelup_Decref *node = (qelup_Decref*)QELUP_ATOMIC_XCHG(&qelup_decref_head, NULL);
+    size_t n = 0;
+    
+    while (node != NULL) {
+        qelup_Decref *next = node->next;
+        Py_DECREF(node->obj);
+        free(node);
+        node = next;
+        n++;
+    }
+    
+    if (n > 0) {
+        QELUP_ATOMIC_ADD(&qelup_decref_pending, -(long)n);
+        qelup_decref_batches++;
+        qelup_decref_released += n;
+        if (n > qelup_decref_largest) {
+            qelup_decref_largest = n;
+        }
+        QELUP_STAT_ADD(decrefs, n);
+    }
+    return n;
+}
+
+/* Queue a reference for release; drains inline past the threshold */
+static void qelup_defer_decref(lua_State *L, PyObject *obj) {
+    qelup_Decref *node = qelup_config.decref_batch > 0
+        ? (qelup_Decref*)malloc(sizeof(qelup_Decref)) : NULL;
+    
+    if (node == NULL) {
+        QELUP_GIL_ACQUIRE();
+        Py_DECREF(obj);
+        QELUP_STAT_ADD(decrefs, 1);
+        QELUP_GIL_RELEASE();
+        return;
+    }
+    
+    node->obj = obj;
+    do {
+        node->next = (qelup_Decref*)QELUP_ATOMIC_LOAD(&qelup_decref_head);
+    } while (!QELUP_ATOMIC_CAS(&qelup_decref_head, node->next, node));
+    
+    if (QELUP_ATOMIC_ADD(&qelup_decref_pending, 1) >= qelup_config.decref_batch) {
+        /* Acquiring the GIL drains the stack */
+        QELUP_GIL_ACQUIRE();
+        QELUP_GIL_RELEASE();
+    }
+}
+
+/* Called on every GIL acquisition: one atomic load when nothing is queued */
+static void qelup_drain_pending(void) {
+    if (QELUP_UNLIKELY(QELUP_ATOMIC_LOAD(&qelup_decref_head) != NULL)) {
+        qelup_drain_decrefs();
+    }
+}
+
+/* Release queued references now: core.collect() returns how many */
+static int qelup_collect(lua_State *L) {
+    unsigned long long before = qelup_decref_released;
+    if (Py_IsInitialized()) {
+        /* Acquiring the GIL drains the stack */
+        QELUP_GIL_ACQUIRE();
+        QELUP_GIL_RELEASE();
+    }
+    lua_pushinteger(L, (lua_Integer)(qelup_decref_released - before));
+    return 1;
+}
+
+/*
+    Bookkeeping for one Lua state, shared by its Python-side views. Views
+    freed while the state is not inside a bridge call on the freeing thread
+    queue their registry reference here; the state's next bridge call
+    releases them. Once the state is closed the queue is only discarded.
+    Changed only with the GIL held.
+*/
+typedef struct {
+    int closed;         /* lua_close ran; the state must not be touched */
+    int users;          /* live views, plus one while the state is open */
+    int *refs;          /* references waiting for luaL_unref */
+    int nrefs;
+    int cap;
+} qelup_StateRec;
+
+/* Python-side view of a Lua table or function, held through a registry reference */
+typedef struct {
+    PyObject_HEAD
+    lua_State *L;       /* main thread of the owning Lua state */
+    int ref;            /* registry reference to the table or function */
+    qelup_StateRec *owner;
+} qelup_LuaRef;
+
 /* Forward declarations */
+static PyTypeObject qelup_LuaTableType;
+static PyTypeObject qelup_LuaListType;
+static PyTypeObject qelup_LuaFunctionType;
 static PyObject* lua_to_python(lua_State *L, int index);
-static void python_to_lua(lua_State *L, PyObject *obj);
-static int handle_python_exception(lua_State *L);
+static PyObject* lua_to_python_mode(lua_State *L, int index, int lazy);
+static PyObject* qelup_newluaview(lua_State *L, int index, int sequence);
+static PyObject* qelup_newluafunction(lua_State *L, int index);
+static void qelup_closepools(void);
+static void qelup_stopasync(void);
+static int qelup_iscoroutine(PyObject *obj);
+static int qelup_pushfuture(lua_State *L, PyObject *awaitable);
+static int python_to_lua(lua_State *L, PyObject *obj);
+static int python_to_lua_mode(lua_State *L, PyObject *obj, int lazy);
+static int handle_python_exception(lua_State *L, qelup_Gil gil);
+static PyObject* qelup_callargs(lua_State *L, PyObject *callable, int first, int last);
 
 /* ========================================================================== */
 /* Helper Functions */
@@ -55,13 +541,52 @@ static int check_initialized(lua_State *L) {
     return 0;
 }
 
-/* Create a new Python object wrapper */
+/*
+    Push the wrapper for a Python object. Each Lua state keeps one live
+    wrapper per object in a weak-valued table keyed by the PyObject*, so
+    repeated lookups of the same object share a userdata (and its attribute
+    cache) instead of allocating and finalizing one each time.
+*/
 static qelup_PyObject* qelup_newpyobject(lua_State *L, PyObject *obj) {
+    qelup_getregistry(L, &qelup_wrappers_key);
+    lua_pushlightuserdata(L, obj);
+    lua_rawget(L, -2);
+    
+    qelup_PyObject *udata = (qelup_PyObject*)lua_touserdata(L, -1);
+    if (udata != NULL && udata->obj == obj && udata->generation == qelup_generation) {
+        lua_remove(L, -2);
+        QELUP_STAT_ADD(wrapper_hits, 1);
+        return udata;
+    }
+    lua_pop(L, 1);
+    
+    udata = (qelup_PyObject*)lua_newuserdata(L, sizeof(qelup_PyObject));
+    udata->obj = obj;
+    udata->attrcache = -1;
+    udata->generation = qelup_generation;
+    Py_XINCREF(obj);
+    QELUP_STAT_ADD(wrappers, 1);
+    
+    qelup_getregistry(L, &qelup_pyobject_mt_key);
+    lua_setmetatable(L, -2);
+    
+    lua_pushlightuserdata(L, obj);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+    lua_remove(L, -2);
+    return udata;
+}
+
+/* Create a lazy view over a Python list, tuple or dict */
+static qelup_PyObject* qelup_newproxy(lua_State *L, PyObject *obj) {
     qelup_PyObject *udata = (qelup_PyObject*)lua_newuserdata(L, sizeof(qelup_PyObject));
     udata->obj = obj;
+    udata->attrcache = 0;
+    udata->generation = qelup_generation;
     Py_XINCREF(obj);
+    QELUP_STAT_ADD(wrappers, 1);
     
-    luaL_getmetatable(L, QELUP_PYOBJECT_MT);
+    luaL_getmetatable(L, QELUP_PYPROXY_MT);
     lua_setmetatable(L, -2);
     
     return udata;
@@ -73,365 +598,7717 @@ static PyObject* qelup_checkpyobject(lua_State *L, int index) {
     return udata->obj;
 }
 
+/* Get Python object from a lazy view */
+static PyObject* qelup_checkproxy(lua_State *L, int index) {
+    qelup_PyObject *udata = (qelup_PyObject*)luaL_checkudata(L, index, QELUP_PYPROXY_MT);
+    return udata->obj;
+}
+
+/* Borrow the UTF-8 data and length of a Python str without a strlen */
+static const char* qelup_pystring(PyObject *obj, Py_ssize_t *len) {
+    #ifdef QELUP_PY3
+    return PyUnicode_AsUTF8AndSize(obj, len);
+    #else
+    char *buf = NULL;
+    if (PyString_AsStringAndSize(obj, &buf, len) < 0) {
+        return NULL;
+    }
+    return buf;
+    #endif
+}
+
+/* Convert a Lua string to str, or to bytes when asked or not valid UTF-8 */
+static PyObject* qelup_fromluastring(const char *str, size_t len, int as_bytes) {
+    #ifdef QELUP_PY3
+    if (!as_bytes) {
+        PyObject *ustr = PyUnicode_FromStringAndSize(str, (Py_ssize_t)len);
+        if (ustr != NULL) {
+            return ustr;
+        }
+        PyErr_Clear();
+    }
+    return PyBytes_FromStringAndSize(str, (Py_ssize_t)len);
+    #else
+    (void)as_bytes;
+    return PyString_FromStringAndSize(str, (Py_ssize_t)len);
+    #endif
+}
+
+/* Absolute stack index across Lua versions */
+static int qelup_absindex(lua_State *L, int index) {
+    #if LUA_VERSION_NUM >= 502
+    return lua_absindex(L, index);
+    #else
+    return (index > 0 || index <= LUA_REGISTRYINDEX) ? index : lua_gettop(L) + index + 1;
+    #endif
+}
+
+/* Main thread of a Lua state, identifying the state across coroutines */
+static lua_State* qelup_mainthread(lua_State *L) {
+    #if LUA_VERSION_NUM >= 502
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State *main = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    return main;
+    #else
+    return L;
+    #endif
+}
+
+/* Get Python object from any bridge userdata, or NULL */
+static PyObject* qelup_topyobject(lua_State *L, int index) {
+    qelup_PyObject *udata = (qelup_PyObject*)luaL_testudata(L, index, QELUP_PYOBJECT_MT);
+    if (udata == NULL) {
+        udata = (qelup_PyObject*)luaL_testudata(L, index, QELUP_PYPROXY_MT);
+    }
+    if (udata == NULL) {
+        /* Buffer views hand back the object that exported them */
+        qelup_Buffer *buf = (qelup_Buffer*)luaL_testudata(L, index, QELUP_BUFFER_MT);
+        return buf != NULL && qelup_bufferlive(buf) ? buf->view.obj : NULL;
+    }
+    return udata->obj;
+}
+
 /* ========================================================================== */
 /* Type Conversion: Lua -> Python */
 /* ========================================================================== */
 
-static PyObject* lua_to_python(lua_State *L, int index) {
-    int type = lua_type(L, index);
+/*
+    Tables are converted by an explicit-stack traversal rather than recursion.
+    A per-conversion memo (a Lua table keyed by source table) maps each table
+    to the Python container made for it, so shared subtables stay shared and
+    cycles terminate. Containers are attached to their parent as soon as they
+    are created and filled afterwards. Nesting beyond qelup_config.maxdepth
+    raises ValueError.
     
-    switch (type) {
-        case LUA_TNIL:
-            Py_RETURN_NONE;
-        
+    The key pass that picks list or dict also records the table's shape.
+    Tables without nested tables (homogeneous arrays, flat str -> scalar
+    records) are filled directly in a tight loop, without frames or memo.
+*/
+
+/* Table shapes reported by qelup_newcontainer */
+enum {
+    QELUP_SHAPE_NESTED,     /* has table keys or values: generic traversal */
+    QELUP_SHAPE_FLAT,       /* scalars only, mixed types */
+    QELUP_SHAPE_INTS,       /* array of integers (Lua 5.3+) */
+    QELUP_SHAPE_FLOATS,     /* array of numbers */
+    QELUP_SHAPE_STRINGS     /* array of strings */
+};
+
+/* One table being copied into a list or dict */
+typedef struct {
+    PyObject *obj;          /* list or dict being filled (owned by its parent) */
+    int table;              /* stack index of the source table */
+    lua_Integer pos;        /* next array index, for lists */
+} qelup_LuaFrame;
+
+static PyObject* lua_to_python(lua_State *L, int index) {
+    return lua_to_python_mode(L, index, qelup_config.views);
+}
+
+/* Convert any value except a table */
+static PyObject* lua_to_python_scalar(lua_State *L, int index) {
+    switch (lua_type(L, index)) {
         case LUA_TBOOLEAN:
             return PyBool_FromLong(lua_toboolean(L, index));
         
         case LUA_TNUMBER:
             #if LUA_VERSION_NUM >= 503
             if (lua_isinteger(L, index)) {
-                return PyInt_FromLong(lua_tointeger(L, index));
+                return PyLong_FromLongLong((long long)lua_tointeger(L, index));
             }
             #endif
             return PyFloat_FromDouble(lua_tonumber(L, index));
         
         case LUA_TSTRING: {
-            const char *str = lua_tostring(L, index);
-            return PyString_FromString(str);
-        }
-        
-        case LUA_TTABLE: {
-            /* Check if it's an array or dictionary */
-            int is_array = 1;
-            int max_index = 0;
-            int count = 0;
-            
-            lua_pushnil(L);
-            while (lua_next(L, index < 0 ? index - 1 : index) != 0) {
-                if (lua_type(L, -2) != LUA_TNUMBER) {
-                    is_array = 0;
-                    lua_pop(L, 2);
-                    break;
-                }
-                int idx = lua_tointeger(L, -2);
-                if (idx > max_index) max_index = idx;
-                count++;
-                lua_pop(L, 1);
-            }
-            
-            if (is_array && max_index == count) {
-                /* Convert to Python list */
-                PyObject *list = PyList_New(count);
-                for (int i = 1; i <= count; i++) {
-                    lua_rawgeti(L, index, i);
-                    PyObject *item = lua_to_python(L, -1);
-                    PyList_SetItem(list, i - 1, item);
-                    lua_pop(L, 1);
-                }
-                return list;
-            } else {
-                /* Convert to Python dict */
-                PyObject *dict = PyDict_New();
-                lua_pushnil(L);
-                while (lua_next(L, index < 0 ? index - 1 : index) != 0) {
-                    PyObject *key = lua_to_python(L, -2);
-                    PyObject *value = lua_to_python(L, -1);
-                    PyDict_SetItem(dict, key, value);
-                    Py_DECREF(key);
-                    Py_DECREF(value);
-                    lua_pop(L, 1);
-                }
-                return dict;
-            }
+            size_t len;
+            const char *str = lua_tolstring(L, index, &len);
+            QELUP_STAT_ADD(bytes_topy, len);
+            return qelup_fromluastring(str, len, qelup_config.bytes);
         }
         
         case LUA_TUSERDATA: {
-            /* Check if it's a Python object wrapper */
-            if (luaL_testudata(L, index, QELUP_PYOBJECT_MT)) {
-                PyObject *obj = qelup_checkpyobject(L, index);
+            /* Check if it's a Python object wrapper or lazy view */
+            PyObject *obj = qelup_topyobject(L, index);
+            if (obj != NULL) {
                 Py_INCREF(obj);
                 return obj;
             }
-            /* Fall through to default */
+            Py_RETURN_NONE;
         }
         
+        case LUA_TFUNCTION:
+            return qelup_newluafunction(L, index);
+        
         default:
             Py_RETURN_NONE;
     }
 }
 
-/* ========================================================================== */
-/* Type Conversion: Python -> Lua */
-/* ========================================================================== */
-
-static void python_to_lua(lua_State *L, PyObject *obj) {
-    if (obj == NULL || obj == Py_None) {
-        lua_pushnil(L);
-    }
-    else if (PyBool_Check(obj)) {
-        lua_pushboolean(L, obj == Py_True);
-    }
-    else if (PyInt_Check(obj)) {
-        lua_pushinteger(L, PyInt_AsLong(obj));
+/* Check whether the key on top of the stack is an integer in [1, n] */
+static int qelup_isarraykey(lua_State *L, lua_Integer n) {
+    if (lua_type(L, -1) != LUA_TNUMBER) {
+        return 0;
     }
-    else if (PyFloat_Check(obj)) {
-        lua_pushnumber(L, PyFloat_AsDouble(obj));
+    #if LUA_VERSION_NUM >= 503
+    if (!lua_isinteger(L, -1)) {
+        return 0;
     }
-    else if (PyString_Check(obj)) {
-        const char *str = PyString_AsString(obj);
-        lua_pushstring(L, str);
+    lua_Integer k = lua_tointeger(L, -1);
+    #else
+    lua_Number d = lua_tonumber(L, -1);
+    lua_Integer k = (lua_Integer)d;
+    if ((lua_Number)k != d) {
+        return 0;
     }
-    else if (PyList_Check(obj)) {
-        Py_ssize_t size = PyList_Size(obj);
-        lua_createtable(L, size, 0);
-        for (Py_ssize_t i = 0; i < size; i++) {
-            PyObject *item = PyList_GetItem(obj, i);
-            python_to_lua(L, item);
-            lua_rawseti(L, -2, i + 1);
+    #endif
+    return k >= 1 && k <= n;
+}
+
+/* Make an empty list (keys exactly 1..n) or dict for the table at index */
+static PyObject* qelup_newcontainer(lua_State *L, int index, int *shape) {
+    lua_Integer n = qelup_rawlen(L, index);
+    lua_Integer count = 0;
+    int vtype = LUA_TNIL;   /* common value type, LUA_TNONE once mixed */
+    int ints = 1;
+    int array = 1;
+    int flat = 1;
+    
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+        int t = lua_type(L, -1);
+        if (t == LUA_TTABLE) {
+            flat = 0;
+        } else if (t != vtype) {
+            vtype = vtype == LUA_TNIL ? t : LUA_TNONE;
         }
-    }
-    else if (PyTuple_Check(obj)) {
-        Py_ssize_t size = PyTuple_Size(obj);
-        lua_createtable(L, size, 0);
-        for (Py_ssize_t i = 0; i < size; i++) {
-            PyObject *item = PyTuple_GetItem(obj, i);
-            python_to_lua(L, item);
-            lua_rawseti(L, -2, i + 1);
+        #if LUA_VERSION_NUM >= 503
+        if (t == LUA_TNUMBER && !lua_isinteger(L, -1)) {
+            ints = 0;
         }
-    }
-    else if (PyDict_Check(obj)) {
-        lua_newtable(L);
-        PyObject *key, *value;
-        Py_ssize_t pos = 0;
+        #endif
+        lua_pop(L, 1);
         
-        while (PyDict_Next(obj, &pos, &key, &value)) {
-            python_to_lua(L, key);
-            python_to_lua(L, value);
-            lua_settable(L, -3);
+        if (lua_type(L, -1) == LUA_TTABLE) {
+            flat = 0;
+        }
+        if (array && !qelup_isarraykey(L, n)) {
+            array = 0;
         }
+        if (!array && !flat) {
+            /* A nested dict: nothing more to learn */
+            lua_pop(L, 1);
+            break;
+        }
+        count++;
     }
-    else {
-        /* Wrap as Python object */
-        qelup_newpyobject(L, obj);
+    
+    if (!flat) {
+        *shape = QELUP_SHAPE_NESTED;
+    } else if (!array || count != n) {
+        *shape = QELUP_SHAPE_FLAT;
+    } else if (vtype == LUA_TNUMBER) {
+        #if LUA_VERSION_NUM >= 503
+        *shape = ints ? QELUP_SHAPE_INTS : QELUP_SHAPE_FLOATS;
+        #else
+        (void)ints;
+        *shape = QELUP_SHAPE_FLOATS;
+        #endif
+    } else if (vtype == LUA_TSTRING) {
+        *shape = QELUP_SHAPE_STRINGS;
+    } else {
+        *shape = QELUP_SHAPE_FLAT;
     }
+    
+    /* Empty tables become lists; slots are filled by the traversal */
+    return array && count == n ? PyList_New((Py_ssize_t)n) : PyDict_New();
 }
 
-/* ========================================================================== */
-/* Error Handling */
-/* ========================================================================== */
+/* Fill `list` from array slots 1..n of the table at index, converting each with `expr` */
+#define QELUP_FILL_LIST(list, index, expr) \
+    do { \
+        Py_ssize_t n_ = PyList_GET_SIZE(list); \
+        for (Py_ssize_t i_ = 0; i_ < n_; i_++) { \
+            lua_rawgeti(L, (index), (lua_Integer)i_ + 1); \
+            PyObject *item_ = (expr); \
+            lua_pop(L, 1); \
+            if (item_ == NULL) { \
+                return -1; \
+            } \
+            PyList_SET_ITEM((list), i_, item_); \
+        } \
+    } while (0)
 
-static int handle_python_exception(lua_State *L) {
-    if (!PyErr_Occurred()) {
+/* Fill a container whose table has no nested tables; -1 on error */
+static int qelup_fillflat(lua_State *L, int index, PyObject *obj, int shape) {
+    if (PyDict_Check(obj)) {
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0) {
+            PyObject *key = lua_to_python_scalar(L, -2);
+            PyObject *value = lua_to_python_scalar(L, -1);
+            lua_pop(L, 1);
+            int rc = key != NULL && value != NULL ? PyDict_SetItem(obj, key, value) : -1;
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+            if (rc < 0) {
+                lua_pop(L, 1);
+                return -1;
+            }
+        }
         return 0;
     }
     
-    PyObject *ptype, *pvalue, *ptraceback;
-    PyErr_Fetch(&ptype, &pvalue, &ptraceback);
+    switch (shape) {
+        #if LUA_VERSION_NUM >= 503
+        case QELUP_SHAPE_INTS:
+            QELUP_FILL_LIST(obj, index, PyLong_FromLongLong((long long)lua_tointeger(L, -1)));
+            break;
+        #endif
+        case QELUP_SHAPE_FLOATS:
+            QELUP_FILL_LIST(obj, index, PyFloat_FromDouble(lua_tonumber(L, -1)));
+            break;
+        default:
+            /* Strings go through the scalar path for the bytes setting */
+            QELUP_FILL_LIST(obj, index, lua_to_python_scalar(L, -1));
+            break;
+    }
+    return 0;
+}
+
+/* Find the container already made for the table at index (borrowed) */
+static PyObject* qelup_luamemo_get(lua_State *L, int memo, int index) {
+    lua_pushvalue(L, index);
+    lua_rawget(L, memo);
+    PyObject *obj = (PyObject*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return obj;
+}
+
+static void qelup_luamemo_set(lua_State *L, int memo, int index, PyObject *obj) {
+    lua_pushvalue(L, index);
+    lua_pushlightuserdata(L, obj);
+    lua_rawset(L, memo);
+}
+
+/* Copy the table at (absolute) index and everything reachable from it */
+static PyObject* lua_to_python_table(lua_State *L, int index) {
+    qelup_LuaFrame local[16];
+    qelup_LuaFrame *frames = local;
+    int capacity = 16;
+    int sp = 0;
+    int base = lua_gettop(L);
+    
+    int shape;
+    PyObject *root = qelup_newcontainer(L, index, &shape);
+    if (root == NULL) {
+        return NULL;
+    }
+    if (shape != QELUP_SHAPE_NESTED) {
+        if (qelup_fillflat(L, index, root, shape) < 0) {
+            Py_CLEAR(root);
+        }
+        lua_settop(L, base);
+        return root;
+    }
+    
+    lua_newtable(L);
+    int memo = lua_gettop(L);
+    qelup_luamemo_set(L, memo, index, root);
+    
+    frames[0].obj = root;
+    frames[0].table = index;
+    frames[0].pos = 1;
+    if (PyDict_Check(root)) {
+        lua_pushnil(L);
+    }
+    
+    while (sp >= 0) {
+        qelup_LuaFrame *f = &frames[sp];
+        int is_list = PyList_Check(f->obj);
+        PyObject *key = NULL;
+        
+        /* Advance to the next element, leaving its value on top */
+        if (is_list) {
+            if (f->pos > (lua_Integer)PyList_GET_SIZE(f->obj)) {
+                goto frame_done;
+            }
+            lua_rawgeti(L, f->table, f->pos);
+        } else {
+            if (lua_next(L, f->table) == 0) {
+                goto frame_done;
+            }
+            /* Table keys cannot be hashed as containers; pass them as views */
+            key = lua_type(L, -2) == LUA_TTABLE
+                ? qelup_newluaview(L, -2, -1)
+                : lua_to_python_scalar(L, -2);
+            if (key == NULL) {
+                goto error;
+            }
+        }
+        
+        PyObject *value;
+        int descend = 0;
+        
+        if (lua_type(L, -1) != LUA_TTABLE) {
+            value = lua_to_python_scalar(L, -1);
+        } else if ((value = qelup_luamemo_get(L, memo, -1)) != NULL) {
+            Py_INCREF(value);
+        } else {
+            value = qelup_newcontainer(L, lua_gettop(L), &shape);
+            descend = value != NULL;
+            if (descend && shape != QELUP_SHAPE_NESTED) {
+                /* Flat child: fill it now, but remember it for sharing */
+                descend = 0;
+                qelup_luamemo_set(L, memo, lua_gettop(L), value);
+                if (qelup_fillflat(L, lua_gettop(L), value, shape) < 0) {
+                    Py_CLEAR(value);
+                }
+            }
+        }
+        
+        if (value == NULL) {
+            Py_XDECREF(key);
+            goto error;
+        }
+        
+        if (is_list) {
+            /* SET_ITEM steals; a descended child stays borrowed via the list */
+            PyList_SET_ITEM(f->obj, (Py_ssize_t)(f->pos - 1), value);
+            f->pos++;
+        } else {
+            int rc = PyDict_SetItem(f->obj, key, value);
+            Py_DECREF(key);
+            Py_DECREF(value);
+            if (rc < 0) {
+                goto error;
+            }
+        }
+        
+        if (!descend) {
+            lua_pop(L, 1);
+            continue;
+        }
+        
+        /* Descend into the child; its table stays on the stack meanwhile */
+        if (sp + 1 >= qelup_config.maxdepth) {
+            PyErr_Format(PyExc_ValueError, "Lua table nesting exceeds maximum depth (%d)",
+                         qelup_config.maxdepth);
+            goto error;
+        }
+        if (!lua_checkstack(L, LUA_MINSTACK)) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        if (sp + 1 == capacity) {
+            qelup_LuaFrame *grown = (qelup_LuaFrame*)PyMem_Malloc(2 * capacity * sizeof(qelup_LuaFrame));
+            if (grown == NULL) {
+                PyErr_NoMemory();
+                goto error;
+            }
+            memcpy(grown, frames, capacity * sizeof(qelup_LuaFrame));
+            if (frames != local) {
+                PyMem_Free(frames);
+            }
+            frames = grown;
+            capacity *= 2;
+        }
+        
+        f = &frames[++sp];
+        f->obj = value;
+        f->table = lua_gettop(L);
+        f->pos = 1;
+        qelup_luamemo_set(L, memo, f->table, value);
+        if (!PyList_Check(value)) {
+            lua_pushnil(L);
+        }
+        continue;
+        
+    frame_done:
+        /* Pop the child's table (lua_next already consumed the dict key) */
+        if (sp > 0) {
+            lua_pop(L, 1);
+        }
+        sp--;
+    }
+    
+    if (frames != local) {
+        PyMem_Free(frames);
+    }
+    lua_settop(L, base);
+    return root;
+    
+error:
+    if (frames != local) {
+        PyMem_Free(frames);
+    }
+    lua_settop(L, base);
+    /* The root owns every container created so far */
+    Py_DECREF(root);
+    return NULL;
+}
+
+/* Convert with tables either copied (lazy = 0) or passed as views */
+static PyObject* lua_to_python_mode(lua_State *L, int index, int lazy) {
+    QELUP_STAT_START(t0);
+    PyObject *obj;
+    
+    if (lua_type(L, index) != LUA_TTABLE) {
+        obj = lua_to_python_scalar(L, index);
+    } else if (lazy) {
+        obj = qelup_newluaview(L, index, -1);
+    } else {
+        obj = lua_to_python_table(L, qelup_absindex(L, index));
+    }
+    
+    QELUP_STAT_STOP(t0, QELUP_STAT_TOPY);
+    return obj;
+}
+
+/* ========================================================================== */
+/* Type Conversion: Python -> Lua */
+/* ========================================================================== */
+
+/* Same traversal in the other direction; the memo is keyed by PyObject* */
+
+/* One list, tuple or dict being copied into a table */
+typedef struct {
+    PyObject *obj;          /* container being copied (strong reference) */
+    Py_ssize_t pos;         /* next index, or PyDict_Next position */
+    int table;              /* stack index of the destination table */
+} qelup_PyFrame;
+
+static int python_to_lua(lua_State *L, PyObject *obj) {
+    return python_to_lua_mode(L, obj, qelup_config.proxy);
+}
+
+static int qelup_iscontainer(PyObject *obj) {
+    return PyList_Check(obj) || PyTuple_Check(obj) || PyDict_Check(obj);
+}
+
+/* Push an empty table presized for a container */
+static void qelup_pushcontainer(lua_State *L, PyObject *obj) {
+    if (PyDict_Check(obj)) {
+        lua_createtable(L, 0, (int)PyDict_Size(obj));
+    } else {
+        lua_createtable(L, (int)PySequence_Fast_GET_SIZE(obj), 0);
+    }
+}
+
+/* Push the table already made for a container; returns 0 if none */
+static int qelup_pymemo_get(lua_State *L, int memo, PyObject *obj) {
+    lua_pushlightuserdata(L, obj);
+    lua_rawget(L, memo);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+static void qelup_pymemo_set(lua_State *L, int memo, PyObject *obj) {
+    lua_pushlightuserdata(L, obj);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, memo);
+}
+
+/*
+    Push an exact bool, int, float or str, skipping the generic dispatch;
+    returns 0 (nothing pushed) for anything else.
+*/
+static int qelup_pushexact(lua_State *L, PyObject *obj) {
+    #ifdef QELUP_PY3
+    PyTypeObject *type = Py_TYPE(obj);
+    
+    if (type == &PyFloat_Type) {
+        lua_pushnumber(L, PyFloat_AS_DOUBLE(obj));
+    } else if (type == &PyLong_Type) {
+        int overflow = 0;
+        long long value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow != 0) {
+            return 0;
+        }
+        lua_pushinteger(L, (lua_Integer)value);
+    } else if (type == &PyUnicode_Type) {
+        Py_ssize_t len = 0;
+        const char *str = PyUnicode_AsUTF8AndSize(obj, &len);
+        if (str == NULL) {
+            PyErr_Clear();
+            return 0;
+        }
+        lua_pushlstring(L, str, (size_t)len);
+        QELUP_STAT_ADD(bytes_tolua, (size_t)len);
+    } else if (type == &PyBool_Type) {
+        lua_pushboolean(L, obj == Py_True);
+    } else {
+        return 0;
+    }
+    return 1;
+    #else
+    (void)L;
+    (void)obj;
+    return 0;
+    #endif
+}
+
+/*
+    Copy the run of exact scalars starting at the frame's position straight
+    into its table. Returns 1 once the container is exhausted; otherwise the
+    frame is left at the first element that needs the generic path.
+*/
+static int qelup_copyscalars(lua_State *L, qelup_PyFrame *f) {
+    if (PyDict_Check(f->obj)) {
+        PyObject *key, *value;
+        Py_ssize_t pos = f->pos;
+        while (PyDict_Next(f->obj, &pos, &key, &value)) {
+            if (!qelup_pushexact(L, key)) {
+                return 0;
+            }
+            if (!qelup_pushexact(L, value)) {
+                lua_pop(L, 1);
+                return 0;
+            }
+            lua_rawset(L, f->table);
+            f->pos = pos;
+        }
+        return 1;
+    }
+    
+    PyObject **items = PySequence_Fast_ITEMS(f->obj);
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(f->obj);
+    for (; f->pos < n; f->pos++) {
+        if (!qelup_pushexact(L, items[f->pos])) {
+            return 0;
+        }
+        lua_rawseti(L, f->table, (lua_Integer)f->pos + 1);
+    }
+    return 1;
+}
+
+/* Push anything except an eagerly copied container; returns 0 for those */
+static int python_to_lua_scalar(lua_State *L, PyObject *obj, int lazy) {
+    if (obj == NULL || obj == Py_None) {
+        lua_pushnil(L);
+    }
+    else if (PyBool_Check(obj)) {
+        lua_pushboolean(L, obj == Py_True);
+    }
+    else if (PyInt_Check(obj)) {
+        int overflow = 0;
+        long long value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow != 0) {
+            /* Beyond 64 bits: fall back to the nearest double */
+            lua_pushnumber(L, PyLong_AsDouble(obj));
+        } else {
+            lua_pushinteger(L, (lua_Integer)value);
+        }
+    }
+    else if (PyFloat_Check(obj)) {
+        lua_pushnumber(L, PyFloat_AsDouble(obj));
+    }
+    else if (PyString_Check(obj)) {
+        Py_ssize_t len = 0;
+        const char *str = qelup_pystring(obj, &len);
+        if (str == NULL) {
+            PyErr_Clear();
+            lua_pushnil(L);
+        } else {
+            lua_pushlstring(L, str, (size_t)len);
+            QELUP_STAT_ADD(bytes_tolua, (size_t)len);
+        }
+    }
+    else if (PyBytes_Check(obj)) {
+        lua_pushlstring(L, PyBytes_AS_STRING(obj), (size_t)PyBytes_GET_SIZE(obj));
+        QELUP_STAT_ADD(bytes_tolua, (size_t)PyBytes_GET_SIZE(obj));
+    }
+    else if (PyByteArray_Check(obj)) {
+        lua_pushlstring(L, PyByteArray_AS_STRING(obj), (size_t)PyByteArray_GET_SIZE(obj));
+        QELUP_STAT_ADD(bytes_tolua, (size_t)PyByteArray_GET_SIZE(obj));
+    }
+    else if (qelup_iscontainer(obj)) {
+        if (!lazy) {
+            return 0;
+        }
+        qelup_newproxy(L, obj);
+    }
+    else if ((Py_TYPE(obj) == &qelup_LuaTableType || Py_TYPE(obj) == &qelup_LuaListType
+              || Py_TYPE(obj) == &qelup_LuaFunctionType)
+             && qelup_mainthread(L) == ((qelup_LuaRef*)obj)->L) {
+        /* Views and functions round-trip as the original Lua value */
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ((qelup_LuaRef*)obj)->ref);
+    }
+    else {
+        /* Wrap as Python object */
+        qelup_newpyobject(L, obj);
+    }
+    return 1;
+}
+
+/* Copy a container and everything reachable from it into Lua tables */
+static int python_to_lua_container(lua_State *L, PyObject *obj) {
+    qelup_PyFrame local[16];
+    qelup_PyFrame *frames = local;
+    int capacity = 16;
+    int sp = 0;
+    int base = lua_gettop(L);
+    
+    if (!lua_checkstack(L, LUA_MINSTACK)) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    
+    qelup_pushcontainer(L, obj);
+    frames[0].obj = obj;
+    frames[0].pos = 0;
+    frames[0].table = lua_gettop(L);
+    
+    /* Containers of plain scalars finish here and never need the memo */
+    if (qelup_copyscalars(L, &frames[0])) {
+        return 0;
+    }
+    
+    lua_newtable(L);
+    int memo = lua_gettop(L);
+    lua_pushvalue(L, frames[0].table);
+    qelup_pymemo_set(L, memo, obj);
+    lua_pop(L, 1);
+    Py_INCREF(obj);
+    
+    while (sp >= 0) {
+        qelup_PyFrame *f = &frames[sp];
+        PyObject *item;
+        PyObject *key = NULL;
+        
+        if (qelup_copyscalars(L, f)) {
+            goto frame_done;
+        }
+        
+        /* Fetch the next element; dict keys are pushed right away */
+        if (PyDict_Check(f->obj)) {
+            if (!PyDict_Next(f->obj, &f->pos, &key, &item)) {
+                goto frame_done;
+            }
+            /* Keys are hashable, so only tuples need a (shallow) copy */
+            if (!python_to_lua_scalar(L, key, 0) && python_to_lua_container(L, key) < 0) {
+                goto error;
+            }
+        } else {
+            if (f->pos >= PySequence_Fast_GET_SIZE(f->obj)) {
+                goto frame_done;
+            }
+            item = PySequence_Fast_GET_ITEM(f->obj, f->pos);
+            f->pos++;
+        }
+        
+        int descend = 0;
+        if (!python_to_lua_scalar(L, item, 0) && !qelup_pymemo_get(L, memo, item)) {
+            qelup_pushcontainer(L, item);
+            qelup_pymemo_set(L, memo, item);
+            descend = 1;
+        }
+        
+        /* Store the value; a new child table stays on top to be filled */
+        if (key != NULL) {
+            if (descend) {
+                lua_pushvalue(L, -2);
+                lua_pushvalue(L, -2);
+                lua_rawset(L, f->table);
+                lua_remove(L, -2);
+            } else {
+                lua_rawset(L, f->table);
+            }
+        } else {
+            if (descend) {
+                lua_pushvalue(L, -1);
+            }
+            lua_rawseti(L, f->table, (lua_Integer)f->pos);
+        }
+        
+        if (!descend) {
+            continue;
+        }
+        
+        if (sp + 1 >= qelup_config.maxdepth) {
+            PyErr_Format(PyExc_ValueError, "Python object nesting exceeds maximum depth (%d)",
+                         qelup_config.maxdepth);
+            goto error;
+        }
+        if (!lua_checkstack(L, LUA_MINSTACK)) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        if (sp + 1 == capacity) {
+            qelup_PyFrame *grown = (qelup_PyFrame*)PyMem_Malloc(2 * capacity * sizeof(qelup_PyFrame));
+            if (grown == NULL) {
+                PyErr_NoMemory();
+                goto error;
+            }
+            memcpy(grown, frames, capacity * sizeof(qelup_PyFrame));
+            if (frames != local) {
+                PyMem_Free(frames);
+            }
+            frames = grown;
+            capacity *= 2;
+        }
+        
+        Py_INCREF(item);
+        f = &frames[++sp];
+        f->obj = item;
+        f->pos = 0;
+        f->table = lua_gettop(L);
+        continue;
+        
+    frame_done:
+        Py_DECREF(f->obj);
+        if (sp > 0) {
+            lua_pop(L, 1);
+        }
+        sp--;
+    }
+    
+    if (frames != local) {
+        PyMem_Free(frames);
+    }
+    /* Leave only the root table: drop the memo above it */
+    lua_remove(L, memo);
+    return 0;
+    
+error:
+    for (; sp >= 0; sp--) {
+        Py_DECREF(frames[sp].obj);
+    }
+    if (frames != local) {
+        PyMem_Free(frames);
+    }
+    lua_settop(L, base);
+    return -1;
+}
+
+/*
+    Push a Python value; with lazy set, containers become proxies. Returns 0,
+    or -1 with a Python error set (nothing pushed) if a copy fails.
+*/
+static int python_to_lua_mode(lua_State *L, PyObject *obj, int lazy) {
+    QELUP_STAT_START(t0);
+    int rc = 0;
+    
+    if (!python_to_lua_scalar(L, obj, lazy)) {
+        rc = python_to_lua_container(L, obj);
+    }
+    
+    QELUP_STAT_STOP(t0, QELUP_STAT_TOLUA);
+    return rc;
+}
+
+/* ========================================================================== */
+/* Lua Table Views (Python side) */
+/* ========================================================================== */
+
+/*
+    qelup.LuaTable (Mapping) and qelup.LuaList (Sequence) wrap a registry
+    reference and read the Lua table on access instead of copying it. They
+    may only be used while a bridge call from the owning Lua state is active
+    on the current OS thread; outside of that they raise RuntimeError.
+*/
+
+static int qelup_types_ready = 0;
+
+/* Lua state to use for a view, or NULL with a Python error set */
+static lua_State* luaref_state(qelup_LuaRef *self) {
+    lua_State *L = qelup_current_L;
+    
+    if (L == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Lua value accessed outside of a Lua call");
+        return NULL;
+    }
+    if (qelup_mainthread(L) != self->L) {
+        PyErr_SetString(PyExc_RuntimeError, "Lua value belongs to a different Lua state");
+        return NULL;
+    }
+    if (!lua_checkstack(L, LUA_MINSTACK)) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return L;
+}
+
+static char qelup_state_key;    /* registry: userdata holding the qelup_StateRec */
+
+/* Bookkeeping of the state L belongs to, or NULL before luaopen */
+static qelup_StateRec* qelup_staterec(lua_State *L) {
+    qelup_getregistry(L, &qelup_state_key);
+    qelup_StateRec **slot = (qelup_StateRec**)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return slot != NULL ? *slot : NULL;
+}
+
+/* Drop one user; the last one frees the bookkeeping */
+static void qelup_releasestate(qelup_StateRec *rec) {
+    if (--rec->users == 0) {
+        free(rec->refs);
+        free(rec);
+    }
+}
+
+static int qelup_growrefs(qelup_StateRec *rec) {
+    int cap = rec->cap > 0 ? rec->cap * 2 : 16;
+    int *refs = (int*)realloc(rec->refs, (size_t)cap * sizeof(int));
+    if (refs == NULL) {
+        return -1;
+    }
+    rec->refs = refs;
+    rec->cap = cap;
+    return 0;
+}
+
+/* Release references queued for the state L belongs to (GIL held) */
+static void qelup_drain_unrefs(lua_State *L) {
+    qelup_StateRec *rec = qelup_staterec(L);
+    if (rec == NULL || rec->nrefs == 0) {
+        return;
+    }
+    for (int i = 0; i < rec->nrefs; i++) {
+        luaL_unref(L, LUA_REGISTRYINDEX, rec->refs[i]);
+    }
+    qelup_unref_pending -= rec->nrefs;
+    rec->nrefs = 0;
+}
+
+/* Finalizer of the state's bookkeeping userdata: runs from lua_close */
+static int qelup_state_gc(lua_State *L) {
+    qelup_StateRec **slot = (qelup_StateRec**)lua_touserdata(L, 1);
+    qelup_StateRec *rec = *slot;
+    if (rec == NULL) {
+        return 0;
+    }
+    *slot = NULL;
+    
+    /* Views are freed under the GIL, so the bookkeeping changes under it too */
+    int locked = Py_IsInitialized();
+    PyGILState_STATE state = locked ? PyGILState_Ensure() : PyGILState_UNLOCKED;
+    rec->closed = 1;
+    qelup_unref_pending -= rec->nrefs;
+    rec->nrefs = 0;
+    qelup_releasestate(rec);
+    if (locked) {
+        PyGILState_Release(state);
+    }
+    return 0;
+}
+
+/* Create the state's bookkeeping once per Lua state (from luaopen) */
+static void qelup_openstate(lua_State *L) {
+    if (qelup_staterec(L) != NULL) {
+        return;
+    }
+    qelup_StateRec *rec = (qelup_StateRec*)calloc(1, sizeof(qelup_StateRec));
+    if (rec == NULL) {
+        luaL_error(L, "out of memory");
+    }
+    rec->users = 1;
+    
+    qelup_StateRec **slot = (qelup_StateRec**)lua_newuserdata(L, sizeof(qelup_StateRec*));
+    *slot = rec;
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, qelup_state_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    qelup_setregistry(L, &qelup_state_key);
+}
+
+/* Reference the value at index from a new view object */
+static void qelup_initluaref(lua_State *L, qelup_LuaRef *self, int index) {
+    lua_pushvalue(L, index);
+    self->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    self->L = qelup_mainthread(L);
+    self->owner = qelup_staterec(L);
+    if (self->owner != NULL) {
+        self->owner->users++;
+    }
+}
+
+/* Wrap the table at index; sequence < 0 picks by whether t[1] is set */
+static int qelup_ready_types(void);
+
+static PyObject* qelup_newluaview(lua_State *L, int index, int sequence) {
+    index = qelup_absindex(L, index);
+    
+    if (qelup_ready_types() < 0) {
+        return NULL;
+    }
+    
+    if (sequence < 0) {
+        lua_rawgeti(L, index, 1);
+        sequence = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+    }
+    
+    qelup_LuaRef *self = PyObject_New(qelup_LuaRef,
+                                      sequence ? &qelup_LuaListType : &qelup_LuaTableType);
+    if (self == NULL) {
+        return NULL;
+    }
+    
+    qelup_initluaref(L, self, index);
+    return (PyObject*)self;
+}
+
+static void luaref_dealloc(qelup_LuaRef *self) {
+    qelup_StateRec *rec = self->owner;
+    lua_State *L = qelup_current_L;
+    
+    if (rec == NULL || rec->closed) {
+        /* The registry went away with the state */
+    } else if (L != NULL && qelup_staterec(L) == rec) {
+        /* Inside a bridge call from the owning state on this thread */
+        luaL_unref(L, LUA_REGISTRYINDEX, self->ref);
+    } else if (rec->nrefs < rec->cap || qelup_growrefs(rec) == 0) {
+        rec->refs[rec->nrefs++] = self->ref;
+        qelup_unref_pending++;
+    }
+    /* Out of memory: the registry slot leaks until the state closes */
+    
+    if (rec != NULL) {
+        qelup_releasestate(rec);
+    }
+    PyObject_Del(self);
+}
+
+static PyObject* luaref_repr(qelup_LuaRef *self) {
+    return PyString_FromFormat("<%s ref=%d>", Py_TYPE(self)->tp_name, self->ref);
+}
+
+/* Push the referenced table; returns the Lua state or NULL */
+static lua_State* luaref_push(qelup_LuaRef *self) {
+    lua_State *L = luaref_state(self);
+    if (L != NULL) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, self->ref);
+    }
+    return L;
+}
+
+/* Convert a Python key to a Lua value and look it up; leaves table and value */
+static lua_State* luaref_lookup(qelup_LuaRef *self, PyObject *key) {
+    lua_State *L = luaref_push(self);
+    if (L != NULL) {
+        if (python_to_lua_mode(L, key, 0) < 0) {
+            lua_pop(L, 1);
+            return NULL;
+        }
+        lua_rawget(L, -2);
+    }
+    return L;
+}
+
+static Py_ssize_t luaref_length(qelup_LuaRef *self) {
+    lua_State *L = luaref_push(self);
+    if (L == NULL) {
+        return -1;
+    }
+    
+    Py_ssize_t n = 0;
+    if (Py_TYPE(self) == &qelup_LuaListType) {
+        n = (Py_ssize_t)qelup_rawlen(L, -1);
+    } else {
+        lua_pushnil(L);
+        while (lua_next(L, -2) != 0) {
+            n++;
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    return n;
+}
+
+/* Sequence item (0-based, negative indexes already adjusted) */
+static PyObject* luaref_item(qelup_LuaRef *self, Py_ssize_t i) {
+    lua_State *L = luaref_push(self);
+    if (L == NULL) {
+        return NULL;
+    }
+    
+    if (i < 0 || i >= (Py_ssize_t)qelup_rawlen(L, -1)) {
+        lua_pop(L, 1);
+        PyErr_SetString(PyExc_IndexError, "Lua list index out of range");
+        return NULL;
+    }
+    
+    lua_rawgeti(L, -1, (lua_Integer)i + 1);
+    PyObject *value = lua_to_python_mode(L, -1, 1);
+    lua_pop(L, 2);
+    return value;
+}
+
+static PyObject* luaref_subscript(qelup_LuaRef *self, PyObject *key) {
+    if (Py_TYPE(self) == &qelup_LuaListType) {
+        if (!PyIndex_Check(key)) {
+            PyErr_SetString(PyExc_TypeError, "Lua list indices must be integers");
+            return NULL;
+        }
+        Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (i == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (i < 0) {
+            Py_ssize_t n = luaref_length(self);
+            if (n < 0) {
+                return NULL;
+            }
+            i += n;
+        }
+        return luaref_item(self, i);
+    }
+    
+    lua_State *L = luaref_lookup(self, key);
+    if (L == NULL) {
+        return NULL;
+    }
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 2);
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    
+    PyObject *value = lua_to_python_mode(L, -1, 1);
+    lua_pop(L, 2);
+    return value;
+}
+
+/* Assignment writes straight into the Lua table; deletion stores nil */
+static int luaref_ass_subscript(qelup_LuaRef *self, PyObject *key, PyObject *value) {
+    lua_State *L = luaref_push(self);
+    if (L == NULL) {
+        return -1;
+    }
+    
+    if (Py_TYPE(self) == &qelup_LuaListType) {
+        Py_ssize_t i = PyIndex_Check(key) ? PyNumber_AsSsize_t(key, PyExc_IndexError) : -1;
+        if (PyErr_Occurred() || i < 0) {
+            lua_pop(L, 1);
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_IndexError, "Lua list index out of range");
+            }
+            return -1;
+        }
+        lua_pushinteger(L, (lua_Integer)i + 1);
+    } else if (python_to_lua_mode(L, key, 0) < 0) {
+        lua_pop(L, 1);
+        return -1;
+    } else if (lua_isnil(L, -1) || (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1))) {
+        /* lua_rawset would raise and longjmp through the Python frames */
+        lua_pop(L, 2);
+        PyErr_SetString(PyExc_TypeError, "Lua table keys cannot be nil or NaN");
+        return -1;
+    }
+    
+    if (value == NULL) {
+        lua_pushnil(L);
+    } else if (python_to_lua_mode(L, value, 0) < 0) {
+        lua_pop(L, 2);
+        return -1;
+    }
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    return 0;
+}
+
+static int luaref_contains(qelup_LuaRef *self, PyObject *item) {
+    if (Py_TYPE(self) == &qelup_LuaTableType) {
+        lua_State *L = luaref_lookup(self, item);
+        if (L == NULL) {
+            return -1;
+        }
+        int found = !lua_isnil(L, -1);
+        lua_pop(L, 2);
+        return found;
+    }
+    
+    Py_ssize_t n = luaref_length(self);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *value = luaref_item(self, i);
+        if (value == NULL) {
+            return -1;
+        }
+        int eq = PyObject_RichCompareBool(value, item, Py_EQ);
+        Py_DECREF(value);
+        if (eq != 0) {
+            return eq;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+/* Collect keys, values or items of a mapping view into a list (what: 0, 1, 2) */
+static PyObject* luaref_collect(qelup_LuaRef *self, int what) {
+    lua_State *L = luaref_push(self);
+    if (L == NULL) {
+        return NULL;
+    }
+    
+    PyObject *list = PyList_New(0);
+    lua_pushnil(L);
+    while (list != NULL && lua_next(L, -2) != 0) {
+        PyObject *key = what != 1 ? lua_to_python_mode(L, -2, 1) : NULL;
+        PyObject *value = what != 0 ? lua_to_python_mode(L, -1, 1) : NULL;
+        PyObject *entry = what == 0 ? key : what == 1 ? value :
+                          (key != NULL && value != NULL) ? PyTuple_Pack(2, key, value) : NULL;
+        
+        if (entry == NULL || PyList_Append(list, entry) < 0) {
+            Py_CLEAR(list);
+            lua_pop(L, 1);
+        }
+        if (what == 2) {
+            Py_XDECREF(entry);
+        }
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return list;
+}
+
+static PyObject* luaref_keys(qelup_LuaRef *self, PyObject *unused) {
+    (void)unused;
+    return luaref_collect(self, 0);
+}
+
+static PyObject* luaref_values(qelup_LuaRef *self, PyObject *unused) {
+    (void)unused;
+    return luaref_collect(self, 1);
+}
+
+static PyObject* luaref_items(qelup_LuaRef *self, PyObject *unused) {
+    (void)unused;
+    return luaref_collect(self, 2);
+}
+
+static PyObject* luaref_get(qelup_LuaRef *self, PyObject *args) {
+    PyObject *key, *fallback = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O:get", &key, &fallback)) {
+        return NULL;
+    }
+    
+    lua_State *L = luaref_lookup(self, key);
+    if (L == NULL) {
+        return NULL;
+    }
+    
+    PyObject *value;
+    if (lua_isnil(L, -1)) {
+        Py_INCREF(fallback);
+        value = fallback;
+    } else {
+        value = lua_to_python_mode(L, -1, 1);
+    }
+    lua_pop(L, 2);
+    return value;
+}
+
+/* Mappings iterate their keys; lists use the __getitem__ protocol */
+static PyObject* luaref_iter(qelup_LuaRef *self) {
+    if (Py_TYPE(self) == &qelup_LuaListType) {
+        return PySeqIter_New((PyObject*)self);
+    }
+    
+    PyObject *keys = luaref_collect(self, 0);
+    if (keys == NULL) {
+        return NULL;
+    }
+    PyObject *iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+/* Full copy into a plain list or dict */
+static PyObject* luaref_copy(qelup_LuaRef *self, PyObject *unused) {
+    (void)unused;
+    lua_State *L = luaref_push(self);
+    if (L == NULL) {
+        return NULL;
+    }
+    PyObject *copy = lua_to_python_mode(L, -1, 0);
+    lua_pop(L, 1);
+    return copy;
+}
+
+static PyMappingMethods luaref_as_mapping = {
+    (lenfunc)luaref_length,
+    (binaryfunc)luaref_subscript,
+    (objobjargproc)luaref_ass_subscript
+};
+
+static PySequenceMethods luaref_as_sequence = {
+    (lenfunc)luaref_length,         /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    (ssizeargfunc)luaref_item,      /* sq_item */
+    0,                              /* was_sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* was_sq_ass_slice */
+    (objobjproc)luaref_contains,    /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0                               /* sq_inplace_repeat */
+};
+
+/* Mapping views only answer `in`; an sq_item would make them pass PySequence_Check */
+static PySequenceMethods luatable_as_sequence = {
+    0,                              /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    0,                              /* sq_item */
+    0,                              /* was_sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* was_sq_ass_slice */
+    (objobjproc)luaref_contains,    /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0                               /* sq_inplace_repeat */
+};
+
+static PyMethodDef luatable_methods[] = {
+    {"keys", (PyCFunction)luaref_keys, METH_NOARGS, "List of keys"},
+    {"values", (PyCFunction)luaref_values, METH_NOARGS, "List of values"},
+    {"items", (PyCFunction)luaref_items, METH_NOARGS, "List of (key, value) pairs"},
+    {"get", (PyCFunction)luaref_get, METH_VARARGS, "Value for key, or default"},
+    {"copy", (PyCFunction)luaref_copy, METH_NOARGS, "Copy into a dict"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMethodDef lualist_methods[] = {
+    {"copy", (PyCFunction)luaref_copy, METH_NOARGS, "Copy into a list"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject qelup_LuaTableType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qelup.LuaTable",
+    .tp_basicsize = sizeof(qelup_LuaRef),
+    .tp_dealloc = (destructor)luaref_dealloc,
+    .tp_repr = (reprfunc)luaref_repr,
+    .tp_as_sequence = &luatable_as_sequence,
+    .tp_as_mapping = &luaref_as_mapping,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Lazy Mapping view of a Lua table",
+    .tp_iter = (getiterfunc)luaref_iter,
+    .tp_methods = luatable_methods,
+};
+
+static PyTypeObject qelup_LuaListType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qelup.LuaList",
+    .tp_basicsize = sizeof(qelup_LuaRef),
+    .tp_dealloc = (destructor)luaref_dealloc,
+    .tp_repr = (reprfunc)luaref_repr,
+    .tp_as_sequence = &luaref_as_sequence,
+    .tp_as_mapping = &luaref_as_mapping,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Lazy Sequence view of a Lua array",
+    .tp_iter = (getiterfunc)luaref_iter,
+    .tp_methods = lualist_methods,
+};
+
+/* Register a view type with a collections.abc class so isinstance() works */
+static void qelup_register_abc(const char *abc, PyTypeObject *type) {
+    #ifdef QELUP_PY3
+    PyObject *module = PyImport_ImportModule("collections.abc");
+    #else
+    PyObject *module = PyImport_ImportModule("collections");
+    #endif
+    PyObject *cls = module != NULL ? PyObject_GetAttrString(module, abc) : NULL;
+    PyObject *result = cls != NULL ? PyObject_CallMethod(cls, "register", "O", (PyObject*)type) : NULL;
+    
+    Py_XDECREF(result);
+    Py_XDECREF(cls);
+    Py_XDECREF(module);
+    PyErr_Clear();
+}
+
+/* Ready the Python types defined by the bridge (GIL held) */
+static int qelup_ready_types(void) {
+    if (qelup_types_ready) {
+        return 0;
+    }
+    if (PyType_Ready(&qelup_LuaTableType) < 0 || PyType_Ready(&qelup_LuaListType) < 0
+        || PyType_Ready(&qelup_LuaFunctionType) < 0) {
+        return -1;
+    }
+    qelup_register_abc("Mapping", &qelup_LuaTableType);
+    qelup_register_abc("Sequence", &qelup_LuaListType);
+    qelup_types_ready = 1;
+    return 0;
+}
+
+/* ========================================================================== */
+/* Lua Functions and the lua Module (Python side) */
+/* ========================================================================== */
+
+/*
+    Lua functions reach Python as qelup.LuaFunction, a registry reference
+    that calls back into Lua with converted arguments, so callbacks such as
+    sorted(key=...) or event handlers stay in Python. The `lua` module in
+    sys.modules reaches Lua globals: lua.call("string.format", ...),
+    lua.globals() and lua.<name> for a global. Like table views, both only
+    work while a bridge call from the owning Lua state is active.
+*/
+
+/* Raised in Python for errors thrown by Lua code */
+static PyObject *qelup_LuaError = NULL;
+static PyObject *qelup_CallTimeout = NULL;   /* lua.CallTimeout, see Deadlines */
+static char qelup_timeout_key;  /* registry: the Lua error value for a timeout */
+#define QELUP_TIMEOUT_MSG "Python call timed out"
+
+static PyObject* qelup_newluafunction(lua_State *L, int index) {
+    index = qelup_absindex(L, index);
+    
+    if (qelup_ready_types() < 0) {
+        return NULL;
+    }
+    
+    qelup_LuaRef *self = PyObject_New(qelup_LuaRef, &qelup_LuaFunctionType);
+    if (self == NULL) {
+        return NULL;
+    }
+    
+    qelup_initluaref(L, self, index);
+    return (PyObject*)self;
+}
+
+/* Call the function below the arguments at stack [base + 2, top]; pops all */
+static PyObject* qelup_calllua(lua_State *L, int base, PyObject *args) {
+    Py_ssize_t n = PyTuple_GET_SIZE(args);
+    if (!lua_checkstack(L, (int)n + LUA_MINSTACK)) {
+        lua_settop(L, base);
+        return PyErr_NoMemory();
+    }
+    
+    for (Py_ssize_t i = 0; i < n; i++) {
+        if (python_to_lua(L, PyTuple_GET_ITEM(args, i)) < 0) {
+            lua_settop(L, base);
+            return NULL;
+        }
+    }
+    
+    if (lua_pcall(L, (int)n, LUA_MULTRET, 0) != 0) {
+        PyObject *error = qelup_LuaError != NULL ? qelup_LuaError : PyExc_RuntimeError;
+        qelup_getregistry(L, &qelup_timeout_key);
+        int timeout = qelup_CallTimeout != NULL && lua_rawequal(L, -1, -2);
+        lua_pop(L, 1);
+        
+        if (timeout) {
+            /* A nested call timed out: keep unwinding the outer Python frames */
+            PyErr_SetString(qelup_CallTimeout, QELUP_TIMEOUT_MSG);
+        } else if (lua_type(L, -1) == LUA_TSTRING || lua_type(L, -1) == LUA_TNUMBER) {
+            PyErr_SetString(error, lua_tostring(L, -1));
+        } else {
+            PyErr_Format(error, "(error object is a %s value)", luaL_typename(L, -1));
+        }
+        lua_settop(L, base);
+        return NULL;
+    }
+    
+    /* No results is None, one is the value, several are a tuple */
+    int nres = lua_gettop(L) - base;
+    PyObject *result;
+    if (nres == 0) {
+        Py_INCREF(Py_None);
+        result = Py_None;
+    } else if (nres == 1) {
+        result = lua_to_python(L, -1);
+    } else {
+        result = PyTuple_New(nres);
+        for (int i = 0; result != NULL && i < nres; i++) {
+            PyObject *item = lua_to_python(L, base + 1 + i);
+            if (item == NULL) {
+                Py_CLEAR(result);
+            } else {
+                PyTuple_SET_ITEM(result, i, item);
+            }
+        }
+    }
+    lua_settop(L, base);
+    return result;
+}
+
+static PyObject* luafunction_call(qelup_LuaRef *self, PyObject *args, PyObject *kwargs) {
+    if (kwargs != NULL && PyDict_Size(kwargs) > 0) {
+        PyErr_SetString(PyExc_TypeError, "Lua functions take no keyword arguments");
+        return NULL;
+    }
+    
+    lua_State *L = luaref_state(self);
+    if (L == NULL) {
+        return NULL;
+    }
+    
+    int base = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, self->ref);
+    return qelup_calllua(L, base, args);
+}
+
+static PyTypeObject qelup_LuaFunctionType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qelup.LuaFunction",
+    .tp_basicsize = sizeof(qelup_LuaRef),
+    .tp_dealloc = (destructor)luaref_dealloc,
+    .tp_repr = (reprfunc)luaref_repr,
+    .tp_call = (ternaryfunc)luafunction_call,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Callable reference to a Lua function",
+};
+
+/* Lua state for the lua module, or NULL with a Python error set */
+static lua_State* qelup_luamodule_state(void) {
+    lua_State *L = qelup_current_L;
+    if (L == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "lua module used outside of a Lua call");
+        return NULL;
+    }
+    if (!lua_checkstack(L, LUA_MINSTACK)) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return L;
+}
+
+static void qelup_pushglobals(lua_State *L) {
+    #if LUA_VERSION_NUM >= 502
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+    #else
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    #endif
+}
+
+/* Push the global at a dotted path with raw lookups (never raises in Lua) */
+static int qelup_pushglobal(lua_State *L, const char *path) {
+    qelup_pushglobals(L);
+    while (*path != '\0') {
+        const char *dot = strchr(path, '.');
+        size_t len = dot != NULL ? (size_t)(dot - path) : strlen(path);
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            PyErr_Format(PyExc_AttributeError, "Lua value before '%s' is not a table", path);
+            return -1;
+        }
+        lua_pushlstring(L, path, len);
+        lua_rawget(L, -2);
+        lua_remove(L, -2);
+        path += len + (dot != NULL ? 1 : 0);
+    }
+    return 0;
+}
+
+/* lua.call(name, *args) calls the global function at a dotted path */
+static PyObject* luamodule_call(PyObject *module, PyObject *args) {
+    (void)module;
+    Py_ssize_t n = PyTuple_GET_SIZE(args);
+    if (n < 1 || !PyString_Check(PyTuple_GET_ITEM(args, 0))) {
+        PyErr_SetString(PyExc_TypeError, "lua.call() expects a global name and arguments");
+        return NULL;
+    }
+    
+    lua_State *L = qelup_luamodule_state();
+    const char *name = PyString_AsString(PyTuple_GET_ITEM(args, 0));
+    if (L == NULL || name == NULL) {
+        return NULL;
+    }
+    
+    int base = lua_gettop(L);
+    if (qelup_pushglobal(L, name) < 0) {
+        return NULL;
+    }
+    if (lua_isnil(L, -1)) {
+        lua_settop(L, base);
+        PyErr_Format(PyExc_NameError, "Lua global '%s' is not defined", name);
+        return NULL;
+    }
+    
+    PyObject *rest = PyTuple_GetSlice(args, 1, n);
+    if (rest == NULL) {
+        lua_settop(L, base);
+        return NULL;
+    }
+    PyObject *result = qelup_calllua(L, base, rest);
+    Py_DECREF(rest);
+    return result;
+}
+
+/* lua.globals() is a live view of the global table */
+static PyObject* luamodule_globals(PyObject *module, PyObject *unused) {
+    (void)module;
+    (void)unused;
+    lua_State *L = qelup_luamodule_state();
+    if (L == NULL) {
+        return NULL;
+    }
+    qelup_pushglobals(L);
+    PyObject *view = qelup_newluaview(L, -1, 0);
+    lua_pop(L, 1);
+    return view;
+}
+
+/* lua.<name> reads a global (module __getattr__, Python 3.7+) */
+static PyObject* luamodule_getattr(PyObject *module, PyObject *name) {
+    (void)module;
+    const char *key = PyString_Check(name) ? PyString_AsString(name) : NULL;
+    if (key == NULL || key[0] == '_') {
+        if (!PyErr_Occurred()) {
+            PyErr_SetObject(PyExc_AttributeError, name);
+        }
+        return NULL;
+    }
+    
+    lua_State *L = qelup_luamodule_state();
+    if (L == NULL) {
+        return NULL;
+    }
+    if (qelup_pushglobal(L, key) < 0) {
+        return NULL;
+    }
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        PyErr_Format(PyExc_AttributeError, "Lua global '%s' is not defined", key);
+        return NULL;
+    }
+    PyObject *value = lua_to_python_mode(L, -1, 1);
+    lua_pop(L, 1);
+    return value;
+}
+
+static PyMethodDef luamodule_methods[] = {
+    {"call", (PyCFunction)luamodule_call, METH_VARARGS, "Call a Lua global function by dotted name"},
+    {"globals", (PyCFunction)luamodule_globals, METH_NOARGS, "Live view of the Lua global table"},
+    {"__getattr__", (PyCFunction)luamodule_getattr, METH_O, "Read a Lua global"},
+    {NULL, NULL, 0, NULL}
+};
+
+#ifdef QELUP_PY3
+static struct PyModuleDef luamodule_def = {
+    PyModuleDef_HEAD_INIT,
+    "lua",
+    "Access to the Lua state calling into Python",
+    -1,
+    luamodule_methods,
+    NULL, NULL, NULL, NULL
+};
+#endif
+
+/* Create the lua module and put it in sys.modules (GIL held, after start-up) */
+static void qelup_register_luamodule(void) {
+    if (qelup_ready_types() < 0) {
+        PyErr_Clear();
+        return;
+    }
+    
+    #ifdef QELUP_PY3
+    PyObject *module = PyModule_Create(&luamodule_def);
+    #else
+    PyObject *module = Py_InitModule3("lua", luamodule_methods, "Access to the Lua state calling into Python");
+    Py_XINCREF(module);
+    #endif
+    if (module == NULL) {
+        PyErr_Clear();
+        return;
+    }
+    
+    Py_CLEAR(qelup_LuaError);
+    qelup_LuaError = PyErr_NewException("lua.LuaError", PyExc_RuntimeError, NULL);
+    if (qelup_LuaError != NULL) {
+        Py_INCREF(qelup_LuaError);
+        PyModule_AddObject(module, "LuaError", qelup_LuaError);
+    }
+    
+    /* Raised into Python code whose deadline expired; like KeyboardInterrupt,
+       outside Exception so `except Exception` handlers let it through */
+    Py_CLEAR(qelup_CallTimeout);
+    qelup_CallTimeout = PyErr_NewException("lua.CallTimeout", PyExc_BaseException, NULL);
+    if (qelup_CallTimeout != NULL) {
+        Py_INCREF(qelup_CallTimeout);
+        PyModule_AddObject(module, "CallTimeout", qelup_CallTimeout);
+    }
+    Py_INCREF((PyObject*)&qelup_LuaFunctionType);
+    PyModule_AddObject(module, "LuaFunction", (PyObject*)&qelup_LuaFunctionType);
+    
+    PyObject *modules = PyImport_GetModuleDict();
+    PyDict_SetItemString(modules, "lua", module);
+    Py_DECREF(module);
+    PyErr_Clear();
+}
+
+/* ========================================================================== */
+/* Deadlines */
+/* ========================================================================== */
+
+/*
+    A call with a deadline registers itself on a list that one watchdog
+    thread sleeps on. When a deadline passes, the watchdog takes the GIL and
+    raises lua.CallTimeout in the calling thread with PyThreadState_SetAsyncExc;
+    the interpreter delivers it at the next bytecode boundary, so code stuck
+    inside a single C call is only interrupted once that call returns.
+    Entries are added and removed with the GIL held and the watchdog only
+    fires with the GIL held, so a finished call can never be interrupted.
+    Uses PyThread locks, which are portable but need Python 3.
+*/
+
+
+typedef struct qelup_Deadline {
+    struct qelup_Deadline *next;
+    unsigned long thread;           /* PyThread_get_thread_ident() of the caller */
+    unsigned long long at;          /* qelup_now() time, or 0 when not armed */
+    int fired;
+} qelup_Deadline;
+
+#ifdef QELUP_PY3
+
+static PyThread_type_lock qelup_dl_lock = NULL;    /* guards everything below */
+static PyThread_type_lock qelup_dl_wake = NULL;    /* held unless a wake-up is pending */
+static PyThread_type_lock qelup_dl_exit = NULL;    /* held while the watchdog runs */
+static qelup_Deadline *qelup_deadlines = NULL;
+static unsigned long long qelup_dl_sleep = 0;       /* deadline the watchdog sleeps until (0: none) */
+static int qelup_dl_running = 0;
+static int qelup_dl_stop = 0;
+static int qelup_dl_woken = 0;
+
+#if PY_VERSION_HEX >= 0x03070000
+    #define QELUP_ASYNCEXC_ID(id) (id)
+#else
+    #define QELUP_ASYNCEXC_ID(id) ((long)(id))
+#endif
+
+/* Wake the watchdog so it recomputes its sleep (deadline lock held) */
+static void qelup_dl_signal(void) {
+    if (!qelup_dl_woken) {
+        qelup_dl_woken = 1;
+        PyThread_release_lock(qelup_dl_wake);
+    }
+}
+
+static void qelup_watchdog_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+        if (qelup_dl_stop) {
+            PyThread_release_lock(qelup_dl_lock);
+            break;
+        }
+        unsigned long long next = 0;
+        for (qelup_Deadline *d = qelup_deadlines; d != NULL; d = d->next) {
+            if (!d->fired && (next == 0 || d->at < next)) {
+                next = d->at;
+            }
+        }
+        qelup_dl_sleep = next;
+        PyThread_release_lock(qelup_dl_lock);
+        
+        unsigned long long now = qelup_now();
+        if (next == 0 || next > now) {
+            PY_TIMEOUT_T us = next == 0 ? -1 : (PY_TIMEOUT_T)((next - now + 999) / 1000);
+            if (PyThread_acquire_lock_timed(qelup_dl_wake, us, 0) == PY_LOCK_ACQUIRED) {
+                PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+                qelup_dl_woken = 0;
+                PyThread_release_lock(qelup_dl_lock);
+            }
+            continue;
+        }
+        
+        /* GIL before the list lock, the same order callers use */
+        PyGILState_STATE state = PyGILState_Ensure();
+        PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+        now = qelup_now();
+        for (qelup_Deadline *d = qelup_deadlines; d != NULL; d = d->next) {
+            if (!d->fired && d->at <= now) {
+                d->fired = 1;
+                PyThreadState_SetAsyncExc(QELUP_ASYNCEXC_ID(d->thread), qelup_CallTimeout);
+            }
+        }
+        PyThread_release_lock(qelup_dl_lock);
+        PyGILState_Release(state);
+    }
+    PyThread_release_lock(qelup_dl_exit);
+}
+
+/* Start a deadline for the current thread; ms <= 0 leaves it unarmed (GIL held) */
+static int qelup_arm(qelup_Deadline *d, double ms) {
+    d->at = 0;
+    d->fired = 0;
+    if (ms <= 0 || qelup_CallTimeout == NULL) {
+        return ms <= 0 ? 0 : -1;
+    }
+    
+    if (qelup_dl_lock == NULL) {
+        qelup_dl_lock = PyThread_allocate_lock();
+        qelup_dl_wake = PyThread_allocate_lock();
+        qelup_dl_exit = PyThread_allocate_lock();
+        if (qelup_dl_lock == NULL || qelup_dl_wake == NULL || qelup_dl_exit == NULL) {
+            return -1;
+        }
+        PyThread_acquire_lock(qelup_dl_wake, WAIT_LOCK);
+    }
+    
+    PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+    if (!qelup_dl_running) {
+        qelup_dl_stop = 0;
+        qelup_dl_sleep = 0;
+        PyThread_acquire_lock(qelup_dl_exit, WAIT_LOCK);
+        if (PyThread_start_new_thread(qelup_watchdog_main, NULL) == (unsigned long)-1) {
+            PyThread_release_lock(qelup_dl_exit);
+            PyThread_release_lock(qelup_dl_lock);
+            return -1;
+        }
+        qelup_dl_running = 1;
+    }
+    
+    d->thread = PyThread_get_thread_ident();
+    d->at = qelup_now() + (unsigned long long)(ms * 1e6);
+    d->next = qelup_deadlines;
+    qelup_deadlines = d;
+    if (qelup_dl_sleep == 0 || d->at < qelup_dl_sleep) {
+        qelup_dl_signal();
+    }
+    PyThread_release_lock(qelup_dl_lock);
+    return 0;
+}
+
+/* End a deadline; a timeout not yet delivered is withdrawn (GIL held) */
+static void qelup_disarm(qelup_Deadline *d) {
+    if (d->at == 0) {
+        return;
+    }
+    
+    PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+    for (qelup_Deadline **link = &qelup_deadlines; *link != NULL; link = &(*link)->next) {
+        if (*link == d) {
+            *link = d->next;
+            break;
+        }
+    }
+    PyThread_release_lock(qelup_dl_lock);
+    
+    if (d->fired) {
+        PyThreadState_SetAsyncExc(QELUP_ASYNCEXC_ID(d->thread), NULL);
+    }
+    d->at = 0;
+}
+
+/* Stop the watchdog before finalizing (GIL released, so it can finish a firing) */
+static void qelup_stopwatchdog(void) {
+    if (qelup_dl_lock == NULL || !qelup_dl_running) {
+        return;
+    }
+    PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+    qelup_dl_stop = 1;
+    qelup_dl_signal();
+    PyThread_release_lock(qelup_dl_lock);
+    
+    PyThread_acquire_lock(qelup_dl_exit, WAIT_LOCK);
+    PyThread_release_lock(qelup_dl_exit);
+    
+    /* Consume a wake-up the watchdog did not take */
+    PyThread_acquire_lock(qelup_dl_lock, WAIT_LOCK);
+    if (qelup_dl_woken) {
+        PyThread_acquire_lock(qelup_dl_wake, WAIT_LOCK);
+        qelup_dl_woken = 0;
+    }
+    qelup_dl_running = 0;
+    PyThread_release_lock(qelup_dl_lock);
+}
+
+#else
+
+static int qelup_arm(qelup_Deadline *d, double ms) {
+    d->at = 0;
+    return ms <= 0 ? 0 : -1;
+}
+
+static void qelup_disarm(qelup_Deadline *d) {
+    (void)d;
+}
+
+static void qelup_stopwatchdog(void) {
+}
+
+#endif /* QELUP_PY3 */
+
+/* Bracket Python work with config.timeout; failing to arm just runs unbounded */
+#define QELUP_DEADLINE_BEGIN() \
+    qelup_Deadline qelup_dl; \
+    if (qelup_arm(&qelup_dl, qelup_config.timeout) < 0) PyErr_Clear()
+#define QELUP_DEADLINE_END() qelup_disarm(&qelup_dl)
+
+/* Call with a deadline in ms: core.call_with_timeout(fn, ms, ...) */
+static int qelup_call_with_timeout(lua_State *L) {
+    check_initialized(L);
+    PyObject *obj = qelup_checkpyobject(L, 1);
+    double ms = (double)luaL_checknumber(L, 2);
+    luaL_argcheck(L, ms > 0, 2, "timeout must be positive");
+    
+    QELUP_GIL_ACQUIRE();
+    qelup_Deadline dl;
+    if (qelup_arm(&dl, ms) < 0) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_RuntimeError, "cannot start the deadline watchdog");
+        }
+        return handle_python_exception(L, qelup_gil);
+    }
+    PyObject *result = qelup_callargs(L, obj, 3, lua_gettop(L));
+    qelup_disarm(&dl);
+    
+    if (result == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    int rc = python_to_lua(L, result);
+    Py_DECREF(result);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    return 1;
+}
+
+static int qelup_timeout_tostring(lua_State *L) {
+    lua_pushliteral(L, QELUP_TIMEOUT_MSG);
+    return 1;
+}
+
+/* Create the timeout error value once per Lua state (from luaopen) */
+static void qelup_opentimeout(lua_State *L) {
+    qelup_getregistry(L, &qelup_timeout_key);
+    int exists = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (exists) {
+        return;
+    }
+    
+    lua_createtable(L, 0, 0);
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, qelup_timeout_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_setmetatable(L, -2);
+    qelup_setregistry(L, &qelup_timeout_key);
+}
+
+/* True when a Lua error value came from an expired deadline: core.istimeout(err) */
+static int qelup_istimeout(lua_State *L) {
+    qelup_getregistry(L, &qelup_timeout_key);
+    lua_pushboolean(L, !lua_isnil(L, -1) && lua_rawequal(L, 1, -1));
+    return 1;
+}
+
+/* ========================================================================== */
+/* Error Handling */
+/* ========================================================================== */
+
+/* Push the pending Python error as a Lua string, release the GIL and raise */
+static int handle_python_exception(lua_State *L, qelup_Gil gil) {
+    if (!PyErr_Occurred()) {
+        qelup_gil_release(gil);
+        return 0;
+    }
+    
+    QELUP_STAT_ADD(errors, 1);
+    
+    PyObject *ptype, *pvalue, *ptraceback;
+    PyErr_Fetch(&ptype, &pvalue, &ptraceback);
+    PyErr_NormalizeException(&ptype, &pvalue, &ptraceback);
+    
+    const char *error_msg = "Unknown Python error";
+    
+    if (qelup_CallTimeout != NULL && ptype != NULL && PyErr_GivenExceptionMatches(ptype, qelup_CallTimeout)) {
+        /* A unique value, so no message text can pass for a timeout */
+        qelup_getregistry(L, &qelup_timeout_key);
+    } else if (pvalue != NULL) {
+        PyObject *str = PyObject_Str(pvalue);
+        if (str != NULL) {
+            error_msg = PyString_AsString(str);
+        }
+        lua_pushstring(L, error_msg != NULL ? error_msg : "Unknown Python error");
+        Py_XDECREF(str);
+    } else {
+        lua_pushstring(L, error_msg);
+    }
+    
+    Py_XDECREF(ptype);
+    Py_XDECREF(pvalue);
+    Py_XDECREF(ptraceback);
+    PyErr_Clear();
+    
+    /* lua_error longjmps, so the GIL must be dropped first */
+    qelup_gil_release(gil);
+    return lua_error(L);
+}
+
+/* ========================================================================== */
+/* Core Functions */
+/* ========================================================================== */
+
+/* Interpreter start-up time in ns, reported by core.version() */
+static unsigned long long qelup_init_ns;
+
+/* Check that options[field] is nil or an array of strings; returns its length */
+static int qelup_stringlist(lua_State *L, int options, const char *field) {
+    int n = 0;
+    lua_getfield(L, options, field);
+    if (!lua_isnil(L, -1)) {
+        if (!lua_istable(L, -1)) {
+            return luaL_error(L, "initialize option '%s' must be a list of strings", field);
+        }
+        n = (int)qelup_rawlen(L, -1);
+        for (int i = 1; i <= n; i++) {
+            lua_rawgeti(L, -1, i);
+            if (lua_type(L, -1) != LUA_TSTRING) {
+                return luaL_error(L, "initialize option '%s' must be a list of strings", field);
+            }
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    return n;
+}
+
+/* Import modules on a daemon thread; failures surface on the real import */
+static void qelup_preimport(lua_State *L, int options, int n) {
+    static const char code[] =
+        "import threading\n"
+        "def _qelup_preimport(names):\n"
+        "    import importlib\n"
+        "    for name in names:\n"
+        "        try:\n"
+        "            importlib.import_module(name)\n"
+        "        except Exception:\n"
+        "            pass\n"
+        "_thread = threading.Thread(target=_qelup_preimport, args=(names,), name='qelup-preimport')\n"
+        "_thread.daemon = True\n"
+        "_thread.start()\n";
+    
+    PyObject *names = PyList_New(0);
+    PyObject *globals = PyDict_New();
+    if (names == NULL || globals == NULL) {
+        Py_XDECREF(names);
+        Py_XDECREF(globals);
+        PyErr_Clear();
+        return;
+    }
+    
+    lua_getfield(L, options, "preimport");
+    for (int i = 1; i <= n; i++) {
+        lua_rawgeti(L, -1, i);
+        PyObject *name = PyString_FromString(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        if (name == NULL || PyList_Append(names, name) < 0) {
+            PyErr_Clear();
+        }
+        Py_XDECREF(name);
+    }
+    lua_pop(L, 1);
+    
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "names", names);
+    PyObject *result = PyRun_String(code, Py_file_input, globals, globals);
+    if (result == NULL) {
+        PyErr_Clear();
+    }
+    Py_XDECREF(result);
+    Py_DECREF(globals);
+    Py_DECREF(names);
+}
+
+/*
+    Start the interpreter from an options table: isolated (ignore PYTHON*
+    environment variables and the user site directory), site = false (skip
+    importing site, which scans site-packages), path (the complete module
+    search path) and preimport (modules imported on a background thread).
+    Without options this is plain Py_Initialize().
+*/
+static int qelup_startpython(lua_State *L, int options) {
+    int isolated = 0, site = 1, npath = 0;
+    if (options != 0) {
+        lua_getfield(L, options, "isolated");
+        isolated = lua_toboolean(L, -1);
+        lua_getfield(L, options, "site");
+        site = lua_isnil(L, -1) || lua_toboolean(L, -1);
+        lua_pop(L, 2);
+        npath = qelup_stringlist(L, options, "path");
+    }
+    
+    if (!isolated && site && npath == 0) {
+        Py_Initialize();
+        return 0;
+    }
+    
+    #if PY_VERSION_HEX >= 0x03080000
+    PyConfig config;
+    PyStatus status;
+    if (isolated) {
+        PyConfig_InitIsolatedConfig(&config);
+    } else {
+        PyConfig_InitPythonConfig(&config);
+    }
+    config.site_import = site;
+    
+    status = PyStatus_Ok();
+    if (npath > 0) {
+        config.module_search_paths_set = 1;
+        lua_getfield(L, options, "path");
+        for (int i = 1; i <= npath && !PyStatus_Exception(status); i++) {
+            lua_rawgeti(L, -1, i);
+            wchar_t *entry = Py_DecodeLocale(lua_tostring(L, -1), NULL);
+            lua_pop(L, 1);
+            if (entry == NULL) {
+                status = PyStatus_Error("cannot decode module search path");
+                break;
+            }
+            status = PyWideStringList_Append(&config.module_search_paths, entry);
+            PyMem_RawFree(entry);
+        }
+        lua_pop(L, 1);
+    }
+    
+    if (!PyStatus_Exception(status)) {
+        status = Py_InitializeFromConfig(&config);
+    }
+    PyConfig_Clear(&config);
+    
+    if (PyStatus_Exception(status)) {
+        lua_pushstring(L, status.err_msg != NULL ? status.err_msg : "Py_InitializeFromConfig failed");
+        return -1;
+    }
+    #else
+    /* Before PyConfig the same switches are process-wide flags */
+    if (!site) {
+        Py_NoSiteFlag = 1;
+    }
+    if (isolated) {
+        #if PY_VERSION_HEX >= 0x03040000
+        Py_IsolatedFlag = 1;
+        #endif
+        Py_IgnoreEnvironmentFlag = 1;
+        Py_NoUserSiteDirectory = 1;
+    }
+    if (npath > 0) {
+        #if PY_VERSION_HEX >= 0x03050000
+        lua_getfield(L, options, "path");
+        int table = lua_gettop(L);
+        luaL_checkstack(L, 2 * npath, "too many path entries");
+        for (int i = 1; i <= npath; i++) {
+            if (i > 1) {
+                #ifdef _WIN32
+                lua_pushliteral(L, ";");
+                #else
+                lua_pushliteral(L, ":");
+                #endif
+            }
+            lua_rawgeti(L, table, i);
+        }
+        lua_concat(L, 2 * npath - 1);
+        wchar_t *path = Py_DecodeLocale(lua_tostring(L, -1), NULL);
+        lua_pop(L, 2);
+        if (path == NULL) {
+            lua_pushliteral(L, "cannot decode module search path");
+            return -1;
+        }
+        Py_SetPath(path);
+        PyMem_RawFree(path);
+        #else
+        lua_pushliteral(L, "initialize option 'path' needs Python 3.5 or newer");
+        return -1;
+        #endif
+    }
+    Py_Initialize();
+    #endif
+    return 0;
+}
+
+/* Initialize Python interpreter: core.initialize(options) */
+static int qelup_initialize(lua_State *L) {
+    if (Py_IsInitialized()) {
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+    
+    int options = lua_istable(L, 1) ? 1 : 0;
+    int npreimport = options != 0 ? qelup_stringlist(L, options, "preimport") : 0;
+    
+    unsigned long long start = qelup_now();
+    if (qelup_startpython(L, options) < 0) {
+        lua_pushboolean(L, 0);
+        lua_insert(L, -2);
+        return 2;
+    }
+    qelup_init_ns = qelup_now() - start;
+    
+    if (!Py_IsInitialized()) {
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, "Failed to initialize Python interpreter");
+        return 2;
+    }
+    
+    #if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
+    #endif
+    
+    qelup_generation++;
+    qelup_register_luamodule();
+    
+    if (npreimport > 0) {
+        qelup_preimport(L, options, npreimport);
+    }
+    
+    /* Drop the GIL so any Lua thread can acquire it through PyGILState */
+    qelup_main_tstate = PyEval_SaveThread();
+    
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/* Finalize Python interpreter (must run on the thread that initialized it) */
+static int qelup_finalize(lua_State *L) {
+    (void)L;
+    if (Py_IsInitialized()) {
+        /* Subinterpreters must end while the main GIL is free */
+        qelup_closepools();
+        qelup_stopwatchdog();
+        if (qelup_main_tstate != NULL) {
+            PyEval_RestoreThread(qelup_main_tstate);
+            qelup_main_tstate = NULL;
+        } else {
+            PyGILState_Ensure();
+        }
+        qelup_stopasync();
+        qelup_drain_decrefs();
+        Py_CLEAR(qelup_attrnames);
+        Py_CLEAR(qelup_LuaError);
+        Py_CLEAR(qelup_CallTimeout);
+        qelup_generation++;
+        #ifndef QELUP_NO_STATS
+        qelup_stat_reset();
+        #endif
+        Py_Finalize();
+    }
+    return 0;
+}
+
+/* Import Python module */
+static int qelup_import(lua_State *L) {
+    check_initialized(L);
+    
+    const char *module_name = luaL_checkstring(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *module = PyImport_ImportModule(module_name);
+    
+    if (module == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    qelup_newpyobject(L, module);
+    Py_DECREF(module);
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Execute Python code */
+static int qelup_exec(lua_State *L) {
+    check_initialized(L);
+    
+    const char *code = luaL_checkstring(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *main_module = PyImport_AddModule("__main__");
+    PyObject *global_dict = PyModule_GetDict(main_module);
+    
+    QELUP_DEADLINE_BEGIN();
+    QELUP_STAT_START(t0);
+    PyObject *result = PyRun_String(code, Py_file_input, global_dict, global_dict);
+    QELUP_STAT_STOP(t0, QELUP_STAT_EXEC);
+    QELUP_DEADLINE_END();
+    
+    if (result == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    Py_DECREF(result);
+    QELUP_GIL_RELEASE();
+    
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/* Evaluate Python expression */
+static int qelup_eval(lua_State *L) {
+    check_initialized(L);
+    
+    const char *expr = luaL_checkstring(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *main_module = PyImport_AddModule("__main__");
+    PyObject *global_dict = PyModule_GetDict(main_module);
+    
+    QELUP_DEADLINE_BEGIN();
+    QELUP_STAT_START(t0);
+    PyObject *result = PyRun_String(expr, Py_eval_input, global_dict, global_dict);
+    QELUP_STAT_STOP(t0, QELUP_STAT_EVAL);
+    QELUP_DEADLINE_END();
+    
+    if (result == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    int rc = python_to_lua(L, result);
+    Py_DECREF(result);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Update a boolean setting from field `name` of the options table at index 1 */
+static void qelup_configflag(lua_State *L, const char *name, int *flag) {
+    lua_getfield(L, 1, name);
+    if (!lua_isnil(L, -1)) {
+        *flag = lua_toboolean(L, -1);
+    }
+    lua_pop(L, 1);
+}
+
+/* Read and update bridge settings: core.config({proxy = true}) */
+static int qelup_configure(lua_State *L) {
+    if (lua_istable(L, 1)) {
+        qelup_configflag(L, "proxy", &qelup_config.proxy);
+        qelup_configflag(L, "bytes", &qelup_config.bytes);
+        qelup_configflag(L, "views", &qelup_config.views);
+        qelup_configflag(L, "attrcache", &qelup_config.attrcache);
+        qelup_configflag(L, "async", &qelup_config.async);
+        #ifndef QELUP_NO_STATS
+        qelup_configflag(L, "stats", &qelup_config.stats);
+        qelup_configflag(L, "histograms", &qelup_config.histograms);
+        #endif
+        
+        lua_getfield(L, 1, "timeout");
+        if (!lua_isnil(L, -1)) {
+            double ms = (double)luaL_checknumber(L, -1);
+            luaL_argcheck(L, ms >= 0, 1, "timeout must not be negative");
+            qelup_config.timeout = ms;
+        }
+        lua_pop(L, 1);
+        
+        lua_getfield(L, 1, "decref_batch");
+        if (!lua_isnil(L, -1)) {
+            int batch = (int)luaL_checkinteger(L, -1);
+            luaL_argcheck(L, batch >= 0, 1, "decref_batch must not be negative");
+            qelup_config.decref_batch = batch;
+        }
+        lua_pop(L, 1);
+        
+        lua_getfield(L, 1, "maxdepth");
+        if (!lua_isnil(L, -1)) {
+            int depth = (int)luaL_checkinteger(L, -1);
+            luaL_argcheck(L, depth >= 1, 1, "maxdepth must be positive");
+            qelup_config.maxdepth = depth;
+        }
+        lua_pop(L, 1);
+    } else if (!lua_isnoneornil(L, 1)) {
+        return luaL_argerror(L, 1, "expected table");
+    }
+    
+    lua_newtable(L);
+    lua_pushboolean(L, qelup_config.proxy);
+    lua_setfield(L, -2, "proxy");
+    lua_pushboolean(L, qelup_config.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushboolean(L, qelup_config.views);
+    lua_setfield(L, -2, "views");
+    lua_pushinteger(L, qelup_config.maxdepth);
+    lua_setfield(L, -2, "maxdepth");
+    lua_pushinteger(L, qelup_config.decref_batch);
+    lua_setfield(L, -2, "decref_batch");
+    lua_pushnumber(L, (lua_Number)qelup_config.timeout);
+    lua_setfield(L, -2, "timeout");
+    lua_pushboolean(L, qelup_config.attrcache);
+    lua_setfield(L, -2, "attrcache");
+    lua_pushboolean(L, qelup_config.async);
+    lua_setfield(L, -2, "async");
+    lua_pushboolean(L, qelup_config.stats);
+    lua_setfield(L, -2, "stats");
+    lua_pushboolean(L, qelup_config.histograms);
+    lua_setfield(L, -2, "histograms");
+    return 1;
+}
+
+#ifndef QELUP_NO_STATS
+/* Name for a histogram entry: __qualname__ when available, else repr() */
+static void qelup_pushcallname(lua_State *L, PyObject *callable) {
+    PyObject *name = PyObject_GetAttrString(callable, "__qualname__");
+    if (name == NULL || !PyString_Check(name)) {
+        PyErr_Clear();
+        Py_XDECREF(name);
+        name = PyObject_Repr(callable);
+    }
+    
+    Py_ssize_t len = 0;
+    const char *str = name != NULL ? qelup_pystring(name, &len) : NULL;
+    if (str != NULL) {
+        lua_pushlstring(L, str, (size_t)len);
+    } else {
+        PyErr_Clear();
+        lua_pushliteral(L, "?");
+    }
+    Py_XDECREF(name);
+}
+
+static void qelup_setcounter(lua_State *L, const char *name, unsigned long long value) {
+    lua_pushnumber(L, (lua_Number)value);
+    lua_setfield(L, -2, name);
+}
+#endif
+
+/*
+    Snapshot of the bridge counters: core.stats() returns
+    { enabled, <timer> = {count, ns}..., wrappers, wrapper_hits, decrefs, errors,
+      bytes_to_python, bytes_to_lua, histograms = {{name, count, ns, buckets}},
+      decref_pending, decref_batches, decref_released, decref_largest }
+    The decref_* batch counters are kept whether or not stats are enabled.
+*/
+static int qelup_getstats(lua_State *L) {
+    lua_newtable(L);
+    lua_pushnumber(L, (lua_Number)QELUP_ATOMIC_ADD(&qelup_decref_pending, 0));
+    lua_setfield(L, -2, "decref_pending");
+    lua_pushnumber(L, (lua_Number)qelup_decref_batches);
+    lua_setfield(L, -2, "decref_batches");
+    lua_pushnumber(L, (lua_Number)qelup_decref_released);
+    lua_setfield(L, -2, "decref_released");
+    lua_pushnumber(L, (lua_Number)qelup_decref_largest);
+    lua_setfield(L, -2, "decref_largest");
+    
+    #ifdef QELUP_NO_STATS
+    lua_pushboolean(L, 0);
+    lua_setfield(L, -2, "enabled");
+    #else
+    lua_pushboolean(L, qelup_config.stats);
+    lua_setfield(L, -2, "enabled");
+    
+    for (int i = 0; i < QELUP_STAT_TIMERS; i++) {
+        lua_createtable(L, 0, 2);
+        qelup_setcounter(L, "count", qelup_stats.count[i]);
+        qelup_setcounter(L, "ns", qelup_stats.ns[i]);
+        lua_setfield(L, -2, qelup_stat_names[i]);
+    }
+    
+    qelup_setcounter(L, "wrappers", qelup_stats.wrappers);
+    qelup_setcounter(L, "wrapper_hits", qelup_stats.wrapper_hits);
+    qelup_setcounter(L, "decrefs", qelup_stats.decrefs);
+    qelup_setcounter(L, "errors", qelup_stats.errors);
+    qelup_setcounter(L, "bytes_to_python", qelup_stats.bytes_topy);
+    qelup_setcounter(L, "bytes_to_lua", qelup_stats.bytes_tolua);
+    qelup_setcounter(L, "histograms_dropped", qelup_stats.hist_dropped);
+    
+    lua_newtable(L);
+    if (Py_IsInitialized()) {
+        QELUP_GIL_ACQUIRE();
+        int n = 0;
+        for (int i = 0; i < QELUP_HIST_SLOTS; i++) {
+            qelup_Histogram *h = &qelup_stats.hist[i];
+            if (h->callable == NULL) {
+                continue;
+            }
+            lua_createtable(L, 0, 4);
+            qelup_pushcallname(L, h->callable);
+            lua_setfield(L, -2, "name");
+            qelup_setcounter(L, "count", h->count);
+            qelup_setcounter(L, "ns", h->ns);
+            lua_createtable(L, QELUP_HIST_BUCKETS, 0);
+            for (int b = 0; b < QELUP_HIST_BUCKETS; b++) {
+                lua_pushnumber(L, (lua_Number)h->buckets[b]);
+                lua_rawseti(L, -2, b + 1);
+            }
+            lua_setfield(L, -2, "buckets");
+            lua_rawseti(L, -2, ++n);
+        }
+        QELUP_GIL_RELEASE();
+    }
+    lua_setfield(L, -2, "histograms");
+    #endif
+    return 1;
+}
+
+/* Zero all counters and histograms */
+static int qelup_resetstats(lua_State *L) {
+    qelup_decref_batches = 0;
+    qelup_decref_released = 0;
+    qelup_decref_largest = 0;
+    
+    #ifndef QELUP_NO_STATS
+    if (Py_IsInitialized()) {
+        QELUP_GIL_ACQUIRE();
+        qelup_stat_reset();
+        QELUP_GIL_RELEASE();
+    } else {
+        qelup_stat_reset();
+    }
+    #else
+    (void)L;
+    #endif
+    return 0;
+}
+
+/* Monotonic wall-clock seconds, for timing from Lua: core.now() */
+static int qelup_luanow(lua_State *L) {
+    lua_pushnumber(L, (lua_Number)qelup_now() / 1e9);
+    return 1;
+}
+
+/* Wrap a Lua string as a Python bytes object for a single argument */
+static int qelup_bytes(lua_State *L) {
+    check_initialized(L);
+    
+    size_t len;
+    const char *str = luaL_checklstring(L, 1, &len);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *bytes = PyBytes_FromStringAndSize(str, (Py_ssize_t)len);
+    if (bytes == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    qelup_newpyobject(L, bytes);
+    Py_DECREF(bytes);
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Wrap a Lua table as a lazy Python view: core.view(tbl [, "list"|"dict"]) */
+static int qelup_view(lua_State *L) {
+    static const char *const kinds[] = {"auto", "dict", "list", NULL};
+    
+    check_initialized(L);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int kind = luaL_checkoption(L, 2, "auto", kinds);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *view = qelup_newluaview(L, 1, kind - 1);
+    if (view == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    qelup_newpyobject(L, view);
+    Py_DECREF(view);
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Get Python version */
+static int qelup_version(lua_State *L) {
+    lua_pushstring(L, Py_GetVersion());
+    lua_pushinteger(L, PY_MAJOR_VERSION);
+    lua_pushinteger(L, PY_MINOR_VERSION);
+    lua_pushnumber(L, (lua_Number)qelup_init_ns / 1e6);
+    return 4;
+}
+
+/* ========================================================================== */
+/* Python Object Methods */
+/* ========================================================================== */
+
+/* Check whether the value at index is a table tagged by core.kwargs() */
+static int qelup_iskwargs(lua_State *L, int index) {
+    if (lua_type(L, index) != LUA_TTABLE || !lua_getmetatable(L, index)) {
+        return 0;
+    }
+    luaL_getmetatable(L, QELUP_KWARGS_MT);
+    int tagged = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return tagged;
+}
+
+/*
+    Call `callable` with the Lua values at [first, last] as arguments. A
+    trailing table tagged by core.kwargs() supplies keyword arguments.
+    Returns a new reference, or NULL with a Python error set. GIL must be held.
+*/
+static PyObject* qelup_callargs(lua_State *L, PyObject *callable, int first, int last) {
+    int kwindex = 0;
+    int nkw = 0;
+    
+    if (last >= first && qelup_iskwargs(L, last)) {
+        kwindex = last--;
+        lua_pushnil(L);
+        while (lua_next(L, kwindex) != 0) {
+            nkw++;
+            lua_pop(L, 1);
+        }
+    }
+    
+    int nargs = last - first + 1;
+    PyObject *result = NULL;
+    
+    #ifdef QELUP_HAVE_VECTORCALL
+    /* Slot 0 is reserved so callees may prepend `self` (ARGUMENTS_OFFSET) */
+    PyObject *stack[QELUP_STACK_ARGS + 1];
+    PyObject **argv = stack;
+    PyObject *kwnames = NULL;
+    int filled = 0;
+    
+    if (nargs + nkw > QELUP_STACK_ARGS) {
+        argv = (PyObject**)PyMem_Malloc((size_t)(nargs + nkw + 1) * sizeof(PyObject*));
+        if (argv == NULL) {
+            return PyErr_NoMemory();
+        }
+    }
+    
+    for (int i = 0; i < nargs; i++) {
+        PyObject *arg = lua_to_python(L, first + i);
+        if (arg == NULL) {
+            goto done;
+        }
+        argv[1 + filled++] = arg;
+    }
+    
+    if (nkw > 0) {
+        kwnames = PyTuple_New(nkw);
+        if (kwnames == NULL) {
+            goto done;
+        }
+        
+        int k = 0;
+        lua_pushnil(L);
+        while (lua_next(L, kwindex) != 0) {
+            if (lua_type(L, -2) != LUA_TSTRING) {
+                lua_pop(L, 2);
+                PyErr_SetString(PyExc_TypeError, "keyword argument names must be strings");
+                goto done;
+            }
+            
+            size_t len;
+            const char *name = lua_tolstring(L, -2, &len);
+            PyObject *key = PyUnicode_FromStringAndSize(name, (Py_ssize_t)len);
+            if (key == NULL) {
+                lua_pop(L, 2);
+                goto done;
+            }
+            PyUnicode_InternInPlace(&key);
+            PyTuple_SET_ITEM(kwnames, k++, key);
+            
+            PyObject *value = lua_to_python(L, -1);
+            lua_pop(L, 1);
+            if (value == NULL) {
+                lua_pop(L, 1);
+                goto done;
+            }
+            argv[1 + filled++] = value;
+        }
+    }
+    
+    QELUP_STAT_START(t0);
+    result = qelup_Vectorcall(callable, argv + 1,
+                              (size_t)nargs | PY_VECTORCALL_ARGUMENTS_OFFSET, kwnames);
+    QELUP_STAT_CALL(t0, callable);
+    
+done:
+    for (int i = 1; i <= filled; i++) {
+        Py_DECREF(argv[i]);
+    }
+    Py_XDECREF(kwnames);
+    if (argv != stack) {
+        PyMem_Free(argv);
+    }
+    #else
+    PyObject *args = PyTuple_New(nargs);
+    PyObject *kwargs = NULL;
+    if (args == NULL) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < nargs; i++) {
+        PyObject *arg = lua_to_python(L, first + i);
+        if (arg == NULL) {
+            Py_DECREF(args);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(args, i, arg);
+    }
+    
+    if (nkw > 0) {
+        kwargs = PyDict_New();
+        lua_pushnil(L);
+        while (kwargs != NULL && lua_next(L, kwindex) != 0) {
+            if (lua_type(L, -2) != LUA_TSTRING) {
+                lua_pop(L, 2);
+                PyErr_SetString(PyExc_TypeError, "keyword argument names must be strings");
+                Py_CLEAR(kwargs);
+                break;
+            }
+            
+            size_t len;
+            const char *name = lua_tolstring(L, -2, &len);
+            PyObject *key = qelup_fromluastring(name, len, 0);
+            PyObject *value = lua_to_python(L, -1);
+            lua_pop(L, 1);
+            
+            if (key == NULL || value == NULL || PyDict_SetItem(kwargs, key, value) < 0) {
+                lua_pop(L, 1);
+                Py_CLEAR(kwargs);
+            }
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+        }
+        if (kwargs == NULL) {
+            Py_DECREF(args);
+            return NULL;
+        }
+    }
+    
+    QELUP_STAT_START(t0);
+    result = PyObject_Call(callable, args, kwargs);
+    QELUP_STAT_CALL(t0, callable);
+    Py_DECREF(args);
+    Py_XDECREF(kwargs);
+    #endif
+    
+    return result;
+}
+
+/* Call Python object */
+static int pyobject_call(lua_State *L) {
+    PyObject *obj = qelup_checkpyobject(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    /* The interpreter drops the GIL periodically during long calls */
+    QELUP_DEADLINE_BEGIN();
+    PyObject *result = qelup_callargs(L, obj, 2, lua_gettop(L));
+    QELUP_DEADLINE_END();
+    
+    if (result == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    /* Coroutines run on the bridge loop; Lua gets a future */
+    int rc = qelup_iscoroutine(result) ? qelup_pushfuture(L, result) : python_to_lua(L, result);
+    Py_DECREF(result);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Tag a table as keyword arguments for a call: f(x, core.kwargs{sep = ","}) */
+static int qelup_kwargs(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    luaL_getmetatable(L, QELUP_KWARGS_MT);
+    lua_setmetatable(L, 1);
+    return 1;
+}
+
+/*
+    Interned Python name for the Lua string at index, cached in the names
+    table at `names` (an upvalue). Returns a new reference, or NULL with a
+    Python error set. GIL must be held.
+*/
+static PyObject* qelup_attrname(lua_State *L, int names, int index) {
+    lua_rawgeti(L, names, 0);
+    if (lua_tointeger(L, -1) != qelup_generation) {
+        /* Interpreter restarted since this table was filled */
+        lua_newtable(L);
+        lua_pushinteger(L, qelup_generation);
+        lua_rawseti(L, -2, 0);
+        lua_replace(L, names);
+    }
+    lua_pop(L, 1);
+    
+    lua_pushvalue(L, index);
+    lua_rawget(L, names);
+    PyObject *name = (PyObject*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (name != NULL) {
+        Py_INCREF(name);
+        return name;
+    }
+    
+    size_t len;
+    const char *str = lua_tolstring(L, index, &len);
+    name = PyString_FromStringAndSize(str, (Py_ssize_t)len);
+    if (name == NULL) {
+        return NULL;
+    }
+    PyString_InternInPlace(&name);
+    
+    if (qelup_attrnames == NULL) {
+        qelup_attrnames = PyDict_New();
+    }
+    if (qelup_attrnames != NULL && PyDict_Size(qelup_attrnames) < QELUP_ATTRNAMES_MAX
+        && PyDict_SetItem(qelup_attrnames, name, name) == 0) {
+        lua_pushvalue(L, index);
+        lua_pushlightuserdata(L, name);
+        lua_rawset(L, names);
+    }
+    PyErr_Clear();
+    return name;
+}
+
+/* Decide whether getattr(obj, name) can be reused for later lookups */
+static int qelup_attrcacheable(qelup_PyObject *udata, PyObject *attr) {
+    if (!qelup_config.attrcache || udata->attrcache == 0) {
+        return 0;
+    }
+    /* By default only module and class attributes are treated as stable */
+    if (udata->attrcache < 0 && !PyModule_Check(udata->obj) && !PyType_Check(udata->obj)) {
+        return 0;
+    }
+    /* Only values that stay wrappers; converted scalars could go stale */
+    return PyModule_Check(attr) || PyCallable_Check(attr);
+}
+
+/* Forget cached attributes of the wrapper at index (key at keyindex, or all) */
+static void qelup_attrcache_clear(lua_State *L, int caches, int index, int keyindex) {
+    lua_pushvalue(L, index);
+    if (keyindex == 0) {
+        lua_pushnil(L);
+        lua_rawset(L, caches);
+        return;
+    }
+    lua_rawget(L, caches);
+    if (lua_istable(L, -1)) {
+        lua_pushvalue(L, keyindex);
+        lua_pushnil(L);
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+}
+
+/* Get attribute; upvalue 1 is the names table, upvalue 2 the wrapper caches */
+static int pyobject_index(lua_State *L) {
+    qelup_PyObject *udata = (qelup_PyObject*)luaL_checkudata(L, 1, QELUP_PYOBJECT_MT);
+    luaL_checkstring(L, 2);
+    lua_settop(L, 2);
+    
+    if (qelup_config.attrcache && udata->attrcache != 0) {
+        lua_pushvalue(L, 1);
+        lua_rawget(L, lua_upvalueindex(2));
+        if (lua_istable(L, 3)) {
+            lua_pushvalue(L, 2);
+            lua_rawget(L, 3);
+            if (!lua_isnil(L, -1)) {
+                return 1;
+            }
+        }
+        lua_settop(L, 2);
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *name = qelup_attrname(L, lua_upvalueindex(1), 2);
+    if (name == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    PyObject *attr = PyObject_GetAttr(udata->obj, name);
+    Py_DECREF(name);
+    
+    if (attr == NULL) {
+        PyErr_Clear();
+        QELUP_GIL_RELEASE();
+        lua_pushnil(L);
+        return 1;
+    }
+    
+    int cacheable = qelup_attrcacheable(udata, attr);
+    int rc = python_to_lua(L, attr);
+    Py_DECREF(attr);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    if (cacheable) {
+        lua_pushvalue(L, 1);
+        lua_rawget(L, lua_upvalueindex(2));
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, 1);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, lua_upvalueindex(2));
+        }
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, 3);
+        lua_rawset(L, -3);
+        lua_pop(L, 1);
+    }
+    
+    return 1;
+}
+
+/* Set attribute */
+static int pyobject_newindex(lua_State *L) {
+    PyObject *obj = qelup_checkpyobject(L, 1);
+    luaL_checkstring(L, 2);
+    
+    /* A cached value for this name would now be stale */
+    qelup_attrcache_clear(L, lua_upvalueindex(2), 1, 2);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *name = qelup_attrname(L, lua_upvalueindex(1), 2);
+    if (name == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    PyObject *value = lua_to_python(L, 3);
+    if (value == NULL) {
+        Py_DECREF(name);
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    int result = PyObject_SetAttr(obj, name, value);
+    Py_DECREF(name);
+    Py_DECREF(value);
+    
+    if (result == -1) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    QELUP_GIL_RELEASE();
+    return 0;
+}
+
+/* Control attribute caching for one object: core.attrcache(obj, true|false|nil) */
+static int qelup_attrcache(lua_State *L) {
+    qelup_PyObject *udata = (qelup_PyObject*)luaL_checkudata(L, 1, QELUP_PYOBJECT_MT);
+    
+    udata->attrcache = lua_isnoneornil(L, 2) ? -1 : lua_toboolean(L, 2);
+    
+    qelup_getregistry(L, &qelup_attrcache_key);
+    qelup_attrcache_clear(L, lua_gettop(L), 1, 0);
+    lua_pop(L, 1);
+    
+    return 0;
+}
+
+/* Garbage collection (shared by wrappers and lazy views) */
+static int pyobject_gc(lua_State *L) {
+    qelup_PyObject *udata = (qelup_PyObject*)lua_touserdata(L, 1);
+    if (udata->obj != NULL) {
+        /* Objects outliving Py_Finalize are already gone, even after a re-initialize */
+        if (Py_IsInitialized() && udata->generation == qelup_generation) {
+            qelup_defer_decref(L, udata->obj);
+        }
+        udata->obj = NULL;
+    }
+    return 0;
+}
+
+/* String representation */
+static int pyobject_tostring(lua_State *L) {
+    PyObject *obj = qelup_checkpyobject(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *str = PyObject_Str(obj);
+    if (str == NULL) {
+        PyErr_Clear();
+        QELUP_GIL_RELEASE();
+        lua_pushstring(L, "<Python object>");
+        return 1;
+    }
+    
+    Py_ssize_t len = 0;
+    const char *cstr = qelup_pystring(str, &len);
+    if (cstr == NULL) {
+        PyErr_Clear();
+        len = 0;
+    }
+    lua_pushlstring(L, cstr != NULL ? cstr : "", (size_t)len);
+    Py_DECREF(str);
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Python ==; the same object always has the same wrapper, so Lua's own
+   identity check already covers `is` */
+static int pyobject_eq(lua_State *L) {
+    PyObject *a = qelup_topyobject(L, 1);
+    PyObject *b = qelup_topyobject(L, 2);
+    if (a == NULL || b == NULL || !Py_IsInitialized()) {
+        lua_pushboolean(L, a != NULL && a == b);
+        return 1;
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    int eq = PyObject_RichCompareBool(a, b, Py_EQ);
+    if (eq < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    lua_pushboolean(L, eq);
+    return 1;
+}
+
+/* len(obj) */
+static int pyobject_len(lua_State *L) {
+    PyObject *obj = qelup_checkpyobject(L, 1);
+    check_initialized(L);
+    
+    QELUP_GIL_ACQUIRE();
+    Py_ssize_t n = PyObject_Size(obj);
+    if (n < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    lua_pushinteger(L, (lua_Integer)n);
+    return 1;
+}
+
+/* ========================================================================== */
+/* Lazy Container Proxies */
+/* ========================================================================== */
+
+/* Materialize a lazy view (or any wrapped object) into plain Lua tables */
+static int pyproxy_totable(lua_State *L) {
+    PyObject *obj = qelup_topyobject(L, 1);
+    if (obj == NULL) {
+        return luaL_argerror(L, 1, "expected Python object");
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    if (python_to_lua_mode(L, obj, 0) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Index a view: 1-based integers for sequences, any key for dicts */
+static int pyproxy_index(lua_State *L) {
+    PyObject *obj = qelup_checkproxy(L, 1);
+    
+    if (lua_type(L, 2) == LUA_TSTRING && strcmp(lua_tostring(L, 2), "totable") == 0) {
+        lua_pushcfunction(L, pyproxy_totable);
+        return 1;
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *item = NULL;
+    
+    if (PyDict_Check(obj)) {
+        PyObject *key = lua_to_python(L, 2);
+        if (key == NULL) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        item = PyDict_GetItem(obj, key);
+        Py_XINCREF(item);
+        Py_DECREF(key);
+    } else if (lua_type(L, 2) == LUA_TNUMBER) {
+        lua_Number n = lua_tonumber(L, 2);
+        Py_ssize_t i = (Py_ssize_t)n;
+        if ((lua_Number)i == n && i >= 1 && i <= PySequence_Size(obj)) {
+            item = PySequence_GetItem(obj, i - 1);
+        }
+    }
+    
+    if (item == NULL) {
+        PyErr_Clear();
+        QELUP_GIL_RELEASE();
+        lua_pushnil(L);
+        return 1;
+    }
+    
+    int rc = python_to_lua_mode(L, item, 1);
+    Py_DECREF(item);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Length of the underlying container */
+static int pyproxy_len(lua_State *L) {
+    PyObject *obj = qelup_checkproxy(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    Py_ssize_t size = PyObject_Length(obj);
+    if (size < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    lua_pushinteger(L, size);
+    return 1;
+}
+
+/* Sequence iterator: (view, i) -> i + 1, item */
+static int pyproxy_inext(lua_State *L) {
+    PyObject *obj = qelup_checkproxy(L, 1);
+    lua_Integer i = luaL_checkinteger(L, 2) + 1;
+    
+    QELUP_GIL_ACQUIRE();
+    if (i > PySequence_Size(obj)) {
+        PyErr_Clear();
+        QELUP_GIL_RELEASE();
+        lua_pushnil(L);
+        return 1;
+    }
+    
+    PyObject *item = PySequence_GetItem(obj, i - 1);
+    if (item == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    lua_pushinteger(L, i);
+    int rc = python_to_lua_mode(L, item, 1);
+    Py_DECREF(item);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 2;
+}
+
+/* Dict iterator closure; upvalue 1 holds the PyDict_Next position */
+static int pyproxy_dictnext(lua_State *L) {
+    PyObject *obj = qelup_checkproxy(L, 1);
+    Py_ssize_t pos = (Py_ssize_t)lua_tointeger(L, lua_upvalueindex(1));
+    PyObject *key, *value;
+    
+    QELUP_GIL_ACQUIRE();
+    if (!PyDict_Next(obj, &pos, &key, &value)) {
+        QELUP_GIL_RELEASE();
+        lua_pushnil(L);
+        return 1;
+    }
+    
+    if (python_to_lua_mode(L, key, 1) < 0 || python_to_lua_mode(L, value, 1) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    lua_pushinteger(L, pos);
+    lua_replace(L, lua_upvalueindex(1));
+    return 2;
+}
+
+static int pyproxy_ipairs(lua_State *L) {
+    qelup_checkproxy(L, 1);
+    lua_pushcfunction(L, pyproxy_inext);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, 0);
+    return 3;
+}
+
+static int pyproxy_pairs(lua_State *L) {
+    PyObject *obj = qelup_checkproxy(L, 1);
+    
+    if (!PyDict_Check(obj)) {
+        return pyproxy_ipairs(L);
+    }
+    
+    lua_pushinteger(L, 0);
+    lua_pushcclosure(L, pyproxy_dictnext, 1);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+/* String representation */
+static int pyproxy_tostring(lua_State *L) {
+    PyObject *obj = qelup_checkproxy(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *str = PyObject_Str(obj);
+    if (str == NULL) {
+        PyErr_Clear();
+        QELUP_GIL_RELEASE();
+        lua_pushstring(L, "<Python container>");
+        return 1;
+    }
+    
+    lua_pushstring(L, PyString_AsString(str));
+    Py_DECREF(str);
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Wrap a Python object as a lazy view regardless of the proxy setting */
+static int qelup_lazy(lua_State *L) {
+    PyObject *obj = qelup_topyobject(L, 1);
+    if (obj == NULL) {
+        return luaL_argerror(L, 1, "expected Python object");
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    python_to_lua_mode(L, obj, 1);
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* ========================================================================== */
+/* Batched Calls */
+/* ========================================================================== */
+
+/* Get a callable argument for map/starmap */
+static PyObject* qelup_checkcallable(lua_State *L, int index) {
+    PyObject *obj = qelup_topyobject(L, index);
+    if (obj == NULL) {
+        luaL_argerror(L, index, "expected Python callable");
+    }
+    return obj;
+}
+
+/* Call fn on every element of a Lua array in one crossing: core.map(fn, arr) */
+static int qelup_map(lua_State *L) {
+    PyObject *fn = qelup_checkcallable(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    
+    lua_Integer n = qelup_rawlen(L, 2);
+    lua_createtable(L, (int)n, 0);
+    
+    QELUP_GIL_ACQUIRE();
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, 2, i);
+        PyObject *result = qelup_callargs(L, fn, 4, 4);
+        lua_pop(L, 1);
+        
+        if (result == NULL) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        
+        int rc = python_to_lua(L, result);
+        Py_DECREF(result);
+        if (rc < 0) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        lua_rawseti(L, 3, i);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* Call fn with each table of arguments unpacked: core.starmap(fn, {{a, b}, ...}) */
+static int qelup_starmap(lua_State *L) {
+    PyObject *fn = qelup_checkcallable(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    
+    lua_Integer n = qelup_rawlen(L, 2);
+    lua_createtable(L, (int)n, 0);
+    
+    QELUP_GIL_ACQUIRE();
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, 2, i);
+        if (lua_type(L, 4) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            QELUP_GIL_RELEASE();
+            return luaL_error(L, "starmap: element %d is not a table of arguments", (int)i);
+        }
+        
+        int nargs = (int)qelup_rawlen(L, 4);
+        if (!lua_checkstack(L, nargs + LUA_MINSTACK)) {
+            QELUP_GIL_RELEASE();
+            return luaL_error(L, "starmap: too many arguments in element %d", (int)i);
+        }
+        for (int k = 1; k <= nargs; k++) {
+            lua_rawgeti(L, 4, k);
+        }
+        
+        PyObject *result = qelup_callargs(L, fn, 5, 4 + nargs);
+        lua_settop(L, 3);
+        
+        if (result == NULL) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        
+        int rc = python_to_lua(L, result);
+        Py_DECREF(result);
+        if (rc < 0) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        lua_rawseti(L, 3, i);
+    }
+    QELUP_GIL_RELEASE();
+    
+    return 1;
+}
+
+/* ========================================================================== */
+/* Typed Arrays */
+/* ========================================================================== */
+
+/*
+    core.floats / core.ints / core.strings convert a whole array with one
+    element type. A Python sequence becomes a Lua array; a Lua array becomes
+    a Python list. Elements that do not convert raise TypeError instead of
+    falling back to wrappers.
+*/
+enum { QELUP_FLOATS, QELUP_INTS, QELUP_STRINGS };
+
+/* Push a Lua array made from a Python sequence; -1 with a Python error set */
+static int qelup_typedtolua(lua_State *L, PyObject *obj, int kind) {
+    PyObject *seq = PySequence_Fast(obj, "expected a sequence");
+    if (seq == NULL) {
+        return -1;
+    }
+    
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    lua_createtable(L, (int)n, 0);
+    
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *item = items[i];
+        
+        if (kind == QELUP_FLOATS) {
+            double value = PyFloat_AsDouble(item);
+            if (value == -1.0 && PyErr_Occurred()) {
+                goto error;
+            }
+            lua_pushnumber(L, value);
+        } else if (kind == QELUP_INTS) {
+            long long value = PyLong_AsLongLong(item);
+            if (value == -1 && PyErr_Occurred()) {
+                goto error;
+            }
+            lua_pushinteger(L, (lua_Integer)value);
+        } else if (PyBytes_Check(item)) {
+            lua_pushlstring(L, PyBytes_AS_STRING(item), (size_t)PyBytes_GET_SIZE(item));
+        } else if (PyString_Check(item)) {
+            Py_ssize_t len = 0;
+            const char *str = qelup_pystring(item, &len);
+            if (str == NULL) {
+                goto error;
+            }
+            lua_pushlstring(L, str, (size_t)len);
+            QELUP_STAT_ADD(bytes_tolua, (size_t)len);
+        } else {
+            PyErr_Format(PyExc_TypeError, "element %zd is not a string", i);
+            goto error;
+        }
+        lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    
+    Py_DECREF(seq);
+    return 0;
+    
+error:
+    lua_pop(L, 1);
+    Py_DECREF(seq);
+    return -1;
+}
+
+/* Make a Python list from array slots 1..#t of the table at index */
+static PyObject* qelup_typedtopython(lua_State *L, int index, int kind) {
+    lua_Integer n = qelup_rawlen(L, index);
+    PyObject *list = PyList_New((Py_ssize_t)n);
+    if (list == NULL) {
+        return NULL;
+    }
+    
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, index, i);
+        int t = lua_type(L, -1);
+        PyObject *item = NULL;
+        
+        if (kind == QELUP_STRINGS) {
+            if (t == LUA_TSTRING) {
+                size_t len;
+                const char *str = lua_tolstring(L, -1, &len);
+                QELUP_STAT_ADD(bytes_topy, len);
+                item = qelup_fromluastring(str, len, 0);
+            }
+        } else if (t == LUA_TNUMBER) {
+            lua_Number d = lua_tonumber(L, -1);
+            if (kind == QELUP_FLOATS) {
+                item = PyFloat_FromDouble(d);
+            }
+            #if LUA_VERSION_NUM >= 503
+            else if (lua_isinteger(L, -1)) {
+                item = PyLong_FromLongLong((long long)lua_tointeger(L, -1));
+            }
+            #endif
+            else if (d >= -9.2e18 && d <= 9.2e18 && d == (lua_Number)(long long)d) {
+                item = PyLong_FromLongLong((long long)d);
+            }
+        }
+        lua_pop(L, 1);
+        
+        if (item == NULL) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_TypeError, "element %d is not %s", (int)i,
+                             kind == QELUP_FLOATS ? "a number" :
+                             kind == QELUP_INTS ? "an integer" : "a string");
+            }
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)(i - 1), item);
+    }
+    
+    return list;
+}
+
+static int qelup_typed(lua_State *L, int kind) {
+    check_initialized(L);
+    
+    if (lua_istable(L, 1)) {
+        QELUP_GIL_ACQUIRE();
+        PyObject *list = qelup_typedtopython(L, 1, kind);
+        if (list == NULL) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        qelup_newpyobject(L, list);
+        Py_DECREF(list);
+        QELUP_GIL_RELEASE();
+        return 1;
+    }
+    
+    PyObject *obj = qelup_topyobject(L, 1);
+    if (obj == NULL) {
+        return luaL_argerror(L, 1, "expected Python object or table");
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    if (qelup_typedtolua(L, obj, kind) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    return 1;
+}
+
+/* core.floats(seq | tbl): array of floats */
+static int qelup_floats(lua_State *L) {
+    return qelup_typed(L, QELUP_FLOATS);
+}
+
+/* core.ints(seq | tbl): array of integers */
+static int qelup_ints(lua_State *L) {
+    return qelup_typed(L, QELUP_INTS);
+}
+
+/* core.strings(seq | tbl): array of strings */
+static int qelup_strings(lua_State *L) {
+    return qelup_typed(L, QELUP_STRINGS);
+}
+
+/* ========================================================================== */
+/* Buffer Views */
+/* ========================================================================== */
+
+/*
+    core.buffer(obj) holds a Py_buffer on any contiguous buffer exporter
+    (bytes, bytearray, memoryview, array.array, ...). Items are read and
+    written straight from the exporter's memory without taking the GIL; only
+    acquiring and releasing the buffer need Python.
+*/
+
+/* Element types that can be read from buffer memory */
+enum { QELUP_ITEM_NONE, QELUP_ITEM_INT, QELUP_ITEM_UINT, QELUP_ITEM_FLOAT, QELUP_ITEM_BOOL };
+
+/* Decode a single-item struct format; widths come from itemsize */
+static int qelup_itemkind(const char *format, Py_ssize_t itemsize) {
+    const unsigned int one = 1;
+    int little = *(const unsigned char*)&one;
+    
+    if (format == NULL) {
+        format = "B";
+    }
+    if (*format == '@' || *format == '=') {
+        format++;
+    } else if (*format == '<' || *format == '>' || *format == '!') {
+        if ((*format == '<') != little) {
+            return QELUP_ITEM_NONE;
+        }
+        format++;
+    }
+    if (format[0] == '\0' || format[1] != '\0') {
+        return QELUP_ITEM_NONE;
+    }
+    
+    int kind;
+    switch (format[0]) {
+        case 'b': case 'h': case 'i': case 'l': case 'q': case 'n':
+            kind = QELUP_ITEM_INT;
+            break;
+        case 'B': case 'H': case 'I': case 'L': case 'Q': case 'N': case 'c':
+            kind = QELUP_ITEM_UINT;
+            break;
+        case 'f': case 'd':
+            return itemsize == 4 || itemsize == 8 ? QELUP_ITEM_FLOAT : QELUP_ITEM_NONE;
+        case '?':
+            return itemsize == 1 ? QELUP_ITEM_BOOL : QELUP_ITEM_NONE;
+        default:
+            return QELUP_ITEM_NONE;
+    }
+    return itemsize == 1 || itemsize == 2 || itemsize == 4 || itemsize == 8
+        ? kind : QELUP_ITEM_NONE;
+}
+
+/* Push the item at p (memcpy: buffer memory need not be aligned) */
+static void qelup_pushitem(lua_State *L, const char *p, int kind, Py_ssize_t size) {
+    switch (kind) {
+        case QELUP_ITEM_INT: {
+            int64_t v = 0;
+            if (size == 1) { int8_t x; memcpy(&x, p, 1); v = x; }
+            else if (size == 2) { int16_t x; memcpy(&x, p, 2); v = x; }
+            else if (size == 4) { int32_t x; memcpy(&x, p, 4); v = x; }
+            else { memcpy(&v, p, 8); }
+            lua_pushinteger(L, (lua_Integer)v);
+            break;
+        }
+        case QELUP_ITEM_UINT: {
+            uint64_t v = 0;
+            if (size == 1) { uint8_t x; memcpy(&x, p, 1); v = x; }
+            else if (size == 2) { uint16_t x; memcpy(&x, p, 2); v = x; }
+            else if (size == 4) { uint32_t x; memcpy(&x, p, 4); v = x; }
+            else { memcpy(&v, p, 8); }
+            if (v > (uint64_t)INT64_MAX) {
+                lua_pushnumber(L, (lua_Number)v);
+            } else {
+                lua_pushinteger(L, (lua_Integer)v);
+            }
+            break;
+        }
+        case QELUP_ITEM_FLOAT: {
+            if (size == 4) {
+                float x;
+                memcpy(&x, p, 4);
+                lua_pushnumber(L, (lua_Number)x);
+            } else {
+                double x;
+                memcpy(&x, p, 8);
+                lua_pushnumber(L, (lua_Number)x);
+            }
+            break;
+        }
+        case QELUP_ITEM_BOOL:
+            lua_pushboolean(L, *p != 0);
+            break;
+        default:
+            lua_pushnil(L);
+            break;
+    }
+}
+
+/* Store the Lua value at index into the item at p */
+static void qelup_storeitem(lua_State *L, char *p, int kind, Py_ssize_t size, int index) {
+    if (kind == QELUP_ITEM_BOOL) {
+        *p = (char)lua_toboolean(L, index);
+    } else if (kind == QELUP_ITEM_FLOAT) {
+        double d = (double)luaL_checknumber(L, index);
+        if (size == 4) {
+            float x = (float)d;
+            memcpy(p, &x, 4);
+        } else {
+            memcpy(p, &d, 8);
+        }
+    } else {
+        #if LUA_VERSION_NUM >= 503
+        int64_t v = (int64_t)luaL_checkinteger(L, index);
+        #else
+        int64_t v = (int64_t)luaL_checknumber(L, index);
+        #endif
+        /* Little- and big-endian hosts both truncate by value */
+        if (size == 1) { int8_t x = (int8_t)v; memcpy(p, &x, 1); }
+        else if (size == 2) { int16_t x = (int16_t)v; memcpy(p, &x, 2); }
+        else if (size == 4) { int32_t x = (int32_t)v; memcpy(p, &x, 4); }
+        else { memcpy(p, &v, 8); }
+    }
+}
+
+static qelup_Buffer* qelup_checkbuffer(lua_State *L, int index) {
+    qelup_Buffer *buf = (qelup_Buffer*)luaL_checkudata(L, index, QELUP_BUFFER_MT);
+    if (!qelup_bufferlive(buf)) {
+        luaL_error(L, "buffer has been released");
+    }
+    return buf;
+}
+
+/* Convert a 1-based item index at stack index `arg`, checking bounds */
+static Py_ssize_t qelup_checkitem(lua_State *L, qelup_Buffer *buf, int arg) {
+    lua_Integer i = luaL_checkinteger(L, arg);
+    Py_ssize_t n = buf->view.len / buf->view.itemsize;
+    luaL_argcheck(L, i >= 1 && i <= (lua_Integer)n, arg, "index out of range");
+    return (Py_ssize_t)(i - 1);
+}
+
+/* Push a qelup.buffer holding the Python object at index with `flags` */
+static qelup_Buffer* qelup_pushbuffer(lua_State *L, int index, int flags) {
+    check_initialized(L);
+    
+    PyObject *obj = qelup_topyobject(L, index);
+    if (obj == NULL) {
+        luaL_argerror(L, index, "expected Python object");
+    }
+    
+    qelup_Buffer *buf = (qelup_Buffer*)lua_newuserdata(L, sizeof(qelup_Buffer));
+    buf->held = 0;
+    luaL_getmetatable(L, QELUP_BUFFER_MT);
+    lua_setmetatable(L, -2);
+    
+    QELUP_GIL_ACQUIRE();
+    /* Prefer a writable view, but read-only exporters like bytes are fine */
+    if (PyObject_GetBuffer(obj, &buf->view, flags | PyBUF_WRITABLE) < 0) {
+        PyErr_Clear();
+        if (PyObject_GetBuffer(obj, &buf->view, flags) < 0) {
+            handle_python_exception(L, qelup_gil);
+        }
+    }
+    /* Counters are only touched with the GIL held */
+    QELUP_STAT_ADD(wrappers, 1);
+    QELUP_GIL_RELEASE();
+    
+    buf->held = 1;
+    buf->generation = qelup_generation;
+    buf->kind = qelup_itemkind(buf->view.format, buf->view.itemsize);
+    return buf;
+}
+
+/* Hold a buffer on a Python object: core.buffer(obj) */
+static int qelup_buffer(lua_State *L) {
+    qelup_pushbuffer(L, 1, PyBUF_ANY_CONTIGUOUS | PyBUF_FORMAT);
+    return 1;
+}
+
+/* Release the Py_buffer now instead of at collection */
+static int buffer_release(lua_State *L) {
+    qelup_Buffer *buf = (qelup_Buffer*)luaL_checkudata(L, 1, QELUP_BUFFER_MT);
+    if (buf->held) {
+        buf->held = 0;
+        /* Memory of a finalized interpreter is already gone */
+        if (Py_IsInitialized() && buf->generation == qelup_generation) {
+            QELUP_GIL_ACQUIRE();
+            PyBuffer_Release(&buf->view);
+            QELUP_STAT_ADD(decrefs, 1);
+            QELUP_GIL_RELEASE();
+        }
+    }
+    return 0;
+}
+
+/* Items as a Lua string, with string.sub index rules: buf:sub(i [, j]) */
+static int buffer_sub(lua_State *L) {
+    qelup_Buffer *buf = qelup_checkbuffer(L, 1);
+    lua_Integer n = (lua_Integer)(buf->view.len / buf->view.itemsize);
+    lua_Integer i = luaL_optinteger(L, 2, 1);
+    lua_Integer j = luaL_optinteger(L, 3, -1);
+    
+    if (i < 0) i = n + i + 1 > 0 ? n + i + 1 : 1;
+    else if (i == 0) i = 1;
+    if (j < 0) j = n + j + 1;
+    else if (j > n) j = n;
+    
+    if (i > j) {
+        lua_pushliteral(L, "");
+    } else {
+        Py_ssize_t size = buf->view.itemsize;
+        lua_pushlstring(L, (const char*)buf->view.buf + (i - 1) * size, (size_t)((j - i + 1) * size));
+    }
+    return 1;
+}
+
+/* Raw data pointer for LuaJIT FFI: ffi.cast("float*", buf:ptr()) */
+static int buffer_ptr(lua_State *L) {
+    qelup_Buffer *buf = qelup_checkbuffer(L, 1);
+    lua_pushlightuserdata(L, buf->view.buf);
+    return 1;
+}
+
+/* buf[i] reads item i; other keys are properties and methods */
+static int buffer_index(lua_State *L) {
+    qelup_Buffer *buf = (qelup_Buffer*)luaL_checkudata(L, 1, QELUP_BUFFER_MT);
+    
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        buf = qelup_checkbuffer(L, 1);
+        if (buf->kind == QELUP_ITEM_NONE) {
+            return luaL_error(L, "unsupported buffer format '%s'", buf->view.format);
+        }
+        Py_ssize_t i = qelup_checkitem(L, buf, 2);
+        qelup_pushitem(L, (const char*)buf->view.buf + i * buf->view.itemsize,
+                       buf->kind, buf->view.itemsize);
+        return 1;
+    }
+    
+    const char *key = luaL_checkstring(L, 2);
+    if (strcmp(key, "sub") == 0) {
+        lua_pushcfunction(L, buffer_sub);
+    } else if (strcmp(key, "ptr") == 0) {
+        lua_pushcfunction(L, buffer_ptr);
+    } else if (strcmp(key, "release") == 0) {
+        lua_pushcfunction(L, buffer_release);
+    } else if (strcmp(key, "nbytes") == 0) {
+        lua_pushinteger(L, qelup_bufferlive(buf) ? (lua_Integer)buf->view.len : 0);
+    } else if (strcmp(key, "itemsize") == 0) {
+        lua_pushinteger(L, (lua_Integer)qelup_checkbuffer(L, 1)->view.itemsize);
+    } else if (strcmp(key, "format") == 0) {
+        /* The format string belongs to the exporter */
+        buf = qelup_checkbuffer(L, 1);
+        lua_pushstring(L, buf->view.format != NULL ? buf->view.format : "B");
+    } else if (strcmp(key, "readonly") == 0) {
+        lua_pushboolean(L, qelup_checkbuffer(L, 1)->view.readonly);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+/* buf[i] = value writes item i of a writable buffer */
+static int buffer_newindex(lua_State *L) {
+    qelup_Buffer *buf = qelup_checkbuffer(L, 1);
+    
+    if (buf->view.readonly) {
+        return luaL_error(L, "buffer is read-only");
+    }
+    if (buf->kind == QELUP_ITEM_NONE) {
+        return luaL_error(L, "unsupported buffer format '%s'", buf->view.format);
+    }
+    
+    Py_ssize_t i = qelup_checkitem(L, buf, 2);
+    qelup_storeitem(L, (char*)buf->view.buf + i * buf->view.itemsize,
+                    buf->kind, buf->view.itemsize, 3);
+    return 0;
+}
+
+/* #buf is the number of items */
+static int buffer_len(lua_State *L) {
+    qelup_Buffer *buf = qelup_checkbuffer(L, 1);
+    lua_pushinteger(L, (lua_Integer)(buf->view.len / buf->view.itemsize));
+    return 1;
+}
+
+static int buffer_tostring(lua_State *L) {
+    qelup_Buffer *buf = (qelup_Buffer*)luaL_checkudata(L, 1, QELUP_BUFFER_MT);
+    if (!qelup_bufferlive(buf)) {
+        lua_pushliteral(L, "qelup.buffer: released");
+    } else {
+        lua_pushfstring(L, "qelup.buffer: '%s' x %d", buf->view.format != NULL ? buf->view.format : "B",
+                        (int)(buf->view.len / buf->view.itemsize));
+    }
+    return 1;
+}
+
+/* ========================================================================== */
+/* N-dimensional Arrays */
+/* ========================================================================== */
+
+/*
+    core.ndarray(obj) wraps any strided PEP 3118 buffer (NumPy arrays,
+    memoryviews) with its shape and strides. Indexing and slicing make new
+    views over the same memory; reductions run in C over each innermost row,
+    with typed loops for contiguous rows. Like buffers, element access does
+    not take the GIL.
+*/
+
+/* The owning buffer sits in the view's user value */
+#if LUA_VERSION_NUM >= 502
+    #define qelup_setowner(L, index) lua_setuservalue(L, (index))
+    #define qelup_getowner(L, index) lua_getuservalue(L, (index))
+#else
+    #define qelup_setowner(L, index) lua_setfenv(L, (index))
+    #define qelup_getowner(L, index) lua_getfenv(L, (index))
+#endif
+
+/* Make the value at index `owner` the user value of the userdata on top */
+static void qelup_attachowner(lua_State *L, int owner) {
+    #if LUA_VERSION_NUM >= 502
+    lua_pushvalue(L, owner);
+    #else
+    /* Lua 5.1 environments must be tables */
+    lua_createtable(L, 1, 0);
+    lua_pushvalue(L, owner);
+    lua_rawseti(L, -2, 1);
+    #endif
+    qelup_setowner(L, -2);
+}
+
+/* Push a view of `ndim` dims sharing the owner at stack index `owner` */
+static qelup_NDArray* qelup_newndarray(lua_State *L, int owner, qelup_Buffer *buf, int ndim) {
+    size_t size = sizeof(qelup_NDArray) + (ndim > 0 ? 2 * ndim - 1 : 0) * sizeof(Py_ssize_t);
+    qelup_NDArray *a = (qelup_NDArray*)lua_newuserdata(L, size);
+    a->owner = buf;
+    a->data = NULL;
+    a->ndim = ndim;
+    luaL_getmetatable(L, QELUP_NDARRAY_MT);
+    lua_setmetatable(L, -2);
+    qelup_attachowner(L, owner);
+    return a;
+}
+
+/* Push the owner of the view at index for a derived view */
+static void qelup_pushowner(lua_State *L, int index) {
+    qelup_getowner(L, index);
+    #if LUA_VERSION_NUM < 502
+    lua_rawgeti(L, -1, 1);
+    lua_remove(L, -2);
+    #endif
+}
+
+static qelup_NDArray* qelup_checkndarray(lua_State *L, int index) {
+    qelup_NDArray *a = (qelup_NDArray*)luaL_checkudata(L, index, QELUP_NDARRAY_MT);
+    if (!qelup_bufferlive(a->owner)) {
+        luaL_error(L, "array buffer has been released");
+    }
+    return a;
+}
+
+static Py_ssize_t qelup_numel(qelup_NDArray *a) {
+    Py_ssize_t n = 1;
+    for (int k = 0; k < a->ndim; k++) {
+        n *= QELUP_SHAPE(a)[k];
+    }
+    return n;
+}
+
+/* True when the elements form one C-ordered run */
+static int qelup_ccontiguous(qelup_NDArray *a) {
+    Py_ssize_t expect = a->owner->view.itemsize;
+    for (int k = a->ndim - 1; k >= 0; k--) {
+        if (QELUP_SHAPE(a)[k] != 1 && QELUP_STRIDES(a)[k] != expect) {
+            return 0;
+        }
+        expect *= QELUP_SHAPE(a)[k];
+    }
+    return 1;
+}
+
+/* Wrap a strided buffer: core.ndarray(obj) */
+static int qelup_ndarray(lua_State *L) {
+    qelup_Buffer *buf = qelup_pushbuffer(L, 1, PyBUF_RECORDS_RO);
+    int owner = lua_gettop(L);
+    int ndim = buf->view.ndim;
+    
+    if (ndim > QELUP_MAXDIM) {
+        return luaL_error(L, "array has too many dimensions (%d)", ndim);
+    }
+    if (buf->kind == QELUP_ITEM_NONE) {
+        return luaL_error(L, "unsupported array format '%s'", buf->view.format);
+    }
+    
+    qelup_NDArray *a = qelup_newndarray(L, owner, buf, ndim);
+    a->data = (char*)buf->view.buf;
+    
+    Py_ssize_t stride = buf->view.itemsize;
+    for (int k = ndim - 1; k >= 0; k--) {
+        QELUP_SHAPE(a)[k] = buf->view.shape != NULL ? buf->view.shape[k]
+                                                    : buf->view.len / buf->view.itemsize;
+        /* Exporters may omit strides for C-contiguous data */
+        QELUP_STRIDES(a)[k] = buf->view.strides != NULL ? buf->view.strides[k] : stride;
+        stride *= QELUP_SHAPE(a)[k];
+    }
+    return 1;
+}
+
+/* Element pointer for 1-based indices in stack slots first..first+n-1 */
+static char* qelup_elementptr(lua_State *L, qelup_NDArray *a, int first, int n) {
+    char *p = a->data;
+    for (int k = 0; k < n; k++) {
+        lua_Integer i = luaL_checkinteger(L, first + k);
+        luaL_argcheck(L, i >= 1 && i <= (lua_Integer)QELUP_SHAPE(a)[k], first + k, "index out of range");
+        p += (i - 1) * QELUP_STRIDES(a)[k];
+    }
+    return p;
+}
+
+/* a:get(i, j, ...) reads one element */
+static int ndarray_get(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    if (lua_gettop(L) - 1 != a->ndim) {
+        return luaL_error(L, "expected %d indices", a->ndim);
+    }
+    char *p = qelup_elementptr(L, a, 2, a->ndim);
+    qelup_pushitem(L, p, a->owner->kind, a->owner->view.itemsize);
+    return 1;
+}
+
+/* a:set(i, j, ..., value) writes one element */
+static int ndarray_set(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    if (lua_gettop(L) - 2 != a->ndim) {
+        return luaL_error(L, "expected %d indices and a value", a->ndim);
+    }
+    if (a->owner->view.readonly) {
+        return luaL_error(L, "array is read-only");
+    }
+    char *p = qelup_elementptr(L, a, 2, a->ndim);
+    qelup_storeitem(L, p, a->owner->kind, a->owner->view.itemsize, lua_gettop(L));
+    return 0;
+}
+
+/*
+    a:slice(i, j [, step [, axis]]) views elements i..j (1-based, inclusive,
+    negative counts from the end) along axis (default 1) without copying.
+*/
+static int ndarray_slice(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    lua_Integer j = luaL_optinteger(L, 3, -1);
+    lua_Integer step = luaL_optinteger(L, 4, 1);
+    int axis = (int)luaL_optinteger(L, 5, 1) - 1;
+    
+    luaL_argcheck(L, step != 0, 4, "step must not be zero");
+    luaL_argcheck(L, axis >= 0 && axis < a->ndim, 5, "axis out of range");
+    
+    lua_Integer n = (lua_Integer)QELUP_SHAPE(a)[axis];
+    if (i < 0) i += n + 1;
+    if (j < 0) j += n + 1;
+    
+    lua_Integer count;
+    if (step > 0) {
+        if (i < 1) i = 1;
+        if (j > n) j = n;
+        count = i > j ? 0 : (j - i) / step + 1;
+    } else {
+        if (i > n) i = n;
+        if (j < 1) j = 1;
+        count = i < j ? 0 : (i - j) / -step + 1;
+    }
+    
+    qelup_pushowner(L, 1);
+    qelup_NDArray *view = qelup_newndarray(L, lua_gettop(L), a->owner, a->ndim);
+    memcpy(view->dims, a->dims, 2 * a->ndim * sizeof(Py_ssize_t));
+    view->data = a->data + (count > 0 ? (i - 1) * QELUP_STRIDES(a)[axis] : 0);
+    QELUP_SHAPE(view)[axis] = (Py_ssize_t)count;
+    QELUP_STRIDES(view)[axis] = QELUP_STRIDES(a)[axis] * (Py_ssize_t)step;
+    return 1;
+}
+
+/* Row kernels: results of one strided run of elements */
+enum { QELUP_REDUCE_SUM, QELUP_REDUCE_MIN, QELUP_REDUCE_MAX };
+
+typedef struct {
+    double sum;
+    double min;
+    double max;
+} qelup_Reduce;
+
+typedef double (*qelup_ReadFn)(const char *p);
+
+#define QELUP_READER(name, T) \
+    static double qelup_read_##name(const char *p) { T x; memcpy(&x, p, sizeof(T)); return (double)x; }
+
+QELUP_READER(f64, double)
+QELUP_READER(f32, float)
+QELUP_READER(i8, int8_t)
+QELUP_READER(i16, int16_t)
+QELUP_READER(i32, int32_t)
+QELUP_READER(i64, int64_t)
+QELUP_READER(u8, uint8_t)
+QELUP_READER(u16, uint16_t)
+QELUP_READER(u32, uint32_t)
+QELUP_READER(u64, uint64_t)
+
+static double qelup_read_bool(const char *p) {
+    return *p != 0 ? 1.0 : 0.0;
+}
+
+static qelup_ReadFn qelup_reader(int kind, Py_ssize_t size) {
+    switch (kind) {
+        case QELUP_ITEM_FLOAT:
+            return size == 4 ? qelup_read_f32 : qelup_read_f64;
+        case QELUP_ITEM_INT:
+            return size == 1 ? qelup_read_i8 : size == 2 ? qelup_read_i16 :
+                   size == 4 ? qelup_read_i32 : qelup_read_i64;
+        case QELUP_ITEM_UINT:
+            return size == 1 ? qelup_read_u8 : size == 2 ? qelup_read_u16 :
+                   size == 4 ? qelup_read_u32 : qelup_read_u64;
+        default:
+            return qelup_read_bool;
+    }
+}
+
+/*
+    Contiguous, aligned rows of common types get plain typed loops the
+    compiler can unroll and vectorize; the sum keeps four partial totals.
+*/
+#define QELUP_ROW_KERNEL(name, T) \
+    static void qelup_row_##name(const T *x, Py_ssize_t n, int op, qelup_Reduce *r) { \
+        Py_ssize_t i = 0; \
+        if (op == QELUP_REDUCE_SUM) { \
+            double s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+            for (; i + 4 <= n; i += 4) { \
+                s0 += (double)x[i]; s1 += (double)x[i + 1]; \
+                s2 += (double)x[i + 2]; s3 += (double)x[i + 3]; \
+            } \
+            for (; i < n; i++) s0 += (double)x[i]; \
+            r->sum += (s0 + s1) + (s2 + s3); \
+        } else if (op == QELUP_REDUCE_MIN) { \
+            T m = x[0]; \
+            for (i = 1; i < n; i++) m = x[i] < m ? x[i] : m; \
+            if ((double)m < r->min) r->min = (double)m; \
+        } else { \
+            T m = x[0]; \
+            for (i = 1; i < n; i++) m = x[i] > m ? x[i] : m; \
+            if ((double)m > r->max) r->max = (double)m; \
+        } \
+    }
+
+QELUP_ROW_KERNEL(f64, double)
+QELUP_ROW_KERNEL(f32, float)
+QELUP_ROW_KERNEL(i32, int32_t)
+QELUP_ROW_KERNEL(i64, int64_t)
+QELUP_ROW_KERNEL(u8, uint8_t)
+QELUP_ROW_KERNEL(i16, int16_t)
+
+/* Reduce n elements starting at p, `stride` bytes apart (n >= 1) */
+static void qelup_reducerow(const char *p, Py_ssize_t n, Py_ssize_t stride,
+                            int kind, Py_ssize_t size, int op, qelup_Reduce *r) {
+    if (stride == size && ((uintptr_t)p % (uintptr_t)size) == 0) {
+        if (kind == QELUP_ITEM_FLOAT && size == 8) { qelup_row_f64((const double*)p, n, op, r); return; }
+        if (kind == QELUP_ITEM_FLOAT && size == 4) { qelup_row_f32((const float*)p, n, op, r); return; }
+        if (kind == QELUP_ITEM_INT && size == 4) { qelup_row_i32((const int32_t*)p, n, op, r); return; }
+        if (kind == QELUP_ITEM_INT && size == 8) { qelup_row_i64((const int64_t*)p, n, op, r); return; }
+        if (kind == QELUP_ITEM_INT && size == 2) { qelup_row_i16((const int16_t*)p, n, op, r); return; }
+        if (kind == QELUP_ITEM_UINT && size == 1) { qelup_row_u8((const uint8_t*)p, n, op, r); return; }
+    }
+    
+    qelup_ReadFn read = qelup_reader(kind, size);
+    for (Py_ssize_t i = 0; i < n; i++, p += stride) {
+        double v = read(p);
+        if (op == QELUP_REDUCE_SUM) {
+            r->sum += v;
+        } else if (op == QELUP_REDUCE_MIN) {
+            if (v < r->min) r->min = v;
+        } else if (v > r->max) {
+            r->max = v;
+        }
+    }
+}
+
+/* Start of the innermost row at outer indices idx[0 .. ndim-2] */
+static const char* qelup_rowptr(qelup_NDArray *a, const Py_ssize_t *idx) {
+    const char *p = a->data;
+    for (int k = 0; k < a->ndim - 1; k++) {
+        p += idx[k] * QELUP_STRIDES(a)[k];
+    }
+    return p;
+}
+
+/* Step idx to the next innermost row; returns 0 after the last one */
+static int qelup_nextrow(qelup_NDArray *a, Py_ssize_t *idx) {
+    for (int k = a->ndim - 2; k >= 0; k--) {
+        if (++idx[k] < QELUP_SHAPE(a)[k]) {
+            return 1;
+        }
+        idx[k] = 0;
+    }
+    return 0;
+}
+
+static void qelup_reduce(qelup_NDArray *a, int op, qelup_Reduce *r) {
+    int kind = a->owner->kind;
+    Py_ssize_t size = a->owner->view.itemsize;
+    
+    if (a->ndim == 0 || qelup_ccontiguous(a)) {
+        qelup_reducerow(a->data, qelup_numel(a), size, kind, size, op, r);
+        return;
+    }
+    
+    /* Otherwise one strided pass per innermost row */
+    Py_ssize_t n = QELUP_SHAPE(a)[a->ndim - 1];
+    Py_ssize_t stride = QELUP_STRIDES(a)[a->ndim - 1];
+    Py_ssize_t idx[QELUP_MAXDIM] = {0};
+    do {
+        qelup_reducerow(qelup_rowptr(a, idx), n, stride, kind, size, op, r);
+    } while (qelup_nextrow(a, idx));
+}
+
+/* Push a reduction result, as an integer for integer arrays when exact */
+static void qelup_pushresult(lua_State *L, qelup_NDArray *a, double v) {
+    #if LUA_VERSION_NUM >= 503
+    int kind = a->owner->kind;
+    if ((kind == QELUP_ITEM_INT || kind == QELUP_ITEM_UINT)
+        && v >= -9007199254740992.0 && v <= 9007199254740992.0) {
+        lua_pushinteger(L, (lua_Integer)v);
+        return;
+    }
+    #else
+    (void)a;
+    #endif
+    lua_pushnumber(L, (lua_Number)v);
+}
+
+static int ndarray_sum(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    qelup_Reduce r = {0, 0, 0};
+    if (qelup_numel(a) > 0) {
+        qelup_reduce(a, QELUP_REDUCE_SUM, &r);
+    }
+    qelup_pushresult(L, a, r.sum);
+    return 1;
+}
+
+static int ndarray_mean(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    Py_ssize_t n = qelup_numel(a);
+    qelup_Reduce r = {0, 0, 0};
+    if (n == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    qelup_reduce(a, QELUP_REDUCE_SUM, &r);
+    lua_pushnumber(L, (lua_Number)(r.sum / (double)n));
+    return 1;
+}
+
+/* Shared by min and max; empty arrays give nil */
+static int qelup_extreme(lua_State *L, int op) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    qelup_Reduce r = {0, HUGE_VAL, -HUGE_VAL};
+    if (qelup_numel(a) == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    qelup_reduce(a, op, &r);
+    qelup_pushresult(L, a, op == QELUP_REDUCE_MIN ? r.min : r.max);
+    return 1;
+}
+
+static int ndarray_min(lua_State *L) {
+    return qelup_extreme(L, QELUP_REDUCE_MIN);
+}
+
+static int ndarray_max(lua_State *L) {
+    return qelup_extreme(L, QELUP_REDUCE_MAX);
+}
+
+/* Inner product of two arrays of the same shape: a:dot(b) */
+static int ndarray_dot(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    qelup_NDArray *b = qelup_checkndarray(L, 2);
+    
+    luaL_argcheck(L, a->ndim == b->ndim
+                  && memcmp(QELUP_SHAPE(a), QELUP_SHAPE(b), a->ndim * sizeof(Py_ssize_t)) == 0,
+                  2, "shape mismatch");
+    
+    double sum = 0;
+    if (qelup_numel(a) == 0) {
+        lua_pushnumber(L, 0);
+        return 1;
+    }
+    
+    Py_ssize_t sa = a->owner->view.itemsize;
+    Py_ssize_t sb = b->owner->view.itemsize;
+    
+    /* Contiguous float64 . float64 is the common case: one typed loop */
+    if (a->owner->kind == QELUP_ITEM_FLOAT && b->owner->kind == QELUP_ITEM_FLOAT
+        && sa == 8 && sb == 8 && qelup_ccontiguous(a) && qelup_ccontiguous(b)
+        && ((uintptr_t)a->data % 8) == 0 && ((uintptr_t)b->data % 8) == 0) {
+        const double *x = (const double*)a->data;
+        const double *y = (const double*)b->data;
+        Py_ssize_t n = qelup_numel(a);
+        double s0 = 0, s1 = 0;
+        Py_ssize_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            s0 += x[i] * y[i];
+            s1 += x[i + 1] * y[i + 1];
+        }
+        for (; i < n; i++) {
+            s0 += x[i] * y[i];
+        }
+        lua_pushnumber(L, (lua_Number)(s0 + s1));
+        return 1;
+    }
+    
+    qelup_ReadFn ra = qelup_reader(a->owner->kind, sa);
+    qelup_ReadFn rb = qelup_reader(b->owner->kind, sb);
+    
+    if (a->ndim == 0) {
+        lua_pushnumber(L, (lua_Number)(ra(a->data) * rb(b->data)));
+        return 1;
+    }
+    
+    Py_ssize_t n = QELUP_SHAPE(a)[a->ndim - 1];
+    Py_ssize_t stra = QELUP_STRIDES(a)[a->ndim - 1];
+    Py_ssize_t strb = QELUP_STRIDES(b)[b->ndim - 1];
+    Py_ssize_t idx[QELUP_MAXDIM] = {0};
+    do {
+        const char *pa = qelup_rowptr(a, idx);
+        const char *pb = qelup_rowptr(b, idx);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            sum += ra(pa + i * stra) * rb(pb + i * strb);
+        }
+    } while (qelup_nextrow(a, idx));
+    
+    lua_pushnumber(L, (lua_Number)sum);
+    return 1;
+}
+
+/* Push a Lua array of shape or strides */
+static void qelup_pushdims(lua_State *L, const Py_ssize_t *dims, int ndim) {
+    lua_createtable(L, ndim, 0);
+    for (int k = 0; k < ndim; k++) {
+        lua_pushinteger(L, (lua_Integer)dims[k]);
+        lua_rawseti(L, -2, k + 1);
+    }
+}
+
+/* Raw pointer to the view's first element, for LuaJIT FFI */
+static int ndarray_ptr(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    lua_pushlightuserdata(L, a->data);
+    return 1;
+}
+
+/*
+    a[i] is element i of a 1-D array, or the (ndim-1)-dimensional view at
+    index i along the first axis; other keys are properties and methods.
+*/
+static int ndarray_index(lua_State *L) {
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        qelup_NDArray *a = qelup_checkndarray(L, 1);
+        luaL_argcheck(L, a->ndim >= 1, 2, "cannot index a 0-d array");
+        char *p = qelup_elementptr(L, a, 2, 1);
+        
+        if (a->ndim == 1) {
+            qelup_pushitem(L, p, a->owner->kind, a->owner->view.itemsize);
+            return 1;
+        }
+        
+        qelup_pushowner(L, 1);
+        qelup_NDArray *row = qelup_newndarray(L, lua_gettop(L), a->owner, a->ndim - 1);
+        row->data = p;
+        memcpy(QELUP_SHAPE(row), QELUP_SHAPE(a) + 1, (a->ndim - 1) * sizeof(Py_ssize_t));
+        memcpy(QELUP_STRIDES(row), QELUP_STRIDES(a) + 1, (a->ndim - 1) * sizeof(Py_ssize_t));
+        return 1;
+    }
+    
+    qelup_NDArray *a = (qelup_NDArray*)luaL_checkudata(L, 1, QELUP_NDARRAY_MT);
+    const char *key = luaL_checkstring(L, 2);
+    static const luaL_Reg methods[] = {
+        {"get", ndarray_get},
+        {"set", ndarray_set},
+        {"slice", ndarray_slice},
+        {"sum", ndarray_sum},
+        {"mean", ndarray_mean},
+        {"min", ndarray_min},
+        {"max", ndarray_max},
+        {"dot", ndarray_dot},
+        {"ptr", ndarray_ptr},
+        {NULL, NULL}
+    };
+    
+    for (const luaL_Reg *m = methods; m->name != NULL; m++) {
+        if (strcmp(key, m->name) == 0) {
+            lua_pushcfunction(L, m->func);
+            return 1;
+        }
+    }
+    
+    if (strcmp(key, "ndim") == 0) {
+        lua_pushinteger(L, a->ndim);
+    } else if (strcmp(key, "shape") == 0) {
+        qelup_pushdims(L, QELUP_SHAPE(a), a->ndim);
+    } else if (strcmp(key, "strides") == 0) {
+        qelup_pushdims(L, QELUP_STRIDES(a), a->ndim);
+    } else if (strcmp(key, "size") == 0) {
+        lua_pushinteger(L, (lua_Integer)qelup_numel(a));
+    } else if (strcmp(key, "itemsize") == 0) {
+        lua_pushinteger(L, (lua_Integer)qelup_checkndarray(L, 1)->owner->view.itemsize);
+    } else if (strcmp(key, "format") == 0) {
+        /* The format string belongs to the exporter */
+        a = qelup_checkndarray(L, 1);
+        lua_pushstring(L, a->owner->view.format != NULL ? a->owner->view.format : "B");
+    } else if (strcmp(key, "contiguous") == 0) {
+        lua_pushboolean(L, qelup_ccontiguous(a));
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+/* a[i] = value for 1-D arrays */
+static int ndarray_newindex(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    if (a->ndim != 1) {
+        return luaL_error(L, "use a:set(...) to write a %d-d array", a->ndim);
+    }
+    if (a->owner->view.readonly) {
+        return luaL_error(L, "array is read-only");
+    }
+    char *p = qelup_elementptr(L, a, 2, 1);
+    qelup_storeitem(L, p, a->owner->kind, a->owner->view.itemsize, 3);
+    return 0;
+}
+
+/* #a is the length of the first axis */
+static int ndarray_len(lua_State *L) {
+    qelup_NDArray *a = qelup_checkndarray(L, 1);
+    lua_pushinteger(L, a->ndim > 0 ? (lua_Integer)QELUP_SHAPE(a)[0] : 1);
+    return 1;
+}
+
+static int ndarray_tostring(lua_State *L) {
+    qelup_NDArray *a = (qelup_NDArray*)luaL_checkudata(L, 1, QELUP_NDARRAY_MT);
+    if (!qelup_bufferlive(a->owner)) {
+        lua_pushliteral(L, "qelup.ndarray: released");
+        return 1;
+    }
+    
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    luaL_addstring(&b, "qelup.ndarray: (");
+    for (int k = 0; k < a->ndim; k++) {
+        lua_pushfstring(L, k > 0 ? ", %d" : "%d", (int)QELUP_SHAPE(a)[k]);
+        luaL_addvalue(&b);
+    }
+    lua_pushfstring(L, ") '%s'", a->owner->view.format != NULL ? a->owner->view.format : "B");
+    luaL_addvalue(&b);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/* ========================================================================== */
+/* Arrow C Data Interface */
+/* ========================================================================== */
+
+/*
+    Columnar data crosses the bridge as Arrow C Data Interface structs, so no
+    Arrow library is needed. core.arrow(obj) moves a record batch or array
+    out of any object with __arrow_c_array__ (or pyarrow's _export_to_c);
+    core.arrowstream(obj) walks the batches of __arrow_c_stream__. Columns
+    are then read in place. core.toarrow(columns, names) builds a batch from
+    Lua arrays that Python libraries import through __arrow_c_array__.
+*/
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char *format;
+    const char *name;
+    const char *metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema **children;
+    struct ArrowSchema *dictionary;
+    void (*release)(struct ArrowSchema*);
+    void *private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void **buffers;
+    struct ArrowArray **children;
+    struct ArrowArray *dictionary;
+    void (*release)(struct ArrowArray*);
+    void *private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+    int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema *out);
+    int (*get_next)(struct ArrowArrayStream*, struct ArrowArray *out);
+    const char* (*get_last_error)(struct ArrowArrayStream*);
+    void (*release)(struct ArrowArrayStream*);
+    void *private_data;
+};
+
+#endif /* ARROW_C_STREAM_INTERFACE */
+
+/* An imported record batch or array; its schema may belong to a stream */
+typedef struct {
+    struct ArrowArray array;
+    struct ArrowSchema own;         /* schema when imported on its own */
+    struct ArrowSchema *schema;     /* &own, or the stream's (the user value) */
+    int generation;
+} qelup_Arrow;
+
+typedef struct {
+    struct ArrowArrayStream stream;
+    struct ArrowSchema schema;
+    int generation;
+} qelup_ArrowStream;
+
+/*
+    One column of an imported batch, read in place; the batch is its user
+    value. A struct child is indexed through its parent: row i is child row
+    parent->offset + i, the parent's length bounds the column and a null
+    parent row is a null value.
+*/
+typedef struct {
+    qelup_Arrow *batch;
+    struct ArrowSchema *schema;
+    struct ArrowArray *array;
+    const struct ArrowArray *parent;    /* the struct array, NULL for plain arrays */
+    int64_t offset;     /* parent offset added to every row */
+    int64_t length;     /* rows visible through the parent */
+    int kind;           /* QELUP_ITEM_* or QELUP_ARROW_* */
+    int width;          /* bytes per value, or per offset for strings */
+} qelup_ArrowCol;
+
+/* Column kinds beyond the buffer item kinds */
+enum { QELUP_ARROW_BITS = 16, QELUP_ARROW_STRING, QELUP_ARROW_NULL };
+
+/* Decode an Arrow format string into a column kind and value width */
+static int qelup_arrowkind(const char *format, int *width) {
+    *width = 0;
+    if (format == NULL || format[0] == '\0') {
+        return QELUP_ITEM_NONE;
+    }
+    if (format[1] == '\0') {
+        switch (format[0]) {
+            case 'n': return QELUP_ARROW_NULL;
+            case 'b': return QELUP_ARROW_BITS;
+            case 'c': *width = 1; return QELUP_ITEM_INT;
+            case 'C': *width = 1; return QELUP_ITEM_UINT;
+            case 's': *width = 2; return QELUP_ITEM_INT;
+            case 'S': *width = 2; return QELUP_ITEM_UINT;
+            case 'i': *width = 4; return QELUP_ITEM_INT;
+            case 'I': *width = 4; return QELUP_ITEM_UINT;
+            case 'l': *width = 8; return QELUP_ITEM_INT;
+            case 'L': *width = 8; return QELUP_ITEM_UINT;
+            case 'f': *width = 4; return QELUP_ITEM_FLOAT;
+            case 'g': *width = 8; return QELUP_ITEM_FLOAT;
+            case 'u': case 'z': *width = 4; return QELUP_ARROW_STRING;
+            case 'U': case 'Z': *width = 8; return QELUP_ARROW_STRING;
+            default: return QELUP_ITEM_NONE;
+        }
+    }
+    /* Dates, times, timestamps and durations read as their integer storage */
+    if (strcmp(format, "tdD") == 0 || strcmp(format, "tts") == 0 || strcmp(format, "ttm") == 0) {
+        *width = 4;
+        return QELUP_ITEM_INT;
+    }
+    if (strcmp(format, "tdm") == 0 || strcmp(format, "ttu") == 0 || strcmp(format, "ttn") == 0
+        || strncmp(format, "ts", 2) == 0 || strncmp(format, "tD", 2) == 0) {
+        *width = 8;
+        return QELUP_ITEM_INT;
+    }
+    return QELUP_ITEM_NONE;
+}
+
+/* Whether bit j of an array's validity bitmap marks a null */
+static int qelup_arrowbitnull(const struct ArrowArray *a, int64_t j) {
+    const uint8_t *validity = a->null_count != 0 && a->n_buffers > 0 ? (const uint8_t*)a->buffers[0] : NULL;
+    return validity != NULL && !((validity[j >> 3] >> (j & 7)) & 1);
+}
+
+/* Whether row i (0-based) of a column is null, in the column or its parent */
+static int qelup_arrowisnull(qelup_ArrowCol *c, int64_t i) {
+    return c->kind == QELUP_ARROW_NULL
+        || (c->parent != NULL && qelup_arrowbitnull(c->parent, c->parent->offset + i))
+        || qelup_arrowbitnull(c->array, c->array->offset + c->offset + i);
+}
+
+/* Push row i (0-based, before any offset) of a column */
+static void qelup_pusharrowvalue(lua_State *L, qelup_ArrowCol *c, int64_t i) {
+    struct ArrowArray *a = c->array;
+    int64_t j = a->offset + c->offset + i;
+    
+    if (qelup_arrowisnull(c, i)) {
+        lua_pushnil(L);
+        return;
+    }
+    
+    switch (c->kind) {
+        case QELUP_ARROW_BITS: {
+            const uint8_t *bits = (const uint8_t*)a->buffers[1];
+            lua_pushboolean(L, (bits[j >> 3] >> (j & 7)) & 1);
+            break;
+        }
+        case QELUP_ARROW_STRING: {
+            int64_t start, end;
+            if (c->width == 4) {
+                const int32_t *offsets = (const int32_t*)a->buffers[1];
+                start = offsets[j];
+                end = offsets[j + 1];
+            } else {
+                const int64_t *offsets = (const int64_t*)a->buffers[1];
+                start = offsets[j];
+                end = offsets[j + 1];
+            }
+            lua_pushlstring(L, (const char*)a->buffers[2] + start, (size_t)(end - start));
+            break;
+        }
+        default:
+            qelup_pushitem(L, (const char*)a->buffers[1] + j * c->width, c->kind, c->width);
+            break;
+    }
+}
+
+/* Push an empty batch userdata whose schema is its own */
+static qelup_Arrow* qelup_newarrow(lua_State *L) {
+    qelup_Arrow *a = (qelup_Arrow*)lua_newuserdata(L, sizeof(qelup_Arrow));
+    memset(a, 0, sizeof(qelup_Arrow));
+    a->schema = &a->own;
+    a->generation = qelup_generation;
+    luaL_getmetatable(L, QELUP_ARROW_MT);
+    lua_setmetatable(L, -2);
+    return a;
+}
+
+/* Raise the last error of a stream as a Python exception */
+static int qelup_streamerror(struct ArrowArrayStream *stream, int code) {
+    const char *msg = stream->get_last_error != NULL ? stream->get_last_error(stream) : NULL;
+    PyErr_Format(PyExc_RuntimeError, "Arrow stream error %d: %s", code, msg != NULL ? msg : "unknown");
+    return -1;
+}
+
+/* Move a schema and array out of a Python exporter (GIL held) */
+static int qelup_importarray(PyObject *obj, struct ArrowSchema *schema, struct ArrowArray *array) {
+    if (PyObject_HasAttrString(obj, "__arrow_c_array__")) {
+        PyObject *pair = PyObject_CallMethod(obj, "__arrow_c_array__", NULL);
+        if (pair == NULL) {
+            return -1;
+        }
+        if (!PyTuple_Check(pair) || PyTuple_GET_SIZE(pair) != 2) {
+            Py_DECREF(pair);
+            PyErr_SetString(PyExc_TypeError, "__arrow_c_array__ must return a (schema, array) tuple");
+            return -1;
+        }
+        
+        struct ArrowSchema *s = (struct ArrowSchema*)PyCapsule_GetPointer(PyTuple_GET_ITEM(pair, 0), "arrow_schema");
+        struct ArrowArray *a = s != NULL
+            ? (struct ArrowArray*)PyCapsule_GetPointer(PyTuple_GET_ITEM(pair, 1), "arrow_array")
+            : NULL;
+        if (a == NULL) {
+            Py_DECREF(pair);
+            return -1;
+        }
+        
+        /* Move: the capsule destructors then find release == NULL */
+        *schema = *s;
+        s->release = NULL;
+        *array = *a;
+        a->release = NULL;
+        Py_DECREF(pair);
+        return 0;
+    }
+    
+    if (PyObject_HasAttrString(obj, "_export_to_c")) {
+        /* pyarrow before the PyCapsule interface writes into our structs */
+        PyObject *result = PyObject_CallMethod(obj, "_export_to_c", "NN",
+                                               PyLong_FromVoidPtr(array), PyLong_FromVoidPtr(schema));
+        if (result == NULL) {
+            return -1;
+        }
+        Py_DECREF(result);
+        return 0;
+    }
+    
+    PyErr_SetString(PyExc_TypeError, "object does not export Arrow data (__arrow_c_array__)");
+    return -1;
+}
+
+/* Import a batch or array: core.arrow(obj) */
+static int qelup_arrow(lua_State *L) {
+    check_initialized(L);
+    
+    PyObject *obj = qelup_topyobject(L, 1);
+    if (obj == NULL) {
+        return luaL_argerror(L, 1, "expected Python object");
+    }
+    
+    qelup_Arrow *a = qelup_newarrow(L);
+    
+    QELUP_GIL_ACQUIRE();
+    if (qelup_importarray(obj, &a->own, &a->array) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_STAT_ADD(wrappers, 1);
+    QELUP_GIL_RELEASE();
+    
+    if (a->own.format == NULL) {
+        return luaL_error(L, "Arrow export produced no schema");
+    }
+    return 1;
+}
+
+/* Next batch of a stream, or nothing at the end (upvalue: stream) */
+static int arrowstream_next(lua_State *L) {
+    qelup_ArrowStream *st = (qelup_ArrowStream*)lua_touserdata(L, lua_upvalueindex(1));
+    if (st->stream.release == NULL || st->generation != qelup_generation) {
+        return 0;
+    }
+    
+    qelup_Arrow *a = qelup_newarrow(L);
+    a->schema = &st->schema;
+    qelup_attachowner(L, lua_upvalueindex(1));
+    
+    QELUP_GIL_ACQUIRE();
+    int rc = st->stream.get_next(&st->stream, &a->array);
+    if (rc != 0) {
+        qelup_streamerror(&st->stream, rc);
+        return handle_python_exception(L, qelup_gil);
+    }
+    if (a->array.release != NULL) {
+        QELUP_STAT_ADD(wrappers, 1);
+    }
+    QELUP_GIL_RELEASE();
+    
+    /* A released array marks the end of the stream */
+    return a->array.release != NULL ? 1 : 0;
+}
+
+/* Iterate the batches of an Arrow stream: for batch in core.arrowstream(obj) */
+static int qelup_arrowstream(lua_State *L) {
+    check_initialized(L);
+    
+    PyObject *obj = qelup_topyobject(L, 1);
+    if (obj == NULL) {
+        return luaL_argerror(L, 1, "expected Python object");
+    }
+    
+    qelup_ArrowStream *st = (qelup_ArrowStream*)lua_newuserdata(L, sizeof(qelup_ArrowStream));
+    memset(st, 0, sizeof(qelup_ArrowStream));
+    st->generation = qelup_generation;
+    luaL_getmetatable(L, QELUP_ARROWSTREAM_MT);
+    lua_setmetatable(L, -2);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *capsule = PyObject_CallMethod(obj, "__arrow_c_stream__", NULL);
+    if (capsule == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    struct ArrowArrayStream *stream =
+        (struct ArrowArrayStream*)PyCapsule_GetPointer(capsule, "arrow_array_stream");
+    if (stream == NULL) {
+        Py_DECREF(capsule);
+        return handle_python_exception(L, qelup_gil);
+    }
+    st->stream = *stream;
+    stream->release = NULL;
+    Py_DECREF(capsule);
+    
+    int rc = st->stream.get_schema(&st->stream, &st->schema);
+    if (rc != 0) {
+        qelup_streamerror(&st->stream, rc);
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    
+    lua_pushcclosure(L, arrowstream_next, 1);
+    return 1;
+}
+
+static int arrowstream_gc(lua_State *L) {
+    qelup_ArrowStream *st = (qelup_ArrowStream*)lua_touserdata(L, 1);
+    if (Py_IsInitialized() && st->generation == qelup_generation
+        && (st->schema.release != NULL || st->stream.release != NULL)) {
+        QELUP_GIL_ACQUIRE();
+        if (st->schema.release != NULL) {
+            st->schema.release(&st->schema);
+        }
+        if (st->stream.release != NULL) {
+            st->stream.release(&st->stream);
+        }
+        QELUP_GIL_RELEASE();
+    }
+    st->schema.release = NULL;
+    st->stream.release = NULL;
+    return 0;
+}
+
+/* Release the producer's memory (producers may touch Python, so under the GIL) */
+static int arrow_release(lua_State *L) {
+    qelup_Arrow *a = (qelup_Arrow*)luaL_checkudata(L, 1, QELUP_ARROW_MT);
+    if (Py_IsInitialized() && a->generation == qelup_generation
+        && (a->array.release != NULL || a->own.release != NULL)) {
+        QELUP_GIL_ACQUIRE();
+        if (a->array.release != NULL) {
+            a->array.release(&a->array);
+        }
+        if (a->own.release != NULL) {
+            a->own.release(&a->own);
+        }
+        QELUP_GIL_RELEASE();
+    }
+    a->array.release = NULL;
+    a->own.release = NULL;
+    return 0;
+}
+
+static qelup_Arrow* qelup_checkarrow(lua_State *L, int index) {
+    qelup_Arrow *a = (qelup_Arrow*)luaL_checkudata(L, index, QELUP_ARROW_MT);
+    if (a->array.release == NULL || a->schema->release == NULL || a->generation != qelup_generation) {
+        luaL_error(L, "Arrow batch has been released");
+    }
+    return a;
+}
+
+/* Record batches ("+s") have one column per child; plain arrays are one column */
+static int qelup_isbatch(qelup_Arrow *a) {
+    return strcmp(a->schema->format, "+s") == 0;
+}
+
+static int64_t qelup_arrowncols(qelup_Arrow *a) {
+    return qelup_isbatch(a) ? a->schema->n_children : 1;
+}
+
+static const char* qelup_arrowname(qelup_Arrow *a, int64_t k) {
+    const char *name = qelup_isbatch(a) ? a->schema->children[k]->name : a->schema->name;
+    return name != NULL ? name : "";
+}
+
+/* batch:column(i | name) */
+static int arrow_column(lua_State *L) {
+    qelup_Arrow *a = qelup_checkarrow(L, 1);
+    int64_t ncols = qelup_arrowncols(a);
+    int64_t k = -1;
+    
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        const char *name = lua_tostring(L, 2);
+        for (int64_t i = 0; i < ncols && k < 0; i++) {
+            if (strcmp(qelup_arrowname(a, i), name) == 0) {
+                k = i;
+            }
+        }
+        if (k < 0) {
+            return luaL_error(L, "no column named '%s'", name);
+        }
+    } else {
+        k = (int64_t)luaL_checkinteger(L, 2) - 1;
+        luaL_argcheck(L, k >= 0 && k < ncols, 2, "column index out of range");
+    }
+    
+    qelup_ArrowCol *c = (qelup_ArrowCol*)lua_newuserdata(L, sizeof(qelup_ArrowCol));
+    c->batch = a;
+    c->schema = qelup_isbatch(a) ? a->schema->children[k] : a->schema;
+    c->array = qelup_isbatch(a) ? a->array.children[k] : &a->array;
+    c->parent = qelup_isbatch(a) ? &a->array : NULL;
+    c->offset = qelup_isbatch(a) ? a->array.offset : 0;
+    c->length = a->array.length;
+    c->kind = qelup_arrowkind(c->schema->format, &c->width);
+    
+    /* Reject columns whose buffers do not match the format */
+    int64_t need = c->kind == QELUP_ARROW_STRING ? 3 : c->kind == QELUP_ARROW_NULL ? 0 : 2;
+    if (c->kind != QELUP_ITEM_NONE && c->array->n_buffers < need) {
+        c->kind = QELUP_ITEM_NONE;
+    }
+    /* Dictionary columns store indices under the format; the values live elsewhere */
+    if (c->schema->dictionary != NULL) {
+        c->kind = QELUP_ITEM_NONE;
+    }
+    
+    luaL_getmetatable(L, QELUP_ARROWCOL_MT);
+    lua_setmetatable(L, -2);
+    qelup_attachowner(L, 1);
+    return 1;
+}
+
+static int arrow_index(lua_State *L) {
+    qelup_Arrow *a = qelup_checkarrow(L, 1);
+    const char *key = luaL_checkstring(L, 2);
+    
+    if (strcmp(key, "column") == 0) {
+        lua_pushcfunction(L, arrow_column);
+    } else if (strcmp(key, "release") == 0) {
+        lua_pushcfunction(L, arrow_release);
+    } else if (strcmp(key, "length") == 0) {
+        lua_pushinteger(L, (lua_Integer)a->array.length);
+    } else if (strcmp(key, "ncolumns") == 0) {
+        lua_pushinteger(L, (lua_Integer)qelup_arrowncols(a));
+    } else if (strcmp(key, "format") == 0) {
+        lua_pushstring(L, a->schema->format);
+    } else if (strcmp(key, "names") == 0) {
+        int64_t ncols = qelup_arrowncols(a);
+        lua_createtable(L, (int)ncols, 0);
+        for (int64_t k = 0; k < ncols; k++) {
+            lua_pushstring(L, qelup_arrowname(a, k));
+            lua_rawseti(L, -2, (lua_Integer)k + 1);
+        }
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int arrow_len(lua_State *L) {
+    qelup_Arrow *a = qelup_checkarrow(L, 1);
+    lua_pushinteger(L, (lua_Integer)a->array.length);
+    return 1;
+}
+
+static int arrow_tostring(lua_State *L) {
+    qelup_Arrow *a = (qelup_Arrow*)luaL_checkudata(L, 1, QELUP_ARROW_MT);
+    if (a->array.release == NULL) {
+        lua_pushliteral(L, "qelup.arrow: released");
+    } else {
+        lua_pushfstring(L, "qelup.arrow: %d rows x %d columns",
+                        (int)a->array.length, (int)qelup_arrowncols(a));
+    }
+    return 1;
+}
+
+static qelup_ArrowCol* qelup_checkarrowcol(lua_State *L, int index) {
+    qelup_ArrowCol *c = (qelup_ArrowCol*)luaL_checkudata(L, index, QELUP_ARROWCOL_MT);
+    if (c->batch->array.release == NULL || c->batch->generation != qelup_generation) {
+        luaL_error(L, "Arrow batch has been released");
+    }
+    if (c->kind == QELUP_ITEM_NONE) {
+        if (c->schema->dictionary != NULL) {
+            luaL_error(L, "dictionary-encoded Arrow columns are not supported");
+        }
+        luaL_error(L, "unsupported Arrow column type '%s'", c->schema->format);
+    }
+    return c;
+}
+
+/* Nulls visible through the parent; counted only when the child's own count does not apply */
+static int64_t qelup_arrownulls(qelup_ArrowCol *c) {
+    if (c->parent == NULL || (c->offset == 0 && c->length == c->array->length && c->parent->null_count == 0)) {
+        return c->array->null_count;
+    }
+    int64_t n = 0;
+    for (int64_t i = 0; i < c->length; i++) {
+        n += qelup_arrowisnull(c, i);
+    }
+    return n;
+}
+
+/* col:totable() copies the column into a Lua array (nulls become holes) */
+static int arrowcol_totable(lua_State *L) {
+    qelup_ArrowCol *c = qelup_checkarrowcol(L, 1);
+    int64_t n = c->length;
+    
+    lua_createtable(L, (int)n, 0);
+    for (int64_t i = 0; i < n; i++) {
+        qelup_pusharrowvalue(L, c, i);
+        lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    return 1;
+}
+
+/* Pointer to the first value of a fixed-width column, for LuaJIT FFI */
+static int arrowcol_ptr(lua_State *L) {
+    qelup_ArrowCol *c = qelup_checkarrowcol(L, 1);
+    if (c->width == 0 || c->kind == QELUP_ARROW_STRING) {
+        return luaL_error(L, "column has no fixed-width values");
+    }
+    lua_pushlightuserdata(L, (char*)c->array->buffers[1] + (c->array->offset + c->offset) * c->width);
+    return 1;
+}
+
+/* col[i] reads row i; other keys are properties and methods */
+static int arrowcol_index(lua_State *L) {
+    qelup_ArrowCol *c = qelup_checkarrowcol(L, 1);
+    
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        lua_Integer i = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, i >= 1 && i <= (lua_Integer)c->length, 2, "index out of range");
+        qelup_pusharrowvalue(L, c, (int64_t)i - 1);
+        return 1;
+    }
+    
+    const char *key = luaL_checkstring(L, 2);
+    if (strcmp(key, "totable") == 0) {
+        lua_pushcfunction(L, arrowcol_totable);
+    } else if (strcmp(key, "ptr") == 0) {
+        lua_pushcfunction(L, arrowcol_ptr);
+    } else if (strcmp(key, "name") == 0) {
+        lua_pushstring(L, c->schema->name != NULL ? c->schema->name : "");
+    } else if (strcmp(key, "type") == 0) {
+        lua_pushstring(L, c->schema->format);
+    } else if (strcmp(key, "nulls") == 0) {
+        lua_pushinteger(L, (lua_Integer)qelup_arrownulls(c));
+    } else if (strcmp(key, "length") == 0) {
+        lua_pushinteger(L, (lua_Integer)c->length);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int arrowcol_len(lua_State *L) {
+    qelup_ArrowCol *c = qelup_checkarrowcol(L, 1);
+    lua_pushinteger(L, (lua_Integer)c->length);
+    return 1;
+}
+
+/*
+    Export. A qelup.ArrowBatch Python object owns column buffers built from
+    Lua arrays; every __arrow_c_array__ call hands out fresh structs that
+    point into those buffers and keep the batch alive until released.
+*/
+
+typedef struct {
+    char *name;
+    const char *format;     /* "l", "g", "u", "U" or "b" */
+    int64_t null_count;
+    uint8_t *validity;      /* NULL when there are no nulls */
+    void *offsets;          /* strings only */
+    void *data;
+} qelup_ArrowField;
+
+typedef struct {
+    PyObject_HEAD
+    int64_t length;
+    int64_t ncols;
+    qelup_ArrowField *fields;
+} qelup_ArrowBatch;
+
+/* Private data of an exported array: the batch it points into */
+typedef struct {
+    PyObject *owner;
+    const void *buffers[3];
+} qelup_ArrowPrivate;
+
+static void arrowbatch_dealloc(qelup_ArrowBatch *self) {
+    for (int64_t k = 0; k < self->ncols; k++) {
+        free(self->fields[k].name);
+        free(self->fields[k].validity);
+        free(self->fields[k].offsets);
+        free(self->fields[k].data);
+    }
+    free(self->fields);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/* Consumers may release from any thread */
+static void qelup_arrow_dropowner(PyObject *owner) {
+    if (Py_IsInitialized()) {
+        PyGILState_STATE state = PyGILState_Ensure();
+        Py_DECREF(owner);
+        PyGILState_Release(state);
+    }
+}
+
+static void qelup_schema_release_child(struct ArrowSchema *schema) {
+    free(schema->private_data);
+    schema->release = NULL;
+}
+
+static void qelup_schema_release(struct ArrowSchema *schema) {
+    for (int64_t k = 0; k < schema->n_children; k++) {
+        struct ArrowSchema *child = schema->children[k];
+        if (child->release != NULL) {
+            child->release(child);
+        }
+    }
+    if (schema->n_children > 0) {
+        free(schema->children[0]);
+    }
+    free(schema->children);
+    schema->release = NULL;
+}
+
+static void qelup_array_release_child(struct ArrowArray *array) {
+    qelup_ArrowPrivate *priv = (qelup_ArrowPrivate*)array->private_data;
+    qelup_arrow_dropowner(priv->owner);
+    free(priv);
+    array->release = NULL;
+}
+
+static void qelup_array_release(struct ArrowArray *array) {
+    for (int64_t k = 0; k < array->n_children; k++) {
+        struct ArrowArray *child = array->children[k];
+        if (child->release != NULL) {
+            child->release(child);
+        }
+    }
+    if (array->n_children > 0) {
+        free(array->children[0]);
+    }
+    free(array->children);
+    qelup_array_release_child(array);
+}
+
+/* Fill `out` with a "+s" schema for the batch; child names are copied */
+static int qelup_exportschema(qelup_ArrowBatch *batch, struct ArrowSchema *out) {
+    int64_t n = batch->ncols;
+    struct ArrowSchema **children = (struct ArrowSchema**)calloc((size_t)(n > 0 ? n : 1), sizeof(*children));
+    struct ArrowSchema *kids = (struct ArrowSchema*)calloc((size_t)(n > 0 ? n : 1), sizeof(*kids));
+    if (children == NULL || kids == NULL) {
+        free(children);
+        free(kids);
+        PyErr_NoMemory();
+        return -1;
+    }
+    
+    memset(out, 0, sizeof(*out));
+    out->format = "+s";
+    out->name = "";
+    out->n_children = n;
+    out->children = children;
+    out->release = qelup_schema_release;
+    
+    for (int64_t k = 0; k < n; k++) {
+        size_t len = strlen(batch->fields[k].name);
+        char *name = (char*)malloc(len + 1);
+        children[k] = &kids[k];
+        if (name == NULL) {
+            /* Children so far release with the parent */
+            out->n_children = k;
+            qelup_schema_release(out);
+            PyErr_NoMemory();
+            return -1;
+        }
+        memcpy(name, batch->fields[k].name, len + 1);
+        kids[k].format = batch->fields[k].format;
+        kids[k].name = name;
+        kids[k].flags = ARROW_FLAG_NULLABLE;
+        kids[k].release = qelup_schema_release_child;
+        kids[k].private_data = name;
+    }
+    if (n == 0) {
+        free(kids);
+    }
+    return 0;
+}
+
+/* Fill `out` with a struct array whose children point into the batch */
+static int qelup_exportarray(qelup_ArrowBatch *batch, struct ArrowArray *out) {
+    int64_t n = batch->ncols;
+    struct ArrowArray **children = (struct ArrowArray**)calloc((size_t)(n > 0 ? n : 1), sizeof(*children));
+    struct ArrowArray *kids = (struct ArrowArray*)calloc((size_t)(n > 0 ? n : 1), sizeof(*kids));
+    qelup_ArrowPrivate *priv = (qelup_ArrowPrivate*)calloc(1, sizeof(qelup_ArrowPrivate));
+    if (children == NULL || kids == NULL || priv == NULL) {
+        free(children);
+        free(kids);
+        free(priv);
+        PyErr_NoMemory();
+        return -1;
+    }
+    
+    Py_INCREF(batch);
+    priv->owner = (PyObject*)batch;
+    memset(out, 0, sizeof(*out));
+    out->length = batch->length;
+    out->n_buffers = 1;
+    out->buffers = priv->buffers;
+    out->n_children = n;
+    out->children = children;
+    out->release = qelup_array_release;
+    out->private_data = priv;
+    
+    for (int64_t k = 0; k < n; k++) {
+        qelup_ArrowField *field = &batch->fields[k];
+        qelup_ArrowPrivate *cp = (qelup_ArrowPrivate*)calloc(1, sizeof(qelup_ArrowPrivate));
+        children[k] = &kids[k];
+        if (cp == NULL) {
+            out->n_children = k;
+            qelup_array_release(out);
+            PyErr_NoMemory();
+            return -1;
+        }
+        
+        Py_INCREF(batch);
+        cp->owner = (PyObject*)batch;
+        cp->buffers[0] = field->validity;
+        if (field->offsets != NULL) {
+            cp->buffers[1] = field->offsets;
+            cp->buffers[2] = field->data;
+        } else {
+            cp->buffers[1] = field->data;
+        }
+        
+        kids[k].length = batch->length;
+        kids[k].null_count = field->null_count;
+        kids[k].n_buffers = field->offsets != NULL ? 3 : 2;
+        kids[k].buffers = cp->buffers;
+        kids[k].release = qelup_array_release_child;
+        kids[k].private_data = cp;
+    }
+    if (n == 0) {
+        free(kids);
+    }
+    return 0;
+}
+
+static void qelup_schema_capsule_free(PyObject *capsule) {
+    struct ArrowSchema *schema = (struct ArrowSchema*)PyCapsule_GetPointer(capsule, "arrow_schema");
+    if (schema != NULL && schema->release != NULL) {
+        schema->release(schema);
+    }
+    free(schema);
+}
+
+static void qelup_array_capsule_free(PyObject *capsule) {
+    struct ArrowArray *array = (struct ArrowArray*)PyCapsule_GetPointer(capsule, "arrow_array");
+    if (array != NULL && array->release != NULL) {
+        array->release(array);
+    }
+    free(array);
+}
+
+static PyObject* qelup_schema_capsule(qelup_ArrowBatch *self) {
+    struct ArrowSchema *schema = (struct ArrowSchema*)malloc(sizeof(struct ArrowSchema));
+    if (schema == NULL) {
+        return PyErr_NoMemory();
+    }
+    if (qelup_exportschema(self, schema) < 0) {
+        free(schema);
+        return NULL;
+    }
+    PyObject *capsule = PyCapsule_New(schema, "arrow_schema", qelup_schema_capsule_free);
+    if (capsule == NULL) {
+        schema->release(schema);
+        free(schema);
+    }
+    return capsule;
+}
+
+/* __arrow_c_schema__() */
+static PyObject* arrowbatch_c_schema(qelup_ArrowBatch *self, PyObject *unused) {
+    (void)unused;
+    return qelup_schema_capsule(self);
+}
+
+/* __arrow_c_array__(requested_schema=None): the data is only offered as built */
+static PyObject* arrowbatch_c_array(qelup_ArrowBatch *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"requested_schema", NULL};
+    PyObject *requested = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &requested)) {
+        return NULL;
+    }
+    
+    PyObject *schema = qelup_schema_capsule(self);
+    if (schema == NULL) {
+        return NULL;
+    }
+    
+    struct ArrowArray *array = (struct ArrowArray*)malloc(sizeof(struct ArrowArray));
+    if (array == NULL) {
+        Py_DECREF(schema);
+        return PyErr_NoMemory();
+    }
+    if (qelup_exportarray(self, array) < 0) {
+        free(array);
+        Py_DECREF(schema);
+        return NULL;
+    }
+    PyObject *capsule = PyCapsule_New(array, "arrow_array", qelup_array_capsule_free);
+    if (capsule == NULL) {
+        array->release(array);
+        free(array);
+        Py_DECREF(schema);
+        return NULL;
+    }
+    
+    PyObject *pair = PyTuple_Pack(2, schema, capsule);
+    Py_DECREF(schema);
+    Py_DECREF(capsule);
+    return pair;
+}
+
+static Py_ssize_t arrowbatch_length(qelup_ArrowBatch *self) {
+    return (Py_ssize_t)self->length;
+}
+
+static PyObject* arrowbatch_repr(qelup_ArrowBatch *self) {
+    return PyString_FromFormat("<qelup.ArrowBatch %lld rows x %lld columns>",
+                               (long long)self->length, (long long)self->ncols);
+}
+
+static PyMethodDef arrowbatch_methods[] = {
+    {"__arrow_c_schema__", (PyCFunction)arrowbatch_c_schema, METH_NOARGS, "Export the schema as a PyCapsule"},
+    {"__arrow_c_array__", (PyCFunction)(void(*)(void))arrowbatch_c_array, METH_VARARGS | METH_KEYWORDS,
+     "Export (schema, array) PyCapsules"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMappingMethods arrowbatch_as_mapping = {
+    (lenfunc)arrowbatch_length,
+    NULL,
+    NULL
+};
+
+static PyTypeObject qelup_ArrowBatchType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qelup.ArrowBatch",
+    .tp_basicsize = sizeof(qelup_ArrowBatch),
+    .tp_dealloc = (destructor)arrowbatch_dealloc,
+    .tp_repr = (reprfunc)arrowbatch_repr,
+    .tp_as_mapping = &arrowbatch_as_mapping,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Record batch built from Lua arrays, exported through the Arrow PyCapsule interface",
+    .tp_methods = arrowbatch_methods,
+};
+
+/* Set bit i of a bitmap */
+#define QELUP_SETBIT(bits, i) ((bits)[(i) >> 3] |= (uint8_t)(1u << ((i) & 7)))
+
+/* Build one field from the Lua array at index (length rows); -1 with a Python error */
+static int qelup_buildfield(lua_State *L, int index, int64_t length, qelup_ArrowField *field) {
+    int type = LUA_TNIL;
+    int ints = 1;
+    size_t bytes = 0;
+    
+    /* First pass: element type, nulls and string sizes */
+    for (int64_t i = 1; i <= length; i++) {
+        lua_rawgeti(L, index, (lua_Integer)i);
+        int t = lua_type(L, -1);
+        if (t == LUA_TNIL) {
+            field->null_count++;
+        } else if (type != LUA_TNIL && t != type) {
+            lua_pop(L, 1);
+            PyErr_Format(PyExc_TypeError, "column '%s' mixes %s and %s values",
+                         field->name, lua_typename(L, type), lua_typename(L, t));
+            return -1;
+        } else if (t == LUA_TNUMBER || t == LUA_TSTRING || t == LUA_TBOOLEAN) {
+            type = t;
+            #if LUA_VERSION_NUM >= 503
+            if (t == LUA_TNUMBER && !lua_isinteger(L, -1)) {
+                ints = 0;
+            }
+            #else
+            if (t == LUA_TNUMBER) {
+                lua_Number d = lua_tonumber(L, -1);
+                if (!(d >= -9.2e18 && d <= 9.2e18 && d == (lua_Number)(int64_t)d)) {
+                    ints = 0;
+                }
+            }
+            #endif
+            if (t == LUA_TSTRING) {
+                bytes += (size_t)qelup_rawlen(L, -1);
+            }
+        } else {
+            lua_pop(L, 1);
+            PyErr_Format(PyExc_TypeError, "column '%s' has unsupported %s values",
+                         field->name, lua_typename(L, t));
+            return -1;
+        }
+        lua_pop(L, 1);
+    }
+    
+    size_t rows = (size_t)(length > 0 ? length : 1);
+    if (field->null_count > 0) {
+        field->validity = (uint8_t*)calloc((rows + 7) / 8, 1);
+        if (field->validity == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    
+    if (type == LUA_TSTRING) {
+        int large = bytes > (size_t)INT32_MAX;
+        field->format = large ? "U" : "u";
+        field->offsets = calloc(rows + 1, large ? sizeof(int64_t) : sizeof(int32_t));
+        field->data = malloc(bytes > 0 ? bytes : 1);
+    } else if (type == LUA_TBOOLEAN) {
+        field->format = "b";
+        field->data = calloc((rows + 7) / 8, 1);
+    } else if (type == LUA_TNUMBER && ints) {
+        field->format = "l";
+        field->data = calloc(rows, sizeof(int64_t));
+    } else {
+        /* Numbers, or a column of nothing but nils */
+        field->format = "g";
+        field->data = calloc(rows, sizeof(double));
+    }
+    if (field->data == NULL || (type == LUA_TSTRING && field->offsets == NULL)) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    
+    /* Second pass: fill the buffers */
+    int64_t pos = 0;
+    for (int64_t i = 0; i < length; i++) {
+        lua_rawgeti(L, index, (lua_Integer)i + 1);
+        if (!lua_isnil(L, -1)) {
+            if (field->validity != NULL) {
+                QELUP_SETBIT(field->validity, i);
+            }
+            if (type == LUA_TSTRING) {
+                size_t len;
+                const char *str = lua_tolstring(L, -1, &len);
+                memcpy((char*)field->data + pos, str, len);
+                pos += (int64_t)len;
+            } else if (type == LUA_TBOOLEAN) {
+                if (lua_toboolean(L, -1)) {
+                    QELUP_SETBIT((uint8_t*)field->data, i);
+                }
+            } else if (ints) {
+                #if LUA_VERSION_NUM >= 503
+                ((int64_t*)field->data)[i] = (int64_t)lua_tointeger(L, -1);
+                #else
+                ((int64_t*)field->data)[i] = (int64_t)lua_tonumber(L, -1);
+                #endif
+            } else {
+                ((double*)field->data)[i] = (double)lua_tonumber(L, -1);
+            }
+        }
+        lua_pop(L, 1);
+        
+        if (type == LUA_TSTRING) {
+            if (field->format[0] == 'U') {
+                ((int64_t*)field->offsets)[i + 1] = pos;
+            } else {
+                ((int32_t*)field->offsets)[i + 1] = (int32_t)pos;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Build an exportable batch: core.toarrow(columns, names) */
+static int qelup_toarrow(lua_State *L) {
+    check_initialized(L);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    
+    int64_t ncols = (int64_t)qelup_rawlen(L, 2);
+    int64_t length = 0;
+    
+    /* Check arguments before taking the GIL: Lua errors must not hold it */
+    for (int64_t k = 1; k <= ncols; k++) {
+        lua_rawgeti(L, 2, (lua_Integer)k);
+        if (lua_type(L, -1) != LUA_TSTRING) {
+            return luaL_error(L, "column name %d is not a string", (int)k);
+        }
+        lua_rawget(L, 1);
+        if (!lua_istable(L, -1)) {
+            return luaL_error(L, "column %d is not a table", (int)k);
+        }
+        int64_t n = (int64_t)qelup_rawlen(L, -1);
+        if (n > length) {
+            length = n;
+        }
+        lua_pop(L, 1);
+    }
+    
+    QELUP_GIL_ACQUIRE();
+    if (PyType_Ready(&qelup_ArrowBatchType) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    qelup_ArrowBatch *batch = PyObject_New(qelup_ArrowBatch, &qelup_ArrowBatchType);
+    if (batch == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    batch->length = length;
+    batch->ncols = 0;
+    batch->fields = (qelup_ArrowField*)calloc((size_t)(ncols > 0 ? ncols : 1), sizeof(qelup_ArrowField));
+    if (batch->fields == NULL) {
+        Py_DECREF(batch);
+        PyErr_NoMemory();
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    for (int64_t k = 0; k < ncols; k++) {
+        qelup_ArrowField *field = &batch->fields[k];
+        size_t len;
+        
+        /* Count it first so dealloc frees partial buffers */
+        batch->ncols++;
+        lua_rawgeti(L, 2, (lua_Integer)k + 1);
+        const char *name = lua_tolstring(L, -1, &len);
+        field->name = (char*)malloc(len + 1);
+        if (field->name == NULL) {
+            lua_pop(L, 1);
+            Py_DECREF(batch);
+            PyErr_NoMemory();
+            return handle_python_exception(L, qelup_gil);
+        }
+        memcpy(field->name, name, len + 1);
+        
+        lua_rawget(L, 1);
+        int rc = qelup_buildfield(L, lua_gettop(L), length, field);
+        lua_pop(L, 1);
+        if (rc < 0) {
+            Py_DECREF(batch);
+            return handle_python_exception(L, qelup_gil);
+        }
+    }
+    
+    qelup_newpyobject(L, (PyObject*)batch);
+    Py_DECREF(batch);
+    QELUP_GIL_RELEASE();
+    return 1;
+}
+
+/* ========================================================================== */
+/* Value Codec */
+/* ========================================================================== */
+
+/*
+    Compact tagged encoding of the values python_to_lua handles, for worker
+    processes and subinterpreters that cannot share objects with Lua:
+    N nil, T/F booleans, i int64, d double, s string, l list and m map
+    (little-endian, u32 lengths and counts).
+*/
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} qelup_Bytes;
+
+/* Make room for extra bytes; -1 when out of memory */
+static int qelup_bytesgrow(qelup_Bytes *b, size_t extra) {
+    if (b->len + extra > b->cap) {
+        size_t cap = b->cap > 0 ? b->cap : 256;
+        while (cap < b->len + extra) {
+            cap *= 2;
+        }
+        char *buf = (char*)realloc(b->buf, cap);
+        if (buf == NULL) {
+            return -1;
+        }
+        b->buf = buf;
+        b->cap = cap;
+    }
+    return 0;
+}
+
+static void qelup_bytesreserve(lua_State *L, qelup_Bytes *b, size_t extra) {
+    if (qelup_bytesgrow(b, extra) < 0) {
+        luaL_error(L, "out of memory encoding value");
+    }
+}
+
+static void qelup_bytesput(lua_State *L, qelup_Bytes *b, const void *data, size_t n) {
+    qelup_bytesreserve(L, b, n);
+    memcpy(b->buf + b->len, data, n);
+    b->len += n;
+}
+
+static void qelup_bytesint(lua_State *L, qelup_Bytes *b, char tag, uint64_t v, int bytes) {
+    unsigned char out[9];
+    int n = 0;
+    if (tag != 0) {
+        out[n++] = (unsigned char)tag;
+    }
+    for (int i = 0; i < bytes; i++) {
+        out[n++] = (unsigned char)(v >> (8 * i));
+    }
+    qelup_bytesput(L, b, out, (size_t)n);
+}
+
+static uint64_t qelup_readint(const unsigned char *s, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v |= (uint64_t)s[i] << (8 * i);
+    }
+    return v;
+}
+
+static void qelup_encodestring(lua_State *L, qelup_Bytes *b, const char *s, size_t len) {
+    if (len > UINT32_MAX) {
+        luaL_error(L, "string too large to send");
+    }
+    qelup_bytesint(L, b, 's', (uint64_t)len, 4);
+    qelup_bytesput(L, b, s, len);
+}
+
+/* Append the Lua value at `index` to the buffer */
+static void qelup_encode(lua_State *L, qelup_Bytes *b, int index, int depth) {
+    index = qelup_absindex(L, index);
+    
+    switch (lua_type(L, index)) {
+        case LUA_TNIL:
+            qelup_bytesput(L, b, "N", 1);
+            break;
+        
+        case LUA_TBOOLEAN:
+            qelup_bytesput(L, b, lua_toboolean(L, index) ? "T" : "F", 1);
+            break;
+        
+        case LUA_TNUMBER: {
+            #if LUA_VERSION_NUM >= 503
+            if (lua_isinteger(L, index)) {
+                qelup_bytesint(L, b, 'i', (uint64_t)(int64_t)lua_tointeger(L, index), 8);
+                break;
+            }
+            #endif
+            double d = (double)lua_tonumber(L, index);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            qelup_bytesint(L, b, 'd', bits, 8);
+            break;
+        }
+        
+        case LUA_TSTRING: {
+            size_t len;
+            const char *s = lua_tolstring(L, index, &len);
+            qelup_encodestring(L, b, s, len);
+            break;
+        }
+        
+        case LUA_TTABLE: {
+            if (depth >= qelup_config.maxdepth) {
+                luaL_error(L, "table nested too deeply to send");
+            }
+            luaL_checkstack(L, 3, "value nested too deeply");
+            
+            /* Sequences go as lists, anything else as a map */
+            lua_Integer n = (lua_Integer)qelup_rawlen(L, index);
+            lua_Integer count = 0;
+            int list = 1;
+            lua_pushnil(L);
+            while (lua_next(L, index) != 0) {
+                lua_pop(L, 1);
+                count++;
+                if (list && !qelup_isarraykey(L, n)) {
+                    list = 0;
+                }
+            }
+            
+            if (list) {
+                qelup_bytesint(L, b, 'l', (uint64_t)n, 4);
+                for (lua_Integer i = 1; i <= n; i++) {
+                    lua_rawgeti(L, index, i);
+                    qelup_encode(L, b, -1, depth + 1);
+                    lua_pop(L, 1);
+                }
+            } else {
+                qelup_bytesint(L, b, 'm', (uint64_t)count, 4);
+                lua_pushnil(L);
+                while (lua_next(L, index) != 0) {
+                    qelup_encode(L, b, -2, depth + 1);
+                    qelup_encode(L, b, -1, depth + 1);
+                    lua_pop(L, 1);
+                }
+            }
+            break;
+        }
+        
+        default:
+            luaL_error(L, "cannot send a %s value", luaL_typename(L, index));
+    }
+}
+
+/* Push the value at *pos in the buffer; 0 if it is malformed */
+static int qelup_decode(lua_State *L, qelup_Bytes *b, size_t *pos, int depth) {
+    const unsigned char *s = (const unsigned char*)b->buf;
+    size_t end = b->len;
+    if (*pos >= end || depth > qelup_config.maxdepth) {
+        return 0;
+    }
+    luaL_checkstack(L, 3, "value nested too deeply");
+    
+    char tag = (char)s[(*pos)++];
+    switch (tag) {
+        case 'N': lua_pushnil(L); return 1;
+        case 'T': lua_pushboolean(L, 1); return 1;
+        case 'F': lua_pushboolean(L, 0); return 1;
+        
+        case 'i':
+        case 'd': {
+            if (end - *pos < 8) {
+                return 0;
+            }
+            uint64_t bits = qelup_readint(s + *pos, 8);
+            *pos += 8;
+            if (tag == 'i') {
+                lua_pushinteger(L, (lua_Integer)(int64_t)bits);
+            } else {
+                double d;
+                memcpy(&d, &bits, sizeof(d));
+                lua_pushnumber(L, (lua_Number)d);
+            }
+            return 1;
+        }
+        
+        case 's':
+        case 'l':
+        case 'm': {
+            if (end - *pos < 4) {
+                return 0;
+            }
+            size_t n = (size_t)qelup_readint(s + *pos, 4);
+            *pos += 4;
+            
+            if (tag == 's') {
+                if (end - *pos < n) {
+                    return 0;
+                }
+                lua_pushlstring(L, (const char*)s + *pos, n);
+                *pos += n;
+                return 1;
+            }
+            
+            /* Every element takes at least one byte */
+            if (end - *pos < n) {
+                return 0;
+            }
+            if (tag == 'l') {
+                lua_createtable(L, (int)n, 0);
+                for (size_t i = 1; i <= n; i++) {
+                    if (!qelup_decode(L, b, pos, depth + 1)) {
+                        return 0;
+                    }
+                    lua_rawseti(L, -2, (lua_Integer)i);
+                }
+            } else {
+                lua_createtable(L, 0, (int)n);
+                for (size_t i = 0; i < n; i++) {
+                    if (!qelup_decode(L, b, pos, depth + 1) || !qelup_decode(L, b, pos, depth + 1)) {
+                        return 0;
+                    }
+                    if (lua_isnil(L, -2)) {
+                        lua_pop(L, 2);
+                    } else {
+                        lua_rawset(L, -3);
+                    }
+                }
+            }
+            return 1;
+        }
+        
+        default:
+            return 0;
+    }
+}
+
+/* ========================================================================== */
+/* Worker Pool */
+/* ========================================================================== */
+
+/*
+    core.workers(n) starts n Python processes so CPU-bound calls run on
+    every core instead of sharing one GIL. Each worker talks over a socket
+    pair using the value codec above. A frame is a u32 length and an
+    opcode: I import, X exec, C call; the reply is O value or E message.
+*/
+
+#ifndef _WIN32
+
+#ifndef QELUP_PYTHON
+#define QELUP_PYTHON "python3"
+#endif
+
+#define QELUP_WORKERS_MAX 1024
+
+typedef struct {
+    pid_t pid;
+    int fd;                 /* -1 once closed */
+    int pending;            /* requests sent whose reply is unread */
+} qelup_Worker;
+
+typedef struct {
+    int n;
+    int next;               /* round-robin cursor for single calls */
+    qelup_Bytes frame;      /* frame being encoded or decoded */
+    qelup_Worker w[1];
+} qelup_Pool;
+
+/* Run by each worker with `python -c`: decode, dispatch, encode, repeat */
+static const char qelup_worker_script[] =
+    "import sys, struct, importlib, types\n"
+    "def serve():\n"
+    "    PY2 = sys.version_info[0] < 3\n"
+    "    rd = getattr(sys.stdin, 'buffer', sys.stdin)\n"
+    "    wr = getattr(sys.stdout, 'buffer', sys.stdout)\n"
+    "    sys.stdin = open(sys.platform == 'win32' and 'NUL' or '/dev/null')\n"
+    "    sys.stdout = sys.stderr\n"
+    "    text = PY2 and unicode or str\n"
+    "    ints = PY2 and (int, long) or (int,)\n"
+    "    main = types.ModuleType('__main__')\n"
+    "    sys.modules['__main__'] = main\n"
+    "    mods = {'__main__': main}\n"
+    "    def dec(b, i):\n"
+    "        t = b[i:i+1]\n"
+    "        i += 1\n"
+    "        if t == b'N': return None, i\n"
+    "        if t == b'T': return True, i\n"
+    "        if t == b'F': return False, i\n"
+    "        if t == b'i': return struct.unpack_from('<q', b, i)[0], i + 8\n"
+    "        if t == b'd': return struct.unpack_from('<d', b, i)[0], i + 8\n"
+    "        n = struct.unpack_from('<I', b, i)[0]\n"
+    "        i += 4\n"
+    "        if t == b's':\n"
+    "            s = b[i:i+n]\n"
+    "            return (s if PY2 else s.decode('utf-8', 'surrogateescape')), i + n\n"
+    "        if t == b'l':\n"
+    "            out = []\n"
+    "            for _ in range(n):\n"
+    "                v, i = dec(b, i)\n"
+    "                out.append(v)\n"
+    "            return out, i\n"
+    "        out = {}\n"
+    "        for _ in range(n):\n"
+    "            k, i = dec(b, i)\n"
+    "            out[k], i = dec(b, i)\n"
+    "        return out, i\n"
+    "    def enc(v, out):\n"
+    "        if v is None: out.append(b'N')\n"
+    "        elif v is True: out.append(b'T')\n"
+    "        elif v is False: out.append(b'F')\n"
+    "        elif isinstance(v, ints) and -2**63 <= v < 2**63: out.append(b'i' + struct.pack('<q', v))\n"
+    "        elif isinstance(v, float) or isinstance(v, ints): out.append(b'd' + struct.pack('<d', float(v)))\n"
+    "        elif isinstance(v, (bytes, bytearray, text)):\n"
+    "            if isinstance(v, text): v = v.encode('utf-8', PY2 and 'strict' or 'surrogateescape')\n"
+    "            out.append(b's' + struct.pack('<I', len(v)))\n"
+    "            out.append(bytes(v))\n"
+    "        elif isinstance(v, (list, tuple)):\n"
+    "            out.append(b'l' + struct.pack('<I', len(v)))\n"
+    "            for x in v: enc(x, out)\n"
+    "        elif isinstance(v, dict):\n"
+    "            out.append(b'm' + struct.pack('<I', len(v)))\n"
+    "            for k in v:\n"
+    "                enc(k, out)\n"
+    "                enc(v[k], out)\n"
+    "        elif hasattr(v, 'tolist'): enc(v.tolist(), out)\n"
+    "        else: raise TypeError('cannot send %s back to Lua' % type(v).__name__)\n"
+    "    while True:\n"
+    "        head = rd.read(4)\n"
+    "        if len(head) < 4: break\n"
+    "        n = struct.unpack('<I', head)[0]\n"
+    "        b = rd.read(n)\n"
+    "        if len(b) < n: break\n"
+    "        op = b[0:1]\n"
+    "        try:\n"
+    "            res = None\n"
+    "            if op == b'I':\n"
+    "                name = dec(b, 1)[0]\n"
+    "                mods[name] = importlib.import_module(name)\n"
+    "            elif op == b'X':\n"
+    "                exec(dec(b, 1)[0], main.__dict__)\n"
+    "            else:\n"
+    "                name, i = dec(b, 1)\n"
+    "                attr, i = dec(b, i)\n"
+    "                args = dec(b, i)[0]\n"
+    "                f = mods.get(name) or importlib.import_module(name)\n"
+    "                for part in attr.split('.'): f = getattr(f, part)\n"
+    "                res = f(*args)\n"
+    "            out = [b'O']\n"
+    "            enc(res, out)\n"
+    "        except Exception as e:\n"
+    "            out = [b'E']\n"
+    "            enc('%s: %s' % (type(e).__name__, e), out)\n"
+    "        data = b''.join(out)\n"
+    "        wr.write(struct.pack('<I', len(data)) + data)\n"
+    "        wr.flush()\n"
+    "serve()\n";
+
+/* Start a frame: reserve the length prefix and write the opcode */
+static void qelup_poolbegin(lua_State *L, qelup_Pool *p, char op) {
+    p->frame.len = 0;
+    qelup_bytesint(L, &p->frame, 0, 0, 4);
+    qelup_bytesput(L, &p->frame, &op, 1);
+}
+
+static int qelup_poolsend(qelup_Pool *p, int k) {
+    size_t body = p->frame.len - 4;
+    for (int i = 0; i < 4; i++) {
+        p->frame.buf[i] = (char)(body >> (8 * i));
+    }
+    
+    size_t done = 0;
+    while (done < p->frame.len) {
+        #ifdef MSG_NOSIGNAL
+        ssize_t n = send(p->w[k].fd, p->frame.buf + done, p->frame.len - done, MSG_NOSIGNAL);
+        #else
+        ssize_t n = write(p->w[k].fd, p->frame.buf + done, p->frame.len - done);
+        #endif
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    p->w[k].pending++;
+    return 0;
+}
+
+static int qelup_readall(int fd, char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/* Read one reply frame from worker k into the pool buffer */
+static int qelup_poolrecv(lua_State *L, qelup_Pool *p, int k) {
+    unsigned char head[4];
+    if (qelup_readall(p->w[k].fd, (char*)head, 4) < 0) {
+        return -1;
+    }
+    p->w[k].pending--;
+    p->frame.len = 0;
+    size_t n = (size_t)qelup_readint(head, 4);
+    qelup_bytesreserve(L, &p->frame, n > 0 ? n : 1);
+    if (qelup_readall(p->w[k].fd, p->frame.buf, n) < 0) {
+        return -1;
+    }
+    p->frame.len = n;
+    return 0;
+}
+
+/* Push the result of the reply in the buffer, or its error message; 1 on success */
+static int qelup_poolresult(lua_State *L, qelup_Pool *p) {
+    size_t pos = 1;
+    if (p->frame.len < 1 || !qelup_decode(L, &p->frame, &pos, 0)) {
+        lua_pushliteral(L, "malformed reply from worker");
+        return 0;
+    }
+    return p->frame.buf[0] == 'O';
+}
+
+/* A Lua error in the middle of map() can leave replies unread; skip them */
+static qelup_Pool* qelup_checkpool(lua_State *L, int index) {
+    qelup_Pool *p = (qelup_Pool*)luaL_checkudata(L, index, QELUP_WORKERS_MT);
+    if (p->n == 0) {
+        luaL_error(L, "worker pool has been closed");
+    }
+    for (int k = 0; k < p->n; k++) {
+        while (p->w[k].pending > 0) {
+            if (qelup_poolrecv(L, p, k) < 0) {
+                luaL_error(L, "worker %d exited unexpectedly", k + 1);
+            }
+        }
+    }
+    return p;
+}
+
+/* Send the frame in the buffer to worker k and push its result, raising on errors */
+static int qelup_poolrequest(lua_State *L, qelup_Pool *p, int k) {
+    if (qelup_poolsend(p, k) < 0 || qelup_poolrecv(L, p, k) < 0) {
+        return luaL_error(L, "worker %d exited unexpectedly", k + 1);
+    }
+    if (!qelup_poolresult(L, p)) {
+        return lua_error(L);
+    }
+    return 1;
+}
+
+static int workers_close(lua_State *L) {
+    qelup_Pool *p = (qelup_Pool*)luaL_checkudata(L, 1, QELUP_WORKERS_MT);
+    
+    /* Workers exit when their socket reaches end of file */
+    for (int k = 0; k < p->n; k++) {
+        if (p->w[k].fd >= 0) {
+            close(p->w[k].fd);
+            p->w[k].fd = -1;
+        }
+    }
+    for (int k = 0; k < p->n; k++) {
+        if (p->w[k].pid > 0) {
+            while (waitpid(p->w[k].pid, NULL, 0) < 0 && errno == EINTR) {
+            }
+            p->w[k].pid = 0;
+        }
+    }
+    p->n = 0;
+    free(p->frame.buf);
+    p->frame.buf = NULL;
+    p->frame.len = p->frame.cap = 0;
+    return 0;
+}
+
+/* Start a pool: core.workers(n, python) */
+static int qelup_workers(lua_State *L) {
+    int n = (int)luaL_checkinteger(L, 1);
+    const char *python = luaL_optstring(L, 2, QELUP_PYTHON);
+    luaL_argcheck(L, n >= 1 && n <= QELUP_WORKERS_MAX, 1, "worker count out of range");
+    
+    qelup_Pool *p = (qelup_Pool*)lua_newuserdata(L, sizeof(qelup_Pool) + (size_t)(n - 1) * sizeof(qelup_Worker));
+    p->n = 0;
+    p->next = 0;
+    p->frame.buf = NULL;
+    p->frame.len = p->frame.cap = 0;
+    luaL_getmetatable(L, QELUP_WORKERS_MT);
+    lua_setmetatable(L, -2);
+    
+    for (int k = 0; k < n; k++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            return luaL_error(L, "cannot create worker socket: %s", strerror(errno));
+        }
+        /* Our end must not leak into later workers */
+        fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+        #ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(sv[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+        #endif
+        
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(sv[0]);
+            close(sv[1]);
+            return luaL_error(L, "cannot start worker: %s", strerror(errno));
+        }
+        if (pid == 0) {
+            /* Child: the socket becomes stdin and stdout, stderr is shared */
+            dup2(sv[1], 0);
+            dup2(sv[1], 1);
+            if (sv[1] > 1) {
+                close(sv[1]);
+            }
+            execlp(python, python, "-c", qelup_worker_script, (char*)NULL);
+            _exit(127);
+        }
+        
+        close(sv[1]);
+        p->w[k].pid = pid;
+        p->w[k].fd = sv[0];
+        p->w[k].pending = 0;
+        p->n = k + 1;
+    }
+    return 1;
+}
+
+/* pool:import(module) imports a module in every worker */
+static int workers_import(lua_State *L) {
+    qelup_Pool *p = qelup_checkpool(L, 1);
+    size_t len;
+    const char *name = luaL_checklstring(L, 2, &len);
+    
+    for (int k = 0; k < p->n; k++) {
+        qelup_poolbegin(L, p, 'I');
+        qelup_encodestring(L, &p->frame, name, len);
+        qelup_poolrequest(L, p, k);
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+/* pool:exec(code) runs source in the __main__ module of every worker */
+static int workers_exec(lua_State *L) {
+    qelup_Pool *p = qelup_checkpool(L, 1);
+    size_t len;
+    const char *code = luaL_checklstring(L, 2, &len);
+    
+    for (int k = 0; k < p->n; k++) {
+        qelup_poolbegin(L, p, 'X');
+        qelup_encodestring(L, &p->frame, code, len);
+        qelup_poolrequest(L, p, k);
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+/* Encode a call of module.attr with the arguments at stack [first, last] */
+static void qelup_encodecall(lua_State *L, qelup_Pool *p, int first, int last) {
+    qelup_poolbegin(L, p, 'C');
+    qelup_encode(L, &p->frame, 2, 0);
+    qelup_encode(L, &p->frame, 3, 0);
+    qelup_bytesint(L, &p->frame, 'l', (uint64_t)(last >= first ? last - first + 1 : 0), 4);
+    for (int i = first; i <= last; i++) {
+        qelup_encode(L, &p->frame, i, 0);
+    }
+}
+
+/* pool:call(module, attr, ...) runs one call on the next worker */
+static int workers_call(lua_State *L) {
+    qelup_Pool *p = qelup_checkpool(L, 1);
+    luaL_checkstring(L, 2);
+    luaL_checkstring(L, 3);
+    
+    int k = p->next;
+    p->next = (p->next + 1) % p->n;
+    qelup_encodecall(L, p, 4, lua_gettop(L));
+    return qelup_poolrequest(L, p, k);
+}
+
+/*
+    pool:map(module, attr, items) calls module.attr(item) for every item,
+    keeping each worker busy with one request at a time, and returns the
+    results in order. A worker only gets a new request after its reply is
+    read, so neither side can block on a full socket.
+*/
+static int workers_map(lua_State *L) {
+    qelup_Pool *p = qelup_checkpool(L, 1);
+    luaL_checkstring(L, 2);
+    luaL_checkstring(L, 3);
+    luaL_checktype(L, 4, LUA_TTABLE);
+    lua_settop(L, 4);
+    
+    lua_Integer total = (lua_Integer)qelup_rawlen(L, 4);
+    lua_createtable(L, (int)total, 0);
+    int results = lua_gettop(L);
+    
+    lua_Integer inflight[QELUP_WORKERS_MAX];
+    struct pollfd fds[QELUP_WORKERS_MAX];
+    lua_Integer next = 1;
+    int busy = 0;
+    int failed = 0;     /* stack index of the first error message */
+    
+    for (int k = 0; k < p->n; k++) {
+        inflight[k] = 0;
+        if (next <= total) {
+            lua_rawgeti(L, 4, next);
+            qelup_encodecall(L, p, lua_gettop(L), lua_gettop(L));
+            lua_pop(L, 1);
+            if (qelup_poolsend(p, k) < 0) {
+                return luaL_error(L, "worker %d exited unexpectedly", k + 1);
+            }
+            inflight[k] = next++;
+            busy++;
+        }
+    }
+    
+    while (busy > 0) {
+        int m = 0;
+        for (int k = 0; k < p->n; k++) {
+            fds[k].fd = inflight[k] != 0 ? p->w[k].fd : -1;
+            fds[k].events = POLLIN;
+            fds[k].revents = 0;
+            m = k + 1;
+        }
+        if (poll(fds, (nfds_t)m, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return luaL_error(L, "poll failed: %s", strerror(errno));
+        }
+        
+        for (int k = 0; k < m; k++) {
+            if (fds[k].revents == 0 || inflight[k] == 0) {
+                continue;
+            }
+            if (qelup_poolrecv(L, p, k) < 0) {
+                return luaL_error(L, "worker %d exited unexpectedly", k + 1);
+            }
+            busy--;
+            
+            if (qelup_poolresult(L, p)) {
+                lua_rawseti(L, results, inflight[k]);
+            } else if (!failed) {
+                failed = lua_gettop(L);
+            } else {
+                lua_pop(L, 1);
+            }
+            inflight[k] = 0;
+            
+            /* After an error, only drain what is already in flight */
+            if (!failed && next <= total) {
+                lua_rawgeti(L, 4, next);
+                qelup_encodecall(L, p, lua_gettop(L), lua_gettop(L));
+                lua_pop(L, 1);
+                if (qelup_poolsend(p, k) < 0) {
+                    return luaL_error(L, "worker %d exited unexpectedly", k + 1);
+                }
+                inflight[k] = next++;
+                busy++;
+            }
+        }
+    }
+    
+    if (failed) {
+        lua_pushvalue(L, failed);
+        return lua_error(L);
+    }
+    lua_pushvalue(L, results);
+    return 1;
+}
+
+static int workers_index(lua_State *L) {
+    luaL_checkudata(L, 1, QELUP_WORKERS_MT);
+    const char *key = luaL_checkstring(L, 2);
+    static const luaL_Reg methods[] = {
+        {"import", workers_import},
+        {"exec", workers_exec},
+        {"call", workers_call},
+        {"map", workers_map},
+        {"close", workers_close},
+        {NULL, NULL}
+    };
+    
+    for (const luaL_Reg *m = methods; m->name != NULL; m++) {
+        if (strcmp(key, m->name) == 0) {
+            lua_pushcfunction(L, m->func);
+            return 1;
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int workers_len(lua_State *L) {
+    qelup_Pool *p = (qelup_Pool*)luaL_checkudata(L, 1, QELUP_WORKERS_MT);
+    lua_pushinteger(L, p->n);
+    return 1;
+}
+
+static int workers_tostring(lua_State *L) {
+    qelup_Pool *p = (qelup_Pool*)luaL_checkudata(L, 1, QELUP_WORKERS_MT);
+    lua_pushfstring(L, "qelup.workers: %d processes", p->n);
+    return 1;
+}
+
+#else
+
+static int qelup_workers(lua_State *L) {
+    return luaL_error(L, "worker pools need fork() and are not available on Windows");
+}
+
+#endif /* _WIN32 */
+
+/* ========================================================================== */
+/* Subinterpreter Pool */
+/* ========================================================================== */
+
+/*
+    core.pool(n) runs Python code on n subinterpreters, each with its own
+    GIL (Python 3.12+) and pinned to its own thread, so CPU-bound work runs
+    in parallel inside one process. Requests go through a shared queue as
+    value-codec bytes, since objects cannot cross interpreters; map()
+    queues every item at once and any idle interpreter takes the next.
+    Elsewhere the pool falls back to one private namespace in the main
+    interpreter with the same API, running requests in turn.
+*/
+
+#if !defined(_WIN32) && PY_VERSION_HEX >= 0x030C0000
+#define QELUP_SUBINTERPRETERS
+#endif
+
+#define QELUP_POOL_MAX 256
+
+enum { QELUP_JOB_NEW, QELUP_JOB_QUEUED, QELUP_JOB_DONE };
+
+typedef struct qelup_Job {
+    struct qelup_Job *next;     /* queue link */
+    struct qelup_Job *batch;    /* jobs of the current Lua request */
+    int target;                 /* interpreter index, or -1 for any */
+    int state;                  /* QELUP_JOB_* */
+    qelup_Bytes in;             /* opcode (X exec, E eval, C call), then arguments */
+    qelup_Bytes out;            /* O value or E message */
+} qelup_Job;
+
+typedef struct qelup_InterpPool qelup_InterpPool;
+
+typedef struct {
+    qelup_InterpPool *pool;
+    int index;
+    #ifdef QELUP_SUBINTERPRETERS
+    pthread_t thread;
+    #endif
+} qelup_InterpSlot;
+
+struct qelup_InterpPool {
+    int n;                      /* 0 once closed */
+    int generation;
+    qelup_Job *batch;           /* allocated by the running (or an aborted) request */
+    #ifdef QELUP_SUBINTERPRETERS
+    qelup_InterpPool *next_pool;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* jobs queued, or closing */
+    pthread_cond_t done;        /* a job finished, or a worker started */
+    qelup_Job *head, *tail;     /* FIFO of queued jobs */
+    int closing;
+    int started;
+    int failed;
+    char error[256];
+    #else
+    PyObject *globals;          /* namespace in the main interpreter */
+    #endif
+    qelup_InterpSlot slots[1];
+};
+
+/* Grow without raising, for code that runs outside Lua */
+static int qelup_pyput(qelup_Bytes *b, const void *data, size_t n) {
+    if (qelup_bytesgrow(b, n) < 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(b->buf + b->len, data, n);
+    b->len += n;
+    return 0;
+}
+
+static int qelup_pyputint(qelup_Bytes *b, char tag, uint64_t v, int bytes) {
+    unsigned char out[9];
+    int n = 0;
+    out[n++] = (unsigned char)tag;
+    for (int i = 0; i < bytes; i++) {
+        out[n++] = (unsigned char)(v >> (8 * i));
+    }
+    return qelup_pyput(b, out, (size_t)n);
+}
+
+/* Encode a Python value with the value codec; -1 with an exception set */
+static int qelup_pyencode(PyObject *obj, qelup_Bytes *b, int depth) {
+    if (depth > qelup_config.maxdepth) {
+        PyErr_SetString(PyExc_ValueError, "value nested too deeply to return");
+        return -1;
+    }
+    
+    if (obj == Py_None) {
+        return qelup_pyput(b, "N", 1);
+    }
+    if (PyBool_Check(obj)) {
+        return qelup_pyput(b, obj == Py_True ? "T" : "F", 1);
+    }
+    if (PyLong_Check(obj) || PyInt_Check(obj)) {
+        int overflow = 0;
+        long long v = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow == 0) {
+            if (v == -1 && PyErr_Occurred()) {
+                return -1;
+            }
+            return qelup_pyputint(b, 'i', (uint64_t)(int64_t)v, 8);
+        }
+    }
+    if (PyFloat_Check(obj) || PyLong_Check(obj) || PyInt_Check(obj)) {
+        double d = PyFloat_AsDouble(obj);
+        if (d == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return qelup_pyputint(b, 'd', bits, 8);
+    }
+    
+    const char *data = NULL;
+    Py_ssize_t len = 0;
+    if (PyString_Check(obj)) {
+        data = qelup_pystring(obj, &len);
+        if (data == NULL) {
+            return -1;
+        }
+    }
+    #ifdef QELUP_PY3
+    else if (PyBytes_Check(obj)) {
+        data = PyBytes_AS_STRING(obj);
+        len = PyBytes_GET_SIZE(obj);
+    }
+    #endif
+    else if (PyByteArray_Check(obj)) {
+        data = PyByteArray_AS_STRING(obj);
+        len = PyByteArray_GET_SIZE(obj);
+    }
+    if (data != NULL) {
+        if ((uint64_t)len > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "string too large to return");
+            return -1;
+        }
+        return qelup_pyputint(b, 's', (uint64_t)len, 4) < 0 ? -1 : qelup_pyput(b, data, (size_t)len);
+    }
+    
+    if (PyList_Check(obj) || PyTuple_Check(obj)) {
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(obj);
+        if (qelup_pyputint(b, 'l', (uint64_t)n, 4) < 0) {
+            return -1;
+        }
+        for (Py_ssize_t i = 0; i < n; i++) {
+            if (qelup_pyencode(PySequence_Fast_GET_ITEM(obj, i), b, depth + 1) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    
+    if (PyDict_Check(obj)) {
+        PyObject *key, *value;
+        Py_ssize_t pos = 0;
+        if (qelup_pyputint(b, 'm', (uint64_t)PyDict_Size(obj), 4) < 0) {
+            return -1;
+        }
+        while (PyDict_Next(obj, &pos, &key, &value)) {
+            if (qelup_pyencode(key, b, depth + 1) < 0 || qelup_pyencode(value, b, depth + 1) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    
+    /* NumPy arrays and scalars */
+    if (PyObject_HasAttrString(obj, "tolist")) {
+        PyObject *plain = PyObject_CallMethod(obj, "tolist", NULL);
+        if (plain == NULL) {
+            return -1;
+        }
+        int rc = qelup_pyencode(plain, b, depth + 1);
+        Py_DECREF(plain);
+        return rc;
+    }
+    
+    PyErr_Format(PyExc_TypeError, "cannot return a %s to Lua", Py_TYPE(obj)->tp_name);
+    return -1;
+}
+
+/* Decode a value-codec value into a new Python object */
+static PyObject* qelup_pydecode(const char *buf, size_t end, size_t *pos, int depth) {
+    const unsigned char *s = (const unsigned char*)buf;
+    if (*pos >= end || depth > qelup_config.maxdepth) {
+        PyErr_SetString(PyExc_ValueError, "malformed request");
+        return NULL;
+    }
+    
+    char tag = (char)s[(*pos)++];
+    switch (tag) {
+        case 'N': Py_RETURN_NONE;
+        case 'T': Py_RETURN_TRUE;
+        case 'F': Py_RETURN_FALSE;
+        
+        case 'i':
+        case 'd': {
+            if (end - *pos < 8) {
+                break;
+            }
+            uint64_t bits = qelup_readint(s + *pos, 8);
+            *pos += 8;
+            if (tag == 'i') {
+                return PyLong_FromLongLong((long long)(int64_t)bits);
+            }
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return PyFloat_FromDouble(d);
+        }
+        
+        case 's':
+        case 'l':
+        case 'm': {
+            if (end - *pos < 4) {
+                break;
+            }
+            size_t n = (size_t)qelup_readint(s + *pos, 4);
+            *pos += 4;
+            if (end - *pos < n) {
+                break;
+            }
+            
+            if (tag == 's') {
+                *pos += n;
+                return qelup_fromluastring(buf + *pos - n, n, 0);
+            }
+            
+            PyObject *obj = tag == 'l' ? PyList_New((Py_ssize_t)n) : PyDict_New();
+            for (size_t i = 0; obj != NULL && i < n; i++) {
+                PyObject *first = qelup_pydecode(buf, end, pos, depth + 1);
+                if (first == NULL) {
+                    Py_CLEAR(obj);
+                } else if (tag == 'l') {
+                    PyList_SET_ITEM(obj, (Py_ssize_t)i, first);
+                } else {
+                    PyObject *value = qelup_pydecode(buf, end, pos, depth + 1);
+                    if (value == NULL || PyDict_SetItem(obj, first, value) < 0) {
+                        Py_CLEAR(obj);
+                    }
+                    Py_XDECREF(value);
+                    Py_DECREF(first);
+                }
+            }
+            return obj;
+        }
+        
+        default:
+            break;
+    }
+    PyErr_SetString(PyExc_ValueError, "malformed request");
+    return NULL;
+}
+
+/* Look up a dotted name: globals, then builtins, then an importable module */
+static PyObject* qelup_resolve(PyObject *globals, PyObject *name) {
+    Py_ssize_t len;
+    const char *path = qelup_pystring(name, &len);
+    if (path == NULL) {
+        return NULL;
+    }
+    
+    const char *dot = memchr(path, '.', (size_t)len);
+    Py_ssize_t first = dot != NULL ? (Py_ssize_t)(dot - path) : len;
+    PyObject *key = PyString_FromStringAndSize(path, first);
+    if (key == NULL) {
+        return NULL;
+    }
+    
+    PyObject *obj = PyDict_GetItem(globals, key);
+    if (obj == NULL) {
+        obj = PyDict_GetItem(PyEval_GetBuiltins(), key);
+    }
+    if (obj != NULL) {
+        Py_INCREF(obj);
+    } else {
+        obj = PyImport_Import(key);
+    }
+    Py_DECREF(key);
+    
+    while (obj != NULL && dot != NULL) {
+        const char *part = dot + 1;
+        dot = memchr(part, '.', (size_t)(path + len - part));
+        Py_ssize_t n = dot != NULL ? (Py_ssize_t)(dot - part) : (Py_ssize_t)(path + len - part);
+        PyObject *attr = PyString_FromStringAndSize(part, n);
+        PyObject *next = attr != NULL ? PyObject_GetAttr(obj, attr) : NULL;
+        Py_XDECREF(attr);
+        Py_DECREF(obj);
+        obj = next;
+    }
+    return obj;
+}
+
+/* Run one request against a namespace (that interpreter's GIL held) */
+static void qelup_runjob(PyObject *globals, qelup_Job *job) {
+    size_t pos = 1;
+    PyObject *result = NULL;
+    PyObject *first = job->in.len > 0 ? qelup_pydecode(job->in.buf, job->in.len, &pos, 0) : NULL;
+    
+    if (first != NULL) {
+        char op = job->in.buf[0];
+        if (op == 'C') {
+            PyObject *args = qelup_pydecode(job->in.buf, job->in.len, &pos, 0);
+            PyObject *tuple = args != NULL ? PySequence_Tuple(args) : NULL;
+            PyObject *fn = tuple != NULL ? qelup_resolve(globals, first) : NULL;
+            result = fn != NULL ? PyObject_CallObject(fn, tuple) : NULL;
+            Py_XDECREF(fn);
+            Py_XDECREF(tuple);
+            Py_XDECREF(args);
+        } else {
+            const char *code = qelup_pystring(first, NULL);
+            if (code != NULL) {
+                result = PyRun_String(code, op == 'E' ? Py_eval_input : Py_file_input, globals, globals);
+            }
+            if (result != NULL && op == 'X') {
+                Py_DECREF(result);
+                Py_INCREF(Py_None);
+                result = Py_None;
+            }
+        }
+        Py_DECREF(first);
+    }
+    
+    job->out.len = 0;
+    if (result != NULL && qelup_pyput(&job->out, "O", 1) == 0 && qelup_pyencode(result, &job->out, 0) == 0) {
+        Py_DECREF(result);
+        return;
+    }
+    Py_XDECREF(result);
+    
+    /* Report the exception as "Type: message" */
+    PyObject *ptype, *pvalue, *ptraceback;
+    PyErr_Fetch(&ptype, &pvalue, &ptraceback);
     PyErr_NormalizeException(&ptype, &pvalue, &ptraceback);
+    PyObject *msg = pvalue != NULL ? PyObject_Str(pvalue) : NULL;
+    const char *text = msg != NULL ? qelup_pystring(msg, NULL) : NULL;
+    const char *type = ptype != NULL ? ((PyTypeObject*)ptype)->tp_name : "Error";
+    
+    char line[512];
+    snprintf(line, sizeof(line), "%s: %s", type, text != NULL ? text : "unknown error");
+    job->out.len = 0;
+    if (qelup_pyput(&job->out, "E", 1) < 0 || qelup_pyputint(&job->out, 's', strlen(line), 4) < 0
+        || qelup_pyput(&job->out, line, strlen(line)) < 0) {
+        job->out.len = 0;
+    }
+    Py_XDECREF(msg);
+    Py_XDECREF(ptype);
+    Py_XDECREF(pvalue);
+    Py_XDECREF(ptraceback);
+    PyErr_Clear();
+}
+
+/* Allocate a job on the pool's batch list; opcode written, arguments follow */
+static qelup_Job* qelup_newjob(lua_State *L, qelup_InterpPool *p, char op, int target) {
+    qelup_Job *job = (qelup_Job*)calloc(1, sizeof(qelup_Job));
+    if (job == NULL) {
+        luaL_error(L, "out of memory");
+    }
+    job->target = target;
+    job->batch = p->batch;
+    p->batch = job;
+    qelup_bytesput(L, &job->in, &op, 1);
+    return job;
+}
+
+#ifdef QELUP_SUBINTERPRETERS
+
+/* Open pools, closed before the interpreter is finalized */
+static qelup_InterpPool *qelup_pools = NULL;
+static pthread_mutex_t qelup_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Blocking waits drop the main GIL when this thread holds it (a Lua callback) */
+#define QELUP_UNBLOCK_BEGIN() PyThreadState *qelup_unblock = qelup_current_L != NULL ? PyEval_SaveThread() : NULL
+#define QELUP_UNBLOCK_END() do { if (qelup_unblock != NULL) PyEval_RestoreThread(qelup_unblock); } while (0)
+
+/* Next queued job this interpreter may run (pool locked) */
+static qelup_Job* qelup_takejob(qelup_InterpPool *p, int index) {
+    qelup_Job *prev = NULL;
+    for (qelup_Job *job = p->head; job != NULL; prev = job, job = job->next) {
+        if (job->target < 0 || job->target == index) {
+            if (prev != NULL) {
+                prev->next = job->next;
+            } else {
+                p->head = job->next;
+            }
+            if (p->tail == job) {
+                p->tail = prev;
+            }
+            job->next = NULL;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+/* Worker thread: create an interpreter with its own GIL and serve the queue */
+static void* qelup_interp_main(void *arg) {
+    qelup_InterpSlot *slot = (qelup_InterpSlot*)arg;
+    qelup_InterpPool *p = slot->pool;
     
-    const char *error_msg = "Unknown Python error";
+    /* A thread state of the main interpreter is needed to create one */
+    PyThreadState *main_ts = PyThreadState_New(PyInterpreterState_Main());
+    PyEval_RestoreThread(main_ts);
     
-    if (pvalue != NULL) {
-        PyObject *str = PyObject_Str(pvalue);
-        if (str != NULL) {
-            error_msg = PyString_AsString(str);
-            lua_pushstring(L, error_msg);
-            Py_DECREF(str);
+    PyInterpreterConfig config = {
+        .use_main_obmalloc = 0,
+        .allow_fork = 0,
+        .allow_exec = 0,
+        .allow_threads = 1,
+        .allow_daemon_threads = 0,
+        .check_multi_interp_extensions = 1,
+        .gil = PyInterpreterConfig_OWN_GIL,
+    };
+    PyThreadState *ts = NULL;
+    PyStatus status = Py_NewInterpreterFromConfig(&ts, &config);
+    
+    if (PyStatus_Exception(status)) {
+        /* The main thread state is current again */
+        PyThreadState_Clear(main_ts);
+        PyThreadState_DeleteCurrent();
+        pthread_mutex_lock(&p->lock);
+        p->failed++;
+        snprintf(p->error, sizeof(p->error), "cannot create subinterpreter: %s",
+                 status.err_msg != NULL ? status.err_msg : "unknown error");
+        pthread_cond_broadcast(&p->done);
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+    
+    /* The new interpreter's GIL is held; the main GIL was released */
+    PyObject *globals = PyModule_GetDict(PyImport_AddModule("__main__"));
+    
+    pthread_mutex_lock(&p->lock);
+    p->started++;
+    pthread_cond_broadcast(&p->done);
+    pthread_mutex_unlock(&p->lock);
+    
+    for (;;) {
+        qelup_Job *job = NULL;
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&p->lock);
+        while (!p->closing && (job = qelup_takejob(p, slot->index)) == NULL) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+        Py_END_ALLOW_THREADS
+        
+        if (job == NULL) {
+            break;
         }
+        qelup_runjob(globals, job);
+        
+        pthread_mutex_lock(&p->lock);
+        job->state = QELUP_JOB_DONE;
+        pthread_cond_broadcast(&p->done);
+        pthread_mutex_unlock(&p->lock);
     }
     
-    Py_XDECREF(ptype);
-    Py_XDECREF(pvalue);
-    Py_XDECREF(ptraceback);
+    Py_EndInterpreter(ts);
+    PyEval_RestoreThread(main_ts);
+    PyThreadState_Clear(main_ts);
+    PyThreadState_DeleteCurrent();
+    return NULL;
+}
+
+/* Queue the jobs of the batch that are not queued yet */
+static void qelup_submit(qelup_InterpPool *p) {
+    /* The batch list is newest first; queue oldest first */
+    qelup_Job *fresh = NULL;
+    for (qelup_Job *job = p->batch; job != NULL && job->state == QELUP_JOB_NEW; job = job->batch) {
+        job->state = QELUP_JOB_QUEUED;
+        job->next = fresh;
+        fresh = job;
+    }
+    if (fresh == NULL) {
+        return;
+    }
     
-    return lua_error(L);
+    pthread_mutex_lock(&p->lock);
+    if (p->tail != NULL) {
+        p->tail->next = fresh;
+    } else {
+        p->head = fresh;
+    }
+    while (fresh->next != NULL) {
+        fresh = fresh->next;
+    }
+    p->tail = fresh;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void qelup_waitjob(qelup_InterpPool *p, qelup_Job *job) {
+    QELUP_UNBLOCK_BEGIN();
+    pthread_mutex_lock(&p->lock);
+    while (job->state != QELUP_JOB_DONE && !p->closing) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    QELUP_UNBLOCK_END();
+}
+
+#else
+
+static void qelup_submit(qelup_InterpPool *p) {
+    (void)p;
+}
+
+/* Single-interpreter fallback: run the job now in the main interpreter */
+static void qelup_waitjob(qelup_InterpPool *p, qelup_Job *job) {
+    if (job->state == QELUP_JOB_DONE) {
+        return;
+    }
+    PyGILState_STATE state = PyGILState_Ensure();
+    qelup_runjob(p->globals, job);
+    PyGILState_Release(state);
+    job->state = QELUP_JOB_DONE;
+}
+
+#endif /* QELUP_SUBINTERPRETERS */
+
+/* Wait for and free every job of the batch, e.g. one left by a Lua error */
+static void qelup_reapjobs(qelup_InterpPool *p) {
+    while (p->batch != NULL) {
+        qelup_Job *job = p->batch;
+        p->batch = job->batch;
+        if (job->state == QELUP_JOB_QUEUED) {
+            qelup_waitjob(p, job);
+        }
+        free(job->in.buf);
+        free(job->out.buf);
+        free(job);
+    }
+}
+
+static void qelup_closepool(qelup_InterpPool *p) {
+    if (p->n == 0) {
+        return;
+    }
+    
+    #ifdef QELUP_SUBINTERPRETERS
+    pthread_mutex_lock(&qelup_pools_lock);
+    for (qelup_InterpPool **link = &qelup_pools; *link != NULL; link = &(*link)->next_pool) {
+        if (*link == p) {
+            *link = p->next_pool;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qelup_pools_lock);
+    
+    /* Let running jobs finish; queued ones are dropped */
+    pthread_mutex_lock(&p->lock);
+    p->closing = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_cond_broadcast(&p->done);
+    pthread_mutex_unlock(&p->lock);
+    
+    QELUP_UNBLOCK_BEGIN();
+    for (int k = 0; k < p->n; k++) {
+        pthread_join(p->slots[k].thread, NULL);
+    }
+    QELUP_UNBLOCK_END();
+    
+    for (qelup_Job *job = p->batch; job != NULL; job = job->batch) {
+        job->state = QELUP_JOB_DONE;
+    }
+    qelup_reapjobs(p);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    pthread_mutex_destroy(&p->lock);
+    #else
+    for (qelup_Job *job = p->batch; job != NULL; job = job->batch) {
+        job->state = QELUP_JOB_DONE;
+    }
+    qelup_reapjobs(p);
+    if (p->globals != NULL && Py_IsInitialized() && p->generation == qelup_generation) {
+        PyGILState_STATE state = PyGILState_Ensure();
+        Py_CLEAR(p->globals);
+        PyGILState_Release(state);
+    }
+    p->globals = NULL;
+    #endif
+    p->n = 0;
+}
+
+/* Close every open pool; their interpreters must end before Py_Finalize */
+static void qelup_closepools(void) {
+    #ifdef QELUP_SUBINTERPRETERS
+    for (;;) {
+        pthread_mutex_lock(&qelup_pools_lock);
+        qelup_InterpPool *p = qelup_pools;
+        pthread_mutex_unlock(&qelup_pools_lock);
+        if (p == NULL) {
+            break;
+        }
+        qelup_closepool(p);
+    }
+    #endif
+}
+
+/* Start a pool: core.pool(n) */
+static int qelup_pool(lua_State *L) {
+    check_initialized(L);
+    int n = (int)luaL_optinteger(L, 1, 1);
+    luaL_argcheck(L, n >= 1 && n <= QELUP_POOL_MAX, 1, "interpreter count out of range");
+    
+    #ifndef QELUP_SUBINTERPRETERS
+    n = 1;
+    #endif
+    
+    qelup_InterpPool *p = (qelup_InterpPool*)lua_newuserdata(L, sizeof(qelup_InterpPool) + (size_t)(n - 1) * sizeof(qelup_InterpSlot));
+    memset(p, 0, sizeof(qelup_InterpPool));
+    p->generation = qelup_generation;
+    luaL_getmetatable(L, QELUP_INTERPPOOL_MT);
+    lua_setmetatable(L, -2);
+    
+    #ifdef QELUP_SUBINTERPRETERS
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    
+    int spawned = 0;
+    for (int k = 0; k < n; k++) {
+        p->slots[k].pool = p;
+        p->slots[k].index = k;
+        if (pthread_create(&p->slots[k].thread, NULL, qelup_interp_main, &p->slots[k]) != 0) {
+            break;
+        }
+        spawned++;
+    }
+    p->n = spawned;
+    
+    pthread_mutex_lock(&qelup_pools_lock);
+    p->next_pool = qelup_pools;
+    qelup_pools = p;
+    pthread_mutex_unlock(&qelup_pools_lock);
+    
+    /* Workers need the main GIL to create their interpreters */
+    QELUP_UNBLOCK_BEGIN();
+    pthread_mutex_lock(&p->lock);
+    while (p->started + p->failed < spawned) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    QELUP_UNBLOCK_END();
+    
+    if (spawned < n || p->failed > 0) {
+        char error[256];
+        snprintf(error, sizeof(error), "%s", p->failed > 0 ? p->error : "cannot start interpreter thread");
+        qelup_closepool(p);
+        return luaL_error(L, "%s", error);
+    }
+    #else
+    QELUP_GIL_ACQUIRE();
+    p->globals = PyDict_New();
+    if (p->globals == NULL || PyDict_SetItemString(p->globals, "__builtins__", PyEval_GetBuiltins()) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    p->n = 1;
+    #endif
+    return 1;
+}
+
+static qelup_InterpPool* qelup_checkinterppool(lua_State *L, int index) {
+    qelup_InterpPool *p = (qelup_InterpPool*)luaL_checkudata(L, index, QELUP_INTERPPOOL_MT);
+    if (p->n == 0 || p->generation != qelup_generation) {
+        luaL_error(L, "interpreter pool has been closed");
+    }
+    qelup_reapjobs(p);
+    return p;
+}
+
+/* Push the result of a finished job, or raise its error */
+static void qelup_pushjob(lua_State *L, qelup_Job *job) {
+    size_t pos = 1;
+    if (job->state != QELUP_JOB_DONE || job->out.len < 1) {
+        luaL_error(L, "interpreter pool closed before the request ran");
+    }
+    if (!qelup_decode(L, &job->out, &pos, 0)) {
+        luaL_error(L, "malformed reply from interpreter");
+    }
+    if (job->out.buf[0] != 'O') {
+        lua_error(L);
+    }
+}
+
+/* Queue the batch, wait for each job in order and push its result */
+static int qelup_runbatch(lua_State *L, qelup_InterpPool *p, int results) {
+    qelup_submit(p);
+    
+    /* Newest first on the batch list; collect oldest first */
+    int count = 0;
+    for (qelup_Job *job = p->batch; job != NULL; job = job->batch) {
+        count++;
+    }
+    qelup_Job **order = (qelup_Job**)malloc((size_t)(count > 0 ? count : 1) * sizeof(qelup_Job*));
+    if (order == NULL) {
+        return luaL_error(L, "out of memory");
+    }
+    int i = count;
+    for (qelup_Job *job = p->batch; job != NULL; job = job->batch) {
+        order[--i] = job;
+    }
+    
+    for (i = 0; i < count; i++) {
+        qelup_waitjob(p, order[i]);
+    }
+    
+    /* Results are decoded after every job finished, so a Lua error here
+       cannot leave work running */
+    qelup_Job *failed = NULL;
+    for (i = 0; i < count && failed == NULL; i++) {
+        if (order[i]->out.len < 1 || order[i]->out.buf[0] != 'O') {
+            failed = order[i];
+        }
+    }
+    if (failed != NULL) {
+        free(order);
+        qelup_pushjob(L, failed);
+    }
+    
+    if (results != 0) {
+        for (i = 0; i < count; i++) {
+            size_t pos = 1;
+            if (!qelup_decode(L, &order[i]->out, &pos, 0)) {
+                free(order);
+                return luaL_error(L, "malformed reply from interpreter");
+            }
+            lua_rawseti(L, results, (lua_Integer)i + 1);
+        }
+    } else if (count > 0) {
+        qelup_Job *last = order[count - 1];
+        free(order);
+        qelup_pushjob(L, last);
+        qelup_reapjobs(p);
+        return 1;
+    }
+    free(order);
+    qelup_reapjobs(p);
+    return results != 0 ? 1 : 0;
+}
+
+/* pool:exec(code) runs source in the __main__ of every interpreter */
+static int interppool_exec(lua_State *L) {
+    qelup_InterpPool *p = qelup_checkinterppool(L, 1);
+    luaL_checkstring(L, 2);
+    
+    for (int k = 0; k < p->n; k++) {
+        qelup_Job *job = qelup_newjob(L, p, 'X', k);
+        qelup_encode(L, &job->in, 2, 0);
+    }
+    qelup_runbatch(L, p, 0);
+    return 0;
+}
+
+/* pool:eval(expr) evaluates on the first free interpreter */
+static int interppool_eval(lua_State *L) {
+    qelup_InterpPool *p = qelup_checkinterppool(L, 1);
+    luaL_checkstring(L, 2);
+    
+    qelup_Job *job = qelup_newjob(L, p, 'E', -1);
+    qelup_encode(L, &job->in, 2, 0);
+    return qelup_runbatch(L, p, 0);
+}
+
+/* Encode name and the arguments at stack [first, last] into a call job */
+static void qelup_encodejobcall(lua_State *L, qelup_Job *job, int first, int last) {
+    qelup_encode(L, &job->in, 2, 0);
+    qelup_bytesint(L, &job->in, 'l', (uint64_t)(last >= first ? last - first + 1 : 0), 4);
+    for (int i = first; i <= last; i++) {
+        qelup_encode(L, &job->in, i, 0);
+    }
+}
+
+/* pool:call(name, ...) calls a global, builtin or module function by dotted name */
+static int interppool_call(lua_State *L) {
+    qelup_InterpPool *p = qelup_checkinterppool(L, 1);
+    luaL_checkstring(L, 2);
+    
+    qelup_Job *job = qelup_newjob(L, p, 'C', -1);
+    qelup_encodejobcall(L, job, 3, lua_gettop(L));
+    return qelup_runbatch(L, p, 0);
+}
+
+/* pool:map(name, items) calls name(item) for every item across the interpreters */
+static int interppool_map(lua_State *L) {
+    qelup_InterpPool *p = qelup_checkinterppool(L, 1);
+    luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_settop(L, 3);
+    
+    lua_Integer total = (lua_Integer)qelup_rawlen(L, 3);
+    for (lua_Integer i = 1; i <= total; i++) {
+        qelup_Job *job = qelup_newjob(L, p, 'C', -1);
+        lua_rawgeti(L, 3, i);
+        qelup_encodejobcall(L, job, 4, 4);
+        lua_pop(L, 1);
+    }
+    
+    lua_createtable(L, (int)total, 0);
+    return qelup_runbatch(L, p, lua_gettop(L));
+}
+
+static int interppool_close(lua_State *L) {
+    qelup_InterpPool *p = (qelup_InterpPool*)luaL_checkudata(L, 1, QELUP_INTERPPOOL_MT);
+    qelup_closepool(p);
+    return 0;
+}
+
+static int interppool_index(lua_State *L) {
+    qelup_InterpPool *p = (qelup_InterpPool*)luaL_checkudata(L, 1, QELUP_INTERPPOOL_MT);
+    const char *key = luaL_checkstring(L, 2);
+    static const luaL_Reg methods[] = {
+        {"exec", interppool_exec},
+        {"eval", interppool_eval},
+        {"call", interppool_call},
+        {"map", interppool_map},
+        {"close", interppool_close},
+        {NULL, NULL}
+    };
+    
+    for (const luaL_Reg *m = methods; m->name != NULL; m++) {
+        if (strcmp(key, m->name) == 0) {
+            lua_pushcfunction(L, m->func);
+            return 1;
+        }
+    }
+    if (strcmp(key, "isolated") == 0) {
+        #ifdef QELUP_SUBINTERPRETERS
+        lua_pushboolean(L, p->n > 0);
+        #else
+        (void)p;
+        lua_pushboolean(L, 0);
+        #endif
+        return 1;
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int interppool_len(lua_State *L) {
+    qelup_InterpPool *p = (qelup_InterpPool*)luaL_checkudata(L, 1, QELUP_INTERPPOOL_MT);
+    lua_pushinteger(L, p->n);
+    return 1;
+}
+
+static int interppool_tostring(lua_State *L) {
+    qelup_InterpPool *p = (qelup_InterpPool*)luaL_checkudata(L, 1, QELUP_INTERPPOOL_MT);
+    #ifdef QELUP_SUBINTERPRETERS
+    lua_pushfstring(L, "qelup.pool: %d subinterpreters", p->n);
+    #else
+    lua_pushfstring(L, "qelup.pool: %d shared interpreter", p->n);
+    #endif
+    return 1;
 }
 
 /* ========================================================================== */
-/* Core Functions */
+/* Asyncio Futures */
 /* ========================================================================== */
 
-/* Initialize Python interpreter */
-static int qelup_initialize(lua_State *L) {
-    if (Py_IsInitialized()) {
-        lua_pushboolean(L, 1);
+/*
+    Coroutines run on one bridge-owned asyncio loop in a background thread.
+    Calling an async function from Lua submits the coroutine there and
+    returns a qelup.future wrapping the concurrent.futures.Future, so many
+    awaitables can be in flight while Lua keeps running; qelup.lua lets Lua
+    coroutines yield on these futures. Waits release the GIL, which the
+    loop thread needs to make progress.
+*/
+
+#if defined(QELUP_PY3) && PY_VERSION_HEX >= 0x03070000
+#define QELUP_ASYNCIO
+#endif
+
+typedef struct {
+    PyObject *future;           /* concurrent.futures.Future */
+    int generation;
+} qelup_Future;
+
+#ifdef QELUP_ASYNCIO
+
+/* Namespace of the loop helpers, created on first use */
+static PyObject *qelup_asyncio = NULL;
+
+static const char qelup_asyncio_script[] =
+    "import asyncio, concurrent.futures, threading\n"
+    "loop = asyncio.new_event_loop()\n"
+    "def _run():\n"
+    "    asyncio.set_event_loop(loop)\n"
+    "    loop.run_forever()\n"
+    "thread = threading.Thread(target=_run, name='qelup-asyncio')\n"
+    "thread.daemon = True\n"
+    "thread.start()\n"
+    "async def _await(aw):\n"
+    "    return await aw\n"
+    "def submit(aw):\n"
+    "    if not asyncio.iscoroutine(aw):\n"
+    "        aw = _await(aw)\n"
+    "    return asyncio.run_coroutine_threadsafe(aw, loop)\n"
+    "def wait(fs, timeout):\n"
+    "    done, _ = concurrent.futures.wait(fs, timeout, concurrent.futures.FIRST_COMPLETED)\n"
+    "    return len(done)\n"
+    "def shutdown():\n"
+    "    async def cancel():\n"
+    "        tasks = [t for t in asyncio.all_tasks() if t is not asyncio.current_task()]\n"
+    "        for t in tasks:\n"
+    "            t.cancel()\n"
+    "        await asyncio.gather(*tasks, return_exceptions=True)\n"
+    "    try:\n"
+    "        asyncio.run_coroutine_threadsafe(cancel(), loop).result(5)\n"
+    "    except Exception:\n"
+    "        pass\n"
+    "    loop.call_soon_threadsafe(loop.stop)\n"
+    "    thread.join(5)\n"
+    "    if not thread.is_alive():\n"
+    "        loop.close()\n";
+
+/* Call a loop helper, starting the loop on first use (GIL held) */
+static PyObject* qelup_asynccall(const char *name, PyObject *args) {
+    if (qelup_asyncio == NULL) {
+        PyObject *globals = PyDict_New();
+        if (globals == NULL || PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins()) < 0) {
+            Py_XDECREF(globals);
+            return NULL;
+        }
+        PyObject *result = PyRun_String(qelup_asyncio_script, Py_file_input, globals, globals);
+        if (result == NULL) {
+            Py_DECREF(globals);
+            return NULL;
+        }
+        Py_DECREF(result);
+        qelup_asyncio = globals;
+    }
+    
+    PyObject *fn = PyDict_GetItemString(qelup_asyncio, name);
+    return fn != NULL ? PyObject_CallObject(fn, args) : NULL;
+}
+
+/* Stop the loop and its thread before the interpreter goes away (GIL held) */
+static void qelup_stopasync(void) {
+    if (qelup_asyncio != NULL) {
+        PyObject *result = qelup_asynccall("shutdown", NULL);
+        if (result == NULL) {
+            PyErr_Clear();
+        }
+        Py_XDECREF(result);
+        Py_CLEAR(qelup_asyncio);
+    }
+}
+
+/* Submit an awaitable to the loop and push a qelup.future (GIL held) */
+static int qelup_pushfuture(lua_State *L, PyObject *awaitable) {
+    PyObject *args = PyTuple_Pack(1, awaitable);
+    PyObject *future = args != NULL ? qelup_asynccall("submit", args) : NULL;
+    Py_XDECREF(args);
+    if (future == NULL) {
+        return -1;
+    }
+    
+    qelup_Future *f = (qelup_Future*)lua_newuserdata(L, sizeof(qelup_Future));
+    f->future = future;
+    f->generation = qelup_generation;
+    luaL_getmetatable(L, QELUP_FUTURE_MT);
+    lua_setmetatable(L, -2);
+    return 0;
+}
+
+/* Native coroutines returned by calls go to the loop when config.async is on */
+static int qelup_iscoroutine(PyObject *obj) {
+    return qelup_config.async && PyCoro_CheckExact(obj);
+}
+
+#else
+
+static void qelup_stopasync(void) {
+}
+
+static int qelup_pushfuture(lua_State *L, PyObject *awaitable) {
+    (void)L;
+    (void)awaitable;
+    PyErr_SetString(PyExc_RuntimeError, "asyncio support requires Python 3.7 or newer");
+    return -1;
+}
+
+static int qelup_iscoroutine(PyObject *obj) {
+    (void)obj;
+    return 0;
+}
+
+#endif /* QELUP_ASYNCIO */
+
+/* Run an awaitable on the bridge loop: core.submit(awaitable) */
+static int qelup_submit_awaitable(lua_State *L) {
+    check_initialized(L);
+    PyObject *obj = qelup_checkpyobject(L, 1);
+    
+    QELUP_GIL_ACQUIRE();
+    if (qelup_pushfuture(L, obj) < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    return 1;
+}
+
+static qelup_Future* qelup_checkfuture(lua_State *L, int index) {
+    qelup_Future *f = (qelup_Future*)luaL_checkudata(L, index, QELUP_FUTURE_MT);
+    if (f->future == NULL || f->generation != qelup_generation) {
+        luaL_error(L, "future belongs to a finalized interpreter");
+    }
+    return f;
+}
+
+/* Call a method of the wrapped future and push the converted result */
+static int qelup_futuremethod(lua_State *L, const char *method, int timeout) {
+    qelup_Future *f = qelup_checkfuture(L, 1);
+    
+    int forever = !timeout || lua_isnoneornil(L, 2);
+    double seconds = forever ? 0.0 : (double)luaL_checknumber(L, 2);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *result;
+    if (!forever) {
+        result = PyObject_CallMethod(f->future, method, "d", seconds);
+    } else {
+        result = PyObject_CallMethod(f->future, method, NULL);
+    }
+    if (result == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    int rc = python_to_lua(L, result);
+    Py_DECREF(result);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
+    return 1;
+}
+
+/* future:done() is true once the awaitable finished, failed or was cancelled */
+static int future_done(lua_State *L) {
+    return qelup_futuremethod(L, "done", 0);
+}
+
+/* future:result([timeout]) blocks until done and returns the value or raises */
+static int future_result(lua_State *L) {
+    return qelup_futuremethod(L, "result", 1);
+}
+
+static int future_cancel(lua_State *L) {
+    return qelup_futuremethod(L, "cancel", 0);
+}
+
+/* Block until one of the futures is done: core.wait({f1, f2, ...}, timeout) */
+static int qelup_waitfutures(lua_State *L) {
+    check_initialized(L);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer n = qelup_rawlen(L, 1);
+    int forever = lua_isnoneornil(L, 2);
+    double seconds = forever ? 0.0 : (double)luaL_checknumber(L, 2);
+    
+    QELUP_GIL_ACQUIRE();
+    PyObject *list = PyList_New((Py_ssize_t)n);
+    if (list == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, 1, i);
+        qelup_Future *f = (qelup_Future*)luaL_testudata(L, -1, QELUP_FUTURE_MT);
+        lua_pop(L, 1);
+        if (f == NULL || f->future == NULL || f->generation != qelup_generation) {
+            Py_DECREF(list);
+            QELUP_GIL_RELEASE();
+            return luaL_argerror(L, 1, "expected an array of futures");
+        }
+        Py_INCREF(f->future);
+        PyList_SET_ITEM(list, (Py_ssize_t)(i - 1), f->future);
+    }
+    
+    PyObject *timeout = forever ? (Py_INCREF(Py_None), Py_None) : PyFloat_FromDouble(seconds);
+    PyObject *args = timeout != NULL ? PyTuple_Pack(2, list, timeout) : NULL;
+    Py_DECREF(list);
+    Py_XDECREF(timeout);
+    #ifdef QELUP_ASYNCIO
+    PyObject *result = args != NULL ? qelup_asynccall("wait", args) : NULL;
+    #else
+    PyObject *result = NULL;
+    if (args != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "asyncio support requires Python 3.7 or newer");
+    }
+    #endif
+    Py_XDECREF(args);
+    if (result == NULL) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    
+    lua_pushinteger(L, (lua_Integer)PyLong_AsLong(result));
+    Py_DECREF(result);
+    QELUP_GIL_RELEASE();
+    return 1;
+}
+
+static int future_gc(lua_State *L) {
+    qelup_Future *f = (qelup_Future*)lua_touserdata(L, 1);
+    if (f->future != NULL && Py_IsInitialized() && f->generation == qelup_generation) {
+        qelup_defer_decref(L, f->future);
+    }
+    f->future = NULL;
+    return 0;
+}
+
+static int future_index(lua_State *L) {
+    luaL_checkudata(L, 1, QELUP_FUTURE_MT);
+    const char *key = luaL_checkstring(L, 2);
+    static const luaL_Reg methods[] = {
+        {"done", future_done},
+        {"result", future_result},
+        {"cancel", future_cancel},
+        {NULL, NULL}
+    };
+    
+    for (const luaL_Reg *m = methods; m->name != NULL; m++) {
+        if (strcmp(key, m->name) == 0) {
+            lua_pushcfunction(L, m->func);
+            return 1;
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int future_tostring(lua_State *L) {
+    qelup_Future *f = (qelup_Future*)luaL_checkudata(L, 1, QELUP_FUTURE_MT);
+    lua_pushfstring(L, "qelup.future: %p", (void*)f->future);
+    return 1;
+}
+
+/* ========================================================================== */
+/* Streaming Iterators */
+/* ========================================================================== */
+
+/* Iterator step; upvalue 1 is the state, upvalue 2 the batch buffer */
+static int pyiter_next(lua_State *L) {
+    qelup_Iterator *it = (qelup_Iterator*)lua_touserdata(L, lua_upvalueindex(1));
+    
+    if (it->pos < it->count) {
+        lua_pushinteger(L, ++it->index);
+        lua_rawgeti(L, lua_upvalueindex(2), ++it->pos);
+        return 2;
+    }
+    if ((it->obj != NULL || it->error[0] != NULL) &&
+        (it->generation != qelup_generation || !Py_IsInitialized())) {
+        return luaL_error(L, "iterator belongs to a finalized interpreter");
+    }
+    if (it->obj == NULL) {
+        if (it->error[0] != NULL) {
+            /* Raise the failure that ended the previous batch */
+            QELUP_GIL_ACQUIRE();
+            PyErr_Restore(it->error[0], it->error[1], it->error[2]);
+            it->error[0] = it->error[1] = it->error[2] = NULL;
+            return handle_python_exception(L, qelup_gil);
+        }
+        lua_pushnil(L);
         return 1;
     }
     
-    Py_Initialize();
-    
-    if (!Py_IsInitialized()) {
-        lua_pushboolean(L, 0);
-        lua_pushstring(L, "Failed to initialize Python interpreter");
-        return 2;
+    QELUP_GIL_ACQUIRE();
+    int count = 0;
+    int failed = 0;
+    PyObject *item = NULL;
+    
+    while (count < it->batch && (item = PyIter_Next(it->obj)) != NULL) {
+        int rc = python_to_lua(L, item);
+        Py_DECREF(item);
+        if (rc < 0) {
+            failed = 1;
+            break;
+        }
+        lua_rawseti(L, lua_upvalueindex(2), ++count);
+    }
+    
+    if (item == NULL || failed) {
+        /* Exhausted or failed: drop the Python iterator right away */
+        Py_CLEAR(it->obj);
+        if (PyErr_Occurred()) {
+            if (count == 0) {
+                return handle_python_exception(L, qelup_gil);
+            }
+            /* Hand out what was converted first; the error follows */
+            PyErr_Fetch(&it->error[0], &it->error[1], &it->error[2]);
+        }
+    }
+    QELUP_GIL_RELEASE();
+    
+    it->count = count;
+    it->pos = 0;
+    if (count == 0) {
+        lua_pushnil(L);
+        return 1;
     }
     
-    lua_pushboolean(L, 1);
-    return 1;
+    lua_pushinteger(L, ++it->index);
+    lua_rawgeti(L, lua_upvalueindex(2), ++it->pos);
+    return 2;
 }
 
-/* Finalize Python interpreter */
-static int qelup_finalize(lua_State *L) {
-    if (Py_IsInitialized()) {
-        Py_Finalize();
+static int pyiter_gc(lua_State *L) {
+    qelup_Iterator *it = (qelup_Iterator*)lua_touserdata(L, 1);
+    if (it->error[0] != NULL && Py_IsInitialized() && it->generation == qelup_generation) {
+        QELUP_GIL_ACQUIRE();
+        Py_XDECREF(it->error[0]);
+        Py_XDECREF(it->error[1]);
+        Py_XDECREF(it->error[2]);
+        QELUP_GIL_RELEASE();
     }
-    return 0;
+    it->error[0] = it->error[1] = it->error[2] = NULL;
+    return pyobject_gc(L);
 }
 
-/* Import Python module */
-static int qelup_import(lua_State *L) {
-    check_initialized(L);
-    
-    const char *module_name = luaL_checkstring(L, 1);
-    
-    PyObject *module = PyImport_ImportModule(module_name);
+/* Stream a Python iterable: for i, v in core.iter(obj [, batch]) do ... end */
+static int qelup_iter(lua_State *L) {
+    PyObject *obj = qelup_topyobject(L, 1);
+    if (obj == NULL) {
+        return luaL_argerror(L, 1, "expected Python iterable");
+    }
+    int batch = (int)luaL_optinteger(L, 2, 1);
+    luaL_argcheck(L, batch >= 1, 2, "batch size must be positive");
     
-    if (module == NULL) {
-        return handle_python_exception(L);
+    QELUP_GIL_ACQUIRE();
+    PyObject *iter = PyObject_GetIter(obj);
+    if (iter == NULL) {
+        return handle_python_exception(L, qelup_gil);
     }
+    QELUP_STAT_ADD(wrappers, 1);
+    QELUP_GIL_RELEASE();
     
-    qelup_newpyobject(L, module);
-    Py_DECREF(module);
+    qelup_Iterator *it = (qelup_Iterator*)lua_newuserdata(L, sizeof(qelup_Iterator));
+    it->obj = iter;
+    it->generation = qelup_generation;
+    it->batch = batch;
+    it->pos = 0;
+    it->count = 0;
+    it->index = 0;
+    it->error[0] = it->error[1] = it->error[2] = NULL;
+    luaL_getmetatable(L, QELUP_ITER_MT);
+    lua_setmetatable(L, -2);
     
+    lua_createtable(L, batch, 0);
+    lua_pushcclosure(L, pyiter_next, 2);
     return 1;
 }
 
-/* Execute Python code */
-static int qelup_exec(lua_State *L) {
-    check_initialized(L);
+/* ========================================================================== */
+/* Compiled Code Objects */
+/* ========================================================================== */
+
+/* Compile source once: core.compile(src [, mode [, filename]]) */
+static int qelup_compile(lua_State *L) {
+    static const char *const modes[] = {"eval", "exec", "single", NULL};
+    static const int starts[] = {Py_eval_input, Py_file_input, Py_single_input};
     
-    const char *code = luaL_checkstring(L, 1);
+    check_initialized(L);
     
-    PyObject *main_module = PyImport_AddModule("__main__");
-    PyObject *global_dict = PyModule_GetDict(main_module);
+    const char *src = luaL_checkstring(L, 1);
+    int start = starts[luaL_checkoption(L, 2, "eval", modes)];
+    const char *filename = luaL_optstring(L, 3, "<qelup>");
     
-    PyObject *result = PyRun_String(code, Py_file_input, global_dict, global_dict);
+    QELUP_GIL_ACQUIRE();
+    PyObject *code = Py_CompileString(src, filename, start);
     
-    if (result == NULL) {
-        return handle_python_exception(L);
+    if (code == NULL) {
+        return handle_python_exception(L, qelup_gil);
     }
     
-    Py_DECREF(result);
-    lua_pushboolean(L, 1);
+    qelup_Code *udata = (qelup_Code*)lua_newuserdata(L, sizeof(qelup_Code));
+    QELUP_STAT_ADD(wrappers, 1);
+    udata->obj = code;
+    udata->generation = qelup_generation;
+    udata->start = start;
+    luaL_getmetatable(L, QELUP_CODE_MT);
+    lua_setmetatable(L, -2);
+    QELUP_GIL_RELEASE();
+    
     return 1;
 }
 
-/* Evaluate Python expression */
-static int qelup_eval(lua_State *L) {
-    check_initialized(L);
+/* Run compiled code in __main__, with an optional locals table: code:run(locals) */
+static int pycode_run(lua_State *L) {
+    qelup_Code *udata = (qelup_Code*)luaL_checkudata(L, 1, QELUP_CODE_MT);
+    int has_locals = !lua_isnoneornil(L, 2);
+    int empty_locals = 0;
     
-    const char *expr = luaL_checkstring(L, 1);
+    if (has_locals) {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_pushnil(L);
+        if (lua_next(L, 2) == 0) {
+            empty_locals = 1;
+        } else {
+            lua_pop(L, 2);
+        }
+    }
+    if (udata->obj == NULL) {
+        return luaL_error(L, "code object has been released");
+    }
+    if (udata->generation != qelup_generation || !Py_IsInitialized()) {
+        return luaL_error(L, "code object belongs to a finalized interpreter");
+    }
     
+    QELUP_GIL_ACQUIRE();
     PyObject *main_module = PyImport_AddModule("__main__");
     PyObject *global_dict = PyModule_GetDict(main_module);
+    PyObject *locals = global_dict;
     
-    PyObject *result = PyRun_String(expr, Py_eval_input, global_dict, global_dict);
+    if (empty_locals) {
+        /* An empty table would convert to a list */
+        locals = PyDict_New();
+        if (locals == NULL) {
+            return handle_python_exception(L, qelup_gil);
+        }
+    } else if (has_locals) {
+        locals = lua_to_python(L, 2);
+        if (locals == NULL) {
+            return handle_python_exception(L, qelup_gil);
+        }
+        if (!PyDict_Check(locals)) {
+            Py_DECREF(locals);
+            QELUP_GIL_RELEASE();
+            return luaL_argerror(L, 2, "locals must be a table with string keys");
+        }
+    }
+    
+    QELUP_DEADLINE_BEGIN();
+    QELUP_STAT_START(t0);
+    #ifdef QELUP_PY3
+    PyObject *result = PyEval_EvalCode(udata->obj, global_dict, locals);
+    #else
+    PyObject *result = PyEval_EvalCode((PyCodeObject*)udata->obj, global_dict, locals);
+    #endif
+    QELUP_STAT_STOP(t0, udata->start == Py_eval_input ? QELUP_STAT_EVAL : QELUP_STAT_EXEC);
+    QELUP_DEADLINE_END();
+    
+    if (has_locals) {
+        Py_DECREF(locals);
+    }
     
     if (result == NULL) {
-        return handle_python_exception(L);
+        return handle_python_exception(L, qelup_gil);
     }
     
-    python_to_lua(L, result);
+    int rc = 0;
+    if (udata->start == Py_eval_input) {
+        rc = python_to_lua(L, result);
+    } else {
+        lua_pushboolean(L, 1);
+    }
     Py_DECREF(result);
+    if (rc < 0) {
+        return handle_python_exception(L, qelup_gil);
+    }
+    QELUP_GIL_RELEASE();
     
     return 1;
 }
 
-/* Get Python version */
-static int qelup_version(lua_State *L) {
-    lua_pushstring(L, Py_GetVersion());
-    lua_pushinteger(L, PY_MAJOR_VERSION);
-    lua_pushinteger(L, PY_MINOR_VERSION);
-    return 3;
+/* Method lookup for code handles */
+static int pycode_index(lua_State *L) {
+    luaL_checkudata(L, 1, QELUP_CODE_MT);
+    const char *key = luaL_checkstring(L, 2);
+    
+    if (strcmp(key, "run") == 0) {
+        lua_pushcfunction(L, pycode_run);
+    } else if (strcmp(key, "mode") == 0) {
+        qelup_Code *udata = (qelup_Code*)lua_touserdata(L, 1);
+        lua_pushstring(L, udata->start == Py_eval_input ? "eval" :
+                          udata->start == Py_file_input ? "exec" : "single");
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int pycode_tostring(lua_State *L) {
+    luaL_checkudata(L, 1, QELUP_CODE_MT);
+    lua_pushfstring(L, "qelup.code: %p", lua_touserdata(L, 1));
+    return 1;
 }
 
 /* ========================================================================== */
-/* Python Object Methods */
+/* FFI Interface */
 /* ========================================================================== */
 
-/* Call Python object */
-static int pyobject_call(lua_State *L) {
-    PyObject *obj = qelup_checkpyobject(L, 1);
-    int nargs = lua_gettop(L) - 1;
+/*
+    A small C ABI for LuaJIT's FFI, which compiles calls to these functions
+    into traces instead of going through the Lua C API. Handles are
+    PyObject pointers owned by a live Lua wrapper (core.handle) or returned
+    by qelup_ffi_eval and released with qelup_ffi_release. Functions return
+    0 on success and -1 on failure, with the message available from
+    qelup_ffi_error() on the same thread. Each call takes the GIL itself,
+    but leaves queued decrefs and registry unrefs to the next Lua C API
+    call: the caller is inside a compiled trace and Lua is not reentrant.
+    QELUP_FFI_VERSION changes whenever a signature does.
+*/
+
+#define QELUP_FFI_VERSION 1
+
+#if defined(_WIN32)
+    #define QELUP_FFI_API __declspec(dllexport)
+#elif defined(__GNUC__) || defined(__clang__)
+    #define QELUP_FFI_API __attribute__((visibility("default")))
+#else
+    #define QELUP_FFI_API
+#endif
+
+/* A buffer export; internal holds the Py_buffer until qelup_ffi_buffer_release */
+typedef struct {
+    void *data;
+    int64_t len;            /* bytes */
+    int64_t itemsize;
+    char format[8];         /* struct-module format, e.g. "d" or "B" */
+    int readonly;
+    void *internal;
+} qelup_FFIBuffer;
+
+static QELUP_THREAD_LOCAL char qelup_ffi_message[256];
+static QELUP_THREAD_LOCAL PyObject *qelup_ffi_last = NULL;     /* keeps a string result alive */
+static QELUP_THREAD_LOCAL int qelup_ffi_last_generation = 0;
+
+/* Record the pending Python error for qelup_ffi_error (GIL held) */
+static int qelup_ffi_fail(void) {
+    PyObject *ptype, *pvalue, *ptraceback;
+    PyErr_Fetch(&ptype, &pvalue, &ptraceback);
+    PyErr_NormalizeException(&ptype, &pvalue, &ptraceback);
     
-    PyObject *args = PyTuple_New(nargs);
-    for (int i = 0; i < nargs; i++) {
-        PyObject *arg = lua_to_python(L, i + 2);
-        PyTuple_SetItem(args, i, arg);
+    const char *msg = NULL;
+    PyObject *str = NULL;
+    if (qelup_CallTimeout != NULL && ptype != NULL && PyErr_GivenExceptionMatches(ptype, qelup_CallTimeout)) {
+        msg = QELUP_TIMEOUT_MSG;
+    } else if (pvalue != NULL && (str = PyObject_Str(pvalue)) != NULL) {
+        msg = PyString_AsString(str);
     }
+    snprintf(qelup_ffi_message, sizeof(qelup_ffi_message), "%s", msg != NULL ? msg : "Unknown Python error");
     
-    PyObject *result = PyObject_CallObject(obj, args);
+    Py_XDECREF(str);
+    Py_XDECREF(ptype);
+    Py_XDECREF(pvalue);
+    Py_XDECREF(ptraceback);
+    PyErr_Clear();
+    QELUP_STAT_ADD(errors, 1);
+    return -1;
+}
+
+static int qelup_ffi_ready(void) {
+    if (!Py_IsInitialized()) {
+        snprintf(qelup_ffi_message, sizeof(qelup_ffi_message), "Python is not initialized");
+        return 0;
+    }
+    return 1;
+}
+
+/* Call fn with a tuple built by the caller; steals args (GIL held) */
+static PyObject* qelup_ffi_invoke(PyObject *fn, PyObject *args) {
+    if (args == NULL) {
+        return NULL;
+    }
+    QELUP_DEADLINE_BEGIN();
+    QELUP_STAT_START(t0);
+    PyObject *result = PyObject_CallObject(fn, args);
+    QELUP_STAT_CALL(t0, fn);
+    QELUP_DEADLINE_END();
     Py_DECREF(args);
-    
+    return result;
+}
+
+QELUP_FFI_API int qelup_ffi_version(void) {
+    return QELUP_FFI_VERSION;
+}
+
+QELUP_FFI_API const char* qelup_ffi_error(void) {
+    return qelup_ffi_message;
+}
+
+/* Evaluate an expression in __main__; returns a new handle or NULL */
+QELUP_FFI_API void* qelup_ffi_eval(const char *expr) {
+    if (!qelup_ffi_ready()) {
+        return NULL;
+    }
+    qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+    PyObject *globals = PyModule_GetDict(PyImport_AddModule("__main__"));
+    PyObject *result = PyRun_String(expr, Py_eval_input, globals, globals);
     if (result == NULL) {
-        return handle_python_exception(L);
+        qelup_ffi_fail();
     }
-    
-    python_to_lua(L, result);
-    Py_DECREF(result);
-    
-    return 1;
+    qelup_gil_release(gil);
+    return result;
 }
 
-/* Get attribute */
-static int pyobject_index(lua_State *L) {
-    PyObject *obj = qelup_checkpyobject(L, 1);
-    const char *key = luaL_checkstring(L, 2);
-    
-    PyObject *attr = PyObject_GetAttrString(obj, key);
-    
-    if (attr == NULL) {
-        PyErr_Clear();
-        lua_pushnil(L);
-        return 1;
+QELUP_FFI_API void qelup_ffi_release(void *handle) {
+    if (handle != NULL && Py_IsInitialized()) {
+        qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+        Py_DECREF((PyObject*)handle);
+        qelup_gil_release(gil);
+    }
+}
+
+/* fn(args[0], ..., args[nargs-1]) with float arguments and a float result */
+QELUP_FFI_API int qelup_ffi_call_double(void *fn, int nargs, const double *args, double *out) {
+    if (!qelup_ffi_ready()) {
+        return -1;
+    }
+    qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+    PyObject *tuple = PyTuple_New(nargs);
+    for (int i = 0; tuple != NULL && i < nargs; i++) {
+        PyObject *arg = PyFloat_FromDouble(args[i]);
+        if (arg == NULL) {
+            Py_CLEAR(tuple);
+            break;
+        }
+        PyTuple_SET_ITEM(tuple, i, arg);
     }
     
-    python_to_lua(L, attr);
-    Py_DECREF(attr);
+    int rc = 0;
+    PyObject *result = qelup_ffi_invoke((PyObject*)fn, tuple);
+    if (result != NULL) {
+        *out = PyFloat_AsDouble(result);
+        Py_DECREF(result);
+    }
+    if (result == NULL || (*out == -1.0 && PyErr_Occurred())) {
+        rc = qelup_ffi_fail();
+    }
+    qelup_gil_release(gil);
+    return rc;
+}
+
+/* fn(args...) with int arguments and an int result */
+QELUP_FFI_API int qelup_ffi_call_int(void *fn, int nargs, const int64_t *args, int64_t *out) {
+    if (!qelup_ffi_ready()) {
+        return -1;
+    }
+    qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+    PyObject *tuple = PyTuple_New(nargs);
+    for (int i = 0; tuple != NULL && i < nargs; i++) {
+        PyObject *arg = PyLong_FromLongLong((long long)args[i]);
+        if (arg == NULL) {
+            Py_CLEAR(tuple);
+            break;
+        }
+        PyTuple_SET_ITEM(tuple, i, arg);
+    }
     
-    return 1;
+    int rc = 0;
+    PyObject *result = qelup_ffi_invoke((PyObject*)fn, tuple);
+    if (result != NULL) {
+        *out = (int64_t)PyLong_AsLongLong(result);
+        Py_DECREF(result);
+    }
+    if (result == NULL || (*out == -1 && PyErr_Occurred())) {
+        rc = qelup_ffi_fail();
+    }
+    qelup_gil_release(gil);
+    return rc;
 }
 
-/* Set attribute */
-static int pyobject_newindex(lua_State *L) {
-    PyObject *obj = qelup_checkpyobject(L, 1);
-    const char *key = luaL_checkstring(L, 2);
-    PyObject *value = lua_to_python(L, 3);
+/*
+    fn(arg) with one string argument (str, or bytes when not UTF-8) and a
+    str or bytes result, borrowed through *out until this thread's next
+    string call
+*/
+QELUP_FFI_API int qelup_ffi_call_string(void *fn, const char *arg, size_t len, const char **out, size_t *outlen) {
+    if (!qelup_ffi_ready()) {
+        return -1;
+    }
+    qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+    if (qelup_ffi_last_generation == qelup_generation) {
+        Py_CLEAR(qelup_ffi_last);
+    }
+    qelup_ffi_last = NULL;
     
-    int result = PyObject_SetAttrString(obj, key, value);
-    Py_DECREF(value);
+    PyObject *str = qelup_fromluastring(arg, len, qelup_config.bytes);
+    PyObject *result = qelup_ffi_invoke((PyObject*)fn, str != NULL ? PyTuple_Pack(1, str) : NULL);
+    Py_XDECREF(str);
     
-    if (result == -1) {
-        return handle_python_exception(L);
+    int rc = 0;
+    Py_ssize_t n = 0;
+    const char *data = NULL;
+    if (result != NULL) {
+        if (PyString_Check(result)) {
+            data = qelup_pystring(result, &n);
+        }
+        #ifdef QELUP_PY3
+        else if (PyBytes_Check(result)) {
+            data = PyBytes_AS_STRING(result);
+            n = PyBytes_GET_SIZE(result);
+        }
+        #endif
+        else {
+            PyErr_Format(PyExc_TypeError, "expected a str result, got %s", Py_TYPE(result)->tp_name);
+        }
     }
     
-    return 0;
+    if (data != NULL) {
+        qelup_ffi_last = result;
+        qelup_ffi_last_generation = qelup_generation;
+        *out = data;
+        *outlen = (size_t)n;
+    } else {
+        Py_XDECREF(result);
+        rc = qelup_ffi_fail();
+    }
+    qelup_gil_release(gil);
+    return rc;
 }
 
-/* Garbage collection */
-static int pyobject_gc(lua_State *L) {
-    qelup_PyObject *udata = (qelup_PyObject*)luaL_checkudata(L, 1, QELUP_PYOBJECT_MT);
-    if (udata->obj != NULL) {
-        Py_DECREF(udata->obj);
-        udata->obj = NULL;
+/* Export obj's buffer for direct access; release with qelup_ffi_buffer_release */
+QELUP_FFI_API int qelup_ffi_buffer(void *obj, qelup_FFIBuffer *buf) {
+    memset(buf, 0, sizeof(*buf));
+    if (!qelup_ffi_ready()) {
+        return -1;
     }
-    return 0;
+    Py_buffer *view = (Py_buffer*)calloc(1, sizeof(Py_buffer));
+    if (view == NULL) {
+        snprintf(qelup_ffi_message, sizeof(qelup_ffi_message), "out of memory");
+        return -1;
+    }
+    
+    qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+    int rc = 0;
+    const char *format = NULL;
+    if (PyObject_GetBuffer((PyObject*)obj, view, PyBUF_ANY_CONTIGUOUS | PyBUF_FORMAT) < 0) {
+        free(view);
+        rc = qelup_ffi_fail();
+    } else if (strlen(format = view->format != NULL ? view->format : "B") >= sizeof(buf->format)) {
+        /* A truncated format would describe different items */
+        snprintf(qelup_ffi_message, sizeof(qelup_ffi_message), "buffer format '%.64s' is too long", format);
+        PyBuffer_Release(view);
+        free(view);
+        rc = -1;
+    } else {
+        buf->data = view->buf;
+        buf->len = (int64_t)view->len;
+        buf->itemsize = (int64_t)view->itemsize;
+        memcpy(buf->format, format, strlen(format) + 1);
+        buf->readonly = view->readonly;
+        buf->internal = view;
+    }
+    qelup_gil_release(gil);
+    return rc;
 }
 
-/* String representation */
-static int pyobject_tostring(lua_State *L) {
-    PyObject *obj = qelup_checkpyobject(L, 1);
-    
-    PyObject *str = PyObject_Str(obj);
-    if (str == NULL) {
-        lua_pushstring(L, "<Python object>");
-        return 1;
+QELUP_FFI_API void qelup_ffi_buffer_release(qelup_FFIBuffer *buf) {
+    Py_buffer *view = (Py_buffer*)buf->internal;
+    if (view != NULL && Py_IsInitialized()) {
+        qelup_Gil gil = qelup_gil_acquire_nodrain(NULL);
+        PyBuffer_Release(view);
+        qelup_gil_release(gil);
     }
-    
-    const char *cstr = PyString_AsString(str);
-    lua_pushstring(L, cstr);
-    Py_DECREF(str);
-    
+    free(view);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/* The PyObject* behind a wrapper as a light userdata, for ffi.cast: core.handle(obj) */
+static int qelup_handle(lua_State *L) {
+    lua_pushlightuserdata(L, (void*)qelup_checkpyobject(L, 1));
     return 1;
 }
 
@@ -446,6 +8323,36 @@ static const luaL_Reg qelup_funcs[] = {
     {"exec", qelup_exec},
     {"eval", qelup_eval},
     {"version", qelup_version},
+    {"config", qelup_configure},
+    {"bytes", qelup_bytes},
+    {"kwargs", qelup_kwargs},
+    {"view", qelup_view},
+    {"attrcache", qelup_attrcache},
+    {"stats", qelup_getstats},
+    {"resetStats", qelup_resetstats},
+    {"now", qelup_luanow},
+    {"compile", qelup_compile},
+    {"map", qelup_map},
+    {"starmap", qelup_starmap},
+    {"floats", qelup_floats},
+    {"buffer", qelup_buffer},
+    {"ndarray", qelup_ndarray},
+    {"arrow", qelup_arrow},
+    {"arrowstream", qelup_arrowstream},
+    {"toarrow", qelup_toarrow},
+    {"workers", qelup_workers},
+    {"pool", qelup_pool},
+    {"submit", qelup_submit_awaitable},
+    {"wait", qelup_waitfutures},
+    {"collect", qelup_collect},
+    {"call_with_timeout", qelup_call_with_timeout},
+    {"istimeout", qelup_istimeout},
+    {"handle", qelup_handle},
+    {"ints", qelup_ints},
+    {"strings", qelup_strings},
+    {"iter", qelup_iter},
+    {"lazy", qelup_lazy},
+    {"totable", pyproxy_totable},
     {NULL, NULL}
 };
 
@@ -455,19 +8362,206 @@ static const luaL_Reg pyobject_methods[] = {
     {"__newindex", pyobject_newindex},
     {"__gc", pyobject_gc},
     {"__tostring", pyobject_tostring},
+    {"__eq", pyobject_eq},
+    {"__len", pyobject_len},
+    {NULL, NULL}
+};
+
+static const luaL_Reg pycode_methods[] = {
+    {"__index", pycode_index},
+    {"__call", pycode_run},
+    {"__gc", pyobject_gc},
+    {"__tostring", pycode_tostring},
+    {NULL, NULL}
+};
+
+static const luaL_Reg buffer_methods[] = {
+    {"__index", buffer_index},
+    {"__newindex", buffer_newindex},
+    {"__len", buffer_len},
+    {"__gc", buffer_release},
+    {"__tostring", buffer_tostring},
+    {NULL, NULL}
+};
+
+static const luaL_Reg ndarray_methods[] = {
+    {"__index", ndarray_index},
+    {"__newindex", ndarray_newindex},
+    {"__len", ndarray_len},
+    {"__tostring", ndarray_tostring},
+    {NULL, NULL}
+};
+
+static const luaL_Reg arrow_methods[] = {
+    {"__index", arrow_index},
+    {"__len", arrow_len},
+    {"__gc", arrow_release},
+    {"__tostring", arrow_tostring},
+    {NULL, NULL}
+};
+
+static const luaL_Reg arrowcol_methods[] = {
+    {"__index", arrowcol_index},
+    {"__len", arrowcol_len},
+    {NULL, NULL}
+};
+
+#ifndef _WIN32
+static const luaL_Reg workers_methods[] = {
+    {"__index", workers_index},
+    {"__len", workers_len},
+    {"__gc", workers_close},
+    {"__tostring", workers_tostring},
+    {NULL, NULL}
+};
+#endif
+
+static const luaL_Reg future_methods[] = {
+    {"__index", future_index},
+    {"__gc", future_gc},
+    {"__tostring", future_tostring},
+    {NULL, NULL}
+};
+
+static const luaL_Reg interppool_methods[] = {
+    {"__index", interppool_index},
+    {"__len", interppool_len},
+    {"__gc", interppool_close},
+    {"__tostring", interppool_tostring},
+    {NULL, NULL}
+};
+
+static const luaL_Reg pyproxy_methods[] = {
+    {"__index", pyproxy_index},
+    {"__len", pyproxy_len},
+    {"__pairs", pyproxy_pairs},
+    {"__ipairs", pyproxy_ipairs},
+    {"__gc", pyobject_gc},
+    {"__tostring", pyproxy_tostring},
     {NULL, NULL}
 };
 
+/* luaL_setfuncs with shared upvalues, for every Lua version */
+static void qelup_setfuncs(lua_State *L, const luaL_Reg *funcs, int nup) {
+    #if LUA_VERSION_NUM >= 502
+    luaL_setfuncs(L, funcs, nup);
+    #else
+    for (; funcs->name != NULL; funcs++) {
+        for (int i = 0; i < nup; i++) {
+            lua_pushvalue(L, -nup);
+        }
+        lua_pushcclosure(L, funcs->func, nup);
+        lua_setfield(L, -(nup + 2), funcs->name);
+    }
+    lua_pop(L, nup);
+    #endif
+}
+
 int luaopen_qelup_core(lua_State *L) {
-    /* Create metatable for Python objects */
+    /* Where Python-side views queue references they drop */
+    qelup_openstate(L);
+    qelup_opentimeout(L);
+    
+    /* Attribute name and value caches, also reachable from the registry */
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    qelup_setregistry(L, &qelup_attrnames_key);
+    
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    qelup_setregistry(L, &qelup_attrcache_key);
+    
+    /* One live wrapper per Python object */
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    qelup_setregistry(L, &qelup_wrappers_key);
+    
+    /* Create metatable for Python objects; caches are shared upvalues */
     luaL_newmetatable(L, QELUP_PYOBJECT_MT);
+    lua_pushvalue(L, -1);
+    qelup_setregistry(L, &qelup_pyobject_mt_key);
+    lua_insert(L, -3);
+    qelup_setfuncs(L, pyobject_methods, 2);
+    lua_pop(L, 1);
+    
+    /* Create metatable for lazy container views */
+    luaL_newmetatable(L, QELUP_PYPROXY_MT);
+    
+    #if LUA_VERSION_NUM >= 502
+    luaL_setfuncs(L, pyproxy_methods, 0);
+    #else
+    luaL_register(L, NULL, pyproxy_methods);
+    #endif
+    
+    lua_pop(L, 1);
+    
+    /* Create metatable for compiled code handles */
+    luaL_newmetatable(L, QELUP_CODE_MT);
     
     #if LUA_VERSION_NUM >= 502
-    luaL_setfuncs(L, pyobject_methods, 0);
+    luaL_setfuncs(L, pycode_methods, 0);
     #else
-    luaL_register(L, NULL, pyobject_methods);
+    luaL_register(L, NULL, pycode_methods);
+    #endif
+    
+    lua_pop(L, 1);
+    
+    /* Create metatable for buffer views */
+    luaL_newmetatable(L, QELUP_BUFFER_MT);
+    qelup_setfuncs(L, buffer_methods, 0);
+    lua_pop(L, 1);
+    
+    /* N-dimensional views; their buffer owns the Python side */
+    luaL_newmetatable(L, QELUP_NDARRAY_MT);
+    qelup_setfuncs(L, ndarray_methods, 0);
+    lua_pop(L, 1);
+    
+    /* Arrow batches, their columns and streams */
+    luaL_newmetatable(L, QELUP_ARROW_MT);
+    qelup_setfuncs(L, arrow_methods, 0);
+    lua_pop(L, 1);
+    
+    luaL_newmetatable(L, QELUP_ARROWCOL_MT);
+    qelup_setfuncs(L, arrowcol_methods, 0);
+    lua_pop(L, 1);
+    
+    luaL_newmetatable(L, QELUP_ARROWSTREAM_MT);
+    lua_pushcfunction(L, arrowstream_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+    
+    #ifndef _WIN32
+    /* Worker pools close their sockets and reap the processes */
+    luaL_newmetatable(L, QELUP_WORKERS_MT);
+    qelup_setfuncs(L, workers_methods, 0);
+    lua_pop(L, 1);
     #endif
     
+    /* Interpreter pools join their threads and end the subinterpreters */
+    luaL_newmetatable(L, QELUP_INTERPPOOL_MT);
+    qelup_setfuncs(L, interppool_methods, 0);
+    lua_pop(L, 1);
+    
+    /* Futures drop their concurrent.futures.Future */
+    luaL_newmetatable(L, QELUP_FUTURE_MT);
+    qelup_setfuncs(L, future_methods, 0);
+    lua_pop(L, 1);
+    
+    /* Iterator state releases its Python iterator and any pending error */
+    luaL_newmetatable(L, QELUP_ITER_MT);
+    lua_pushcfunction(L, pyiter_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+    
+    /* Marker metatable for keyword-argument tables */
+    luaL_newmetatable(L, QELUP_KWARGS_MT);
     lua_pop(L, 1);
     
     /* Create module table */
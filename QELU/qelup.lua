@@ -60,12 +60,91 @@ end
 -- Module cache
 local module_cache = {}
 
+-- Compiled code cache for exec/eval (LRU keyed by source text)
+local code_cache = {
+    capacity = 128,
+    size = 0,
+    hits = 0,
+    misses = 0,
+    lookup = { eval = {}, exec = {} },
+    head = nil,  -- most recently used
+    tail = nil   -- least recently used
+}
+
+--- Unlink a node from the LRU list
+local function lru_unlink(node)
+    if node.prev then node.prev.next = node.next else code_cache.head = node.next end
+    if node.next then node.next.prev = node.prev else code_cache.tail = node.prev end
+    node.prev, node.next = nil, nil
+end
+
+--- Link a node at the head of the LRU list
+local function lru_push(node)
+    node.next = code_cache.head
+    if code_cache.head then code_cache.head.prev = node end
+    code_cache.head = node
+    if not code_cache.tail then code_cache.tail = node end
+end
+
+--- Evict the least recently used entry
+local function lru_evict()
+    local old = code_cache.tail
+    lru_unlink(old)
+    code_cache.lookup[old.mode][old.src] = nil
+    code_cache.size = code_cache.size - 1
+end
+
+--- Drop every cached code object
+local function lru_clear()
+    code_cache.lookup = { eval = {}, exec = {} }
+    code_cache.head, code_cache.tail = nil, nil
+    code_cache.size = 0
+end
+
+--- Fetch a compiled code object, compiling and caching on a miss
+--- @param src string Python source
+--- @param mode string "eval" or "exec"
+--- @return userdata Compiled code handle
+local function cached_code(src, mode)
+    local lookup = code_cache.lookup[mode]
+    local node = lookup[src]
+
+    if node then
+        code_cache.hits = code_cache.hits + 1
+        if node ~= code_cache.head then
+            lru_unlink(node)
+            lru_push(node)
+        end
+        return node.code
+    end
+
+    code_cache.misses = code_cache.misses + 1
+    local code = core.compile(src, mode)
+    if code_cache.capacity <= 0 then
+        return code
+    end
+
+    node = { src = src, mode = mode, code = code }
+    lookup[src] = node
+    lru_push(node)
+    code_cache.size = code_cache.size + 1
+
+    if code_cache.size > code_cache.capacity then
+        lru_evict()
+    end
+
+    return code
+end
+
 -- ============================================================================
 -- Initialization
 -- ============================================================================
 
 --- Initialize Python interpreter
---- @param options table|nil {version: number}
+--- Options trim start-up: isolated (ignore PYTHON* environment variables
+--- and the user site), site = false (skip importing site), path (the full
+--- module search path) and preimport (modules imported in the background).
+--- @param options table|nil {isolated, site, path, preimport}
 --- @return boolean success
 function QELUP.initialize(options)
     if QELUP._initialized then
@@ -74,17 +153,18 @@ function QELUP.initialize(options)
     
     options = options or {}
     
-    local ok, err = core.initialize(options.version or 0)
+    local ok, err = core.initialize(options)
     if not ok then
         error("Failed to initialize Python: " .. tostring(err))
     end
     
     -- Get Python version
-    local version_str, major, minor = core.version()
+    local version_str, major, minor, init_ms = core.version()
     QELUP._python_version = {
         string = version_str,
         major = major,
-        minor = minor
+        minor = minor,
+        init_ms = init_ms
     }
     
     QELUP._initialized = true
@@ -98,7 +178,8 @@ function QELUP.isInitialized()
 end
 
 --- Get Python version information
---- @return table|nil
+--- init_ms is the measured interpreter start-up time.
+--- @return table|nil {string, major, minor, init_ms}
 function QELUP.version()
     if not QELUP._initialized then
         return nil
@@ -113,6 +194,7 @@ function QELUP.finalize()
     end
     
     module_cache = {}
+    lru_clear()
     core.finalize()
     QELUP._initialized = false
     QELUP._python_version = nil
@@ -151,26 +233,68 @@ end
 -- Code Execution
 -- ============================================================================
 
---- Execute Python code
+--- Execute Python code (compiled code is cached by source text)
 --- @param code string Python code to execute
+--- @param locals table|nil Local variables for the code
 --- @return boolean success
-function QELUP.exec(code)
+function QELUP.exec(code, locals)
     if not QELUP._initialized then
         QELUP.initialize()
     end
     
-    return core.exec(code)
+    return cached_code(code, "exec"):run(locals)
 end
 
---- Evaluate Python expression
+--- Evaluate Python expression (compiled code is cached by source text)
 --- @param expr string Python expression to evaluate
+--- @param locals table|nil Local variables for the expression
 --- @return any Result of evaluation
-function QELUP.eval(expr)
+function QELUP.eval(expr, locals)
+    if not QELUP._initialized then
+        QELUP.initialize()
+    end
+    
+    return cached_code(expr, "eval"):run(locals)
+end
+
+--- Compile Python source into a reusable code object
+--- Run it with code:run(locals) or code(locals).
+--- @param src string Python source
+--- @param mode string|nil "eval" (default), "exec" or "single"
+--- @return userdata Compiled code handle
+function QELUP.compile(src, mode)
     if not QELUP._initialized then
         QELUP.initialize()
     end
     
-    return core.eval(expr)
+    return core.compile(src, mode)
+end
+
+--- Set the maximum number of cached exec/eval code objects (0 disables)
+--- @param capacity number Maximum entries
+function QELUP.setCodeCacheSize(capacity)
+    code_cache.capacity = capacity
+    while code_cache.size > math.max(capacity, 0) do
+        lru_evict()
+    end
+end
+
+--- Get exec/eval code cache statistics
+--- @return table {hits, misses, size, capacity}
+function QELUP.codeCacheStats()
+    return {
+        hits = code_cache.hits,
+        misses = code_cache.misses,
+        size = code_cache.size,
+        capacity = code_cache.capacity
+    }
+end
+
+--- Clear the exec/eval code cache and reset its counters
+function QELUP.clearCodeCache()
+    lru_clear()
+    code_cache.hits = 0
+    code_cache.misses = 0
 end
 
 --- Execute Python code from file
@@ -188,6 +312,212 @@ function QELUP.execFile(filepath)
     return QELUP.exec(code)
 end
 
+-- ============================================================================
+-- Bridge Settings
+-- ============================================================================
+
+--- Change bridge-wide settings (process-wide, not per Lua state)
+--- async (default on) makes calls to async functions return qelup.future.
+--- decref_batch is how many collected wrappers may wait for the GIL.
+--- timeout (ms, default 0 = none) bounds every call, exec and eval.
+--- @param options table|nil {proxy, bytes, views, attrcache, async, stats, histograms: boolean, maxdepth, decref_batch, timeout: number}
+--- @return table Current settings
+function QELUP.config(options)
+    return core.config(options)
+end
+
+--- Snapshot of bridge counters collected while config.stats is on
+--- Timers ({count, ns}): lua_to_python, python_to_lua, call, eval, exec.
+--- Counters: wrappers, decrefs, errors, bytes_to_python, bytes_to_lua.
+--- Always present: decref_pending, decref_batches, decref_released, decref_largest.
+--- With config.histograms, `histograms` lists {name, count, ns, buckets}
+--- per callable, where buckets[k] counts calls taking [2^(k-1), 2^k) ns.
+--- @return table Statistics
+function QELUP.stats()
+    return core.stats()
+end
+
+--- Zero all bridge counters and histograms
+function QELUP.resetStats()
+    core.resetStats()
+end
+
+--- Monotonic wall-clock time, on the clock the bridge timers use
+--- Unlike os.clock(), time spent waiting on workers or threads counts.
+--- @return number Seconds since an arbitrary start
+function QELUP.now()
+    return core.now()
+end
+
+--- Release Python objects whose Lua wrappers were collected
+--- They are otherwise released in a batch at the next bridge call.
+--- @return number References released
+function QELUP.collect()
+    return core.collect()
+end
+
+--- Wrap a Lua string as Python bytes (for a single argument)
+--- @param str string Binary data
+--- @return table Python bytes object
+function QELUP.bytes(str)
+    return core.bytes(str)
+end
+
+--- Tag a table as keyword arguments for the call it is passed to
+--- Must be the last argument: fn(a, b, QELUP.kwargs({key = value}))
+--- @param tbl table Keyword arguments (string keys)
+--- @return table The same table, tagged
+function QELUP.kwargs(tbl)
+    return core.kwargs(tbl)
+end
+
+--- Call a Python function on every element of a Lua array
+--- The loop runs in C with a single GIL acquisition.
+--- @param fn any Python callable
+--- @param arr table Lua array of single arguments
+--- @return table Array of results (nil results leave holes)
+function QELUP.map(fn, arr)
+    return core.map(fn, arr)
+end
+
+--- Call a Python function once per table of arguments
+--- @param fn any Python callable
+--- @param args table Lua array of argument arrays, e.g. {{1, 2}, {3, 4}}
+--- @return table Array of results (nil results leave holes)
+function QELUP.starmap(fn, args)
+    return core.starmap(fn, args)
+end
+
+--- Convert a whole array of floats in either direction
+--- A Python sequence (list, tuple, array.array, ...) becomes a Lua array of
+--- numbers; a Lua array becomes a Python list of float.
+--- @param arr any Python sequence or Lua array
+--- @return table Lua array or Python list
+function QELUP.floats(arr)
+    return core.floats(arr)
+end
+
+--- Convert a whole array of integers in either direction
+--- @param arr any Python sequence or Lua array
+--- @return table Lua array or Python list
+function QELUP.ints(arr)
+    return core.ints(arr)
+end
+
+--- Convert a whole array of strings in either direction
+--- @param arr any Python sequence or Lua array
+--- @return table Lua array or Python list
+function QELUP.strings(arr)
+    return core.strings(arr)
+end
+
+--- Hold a zero-copy view of a Python buffer (bytes, bytearray, memoryview,
+--- array.array, contiguous NumPy arrays, ...)
+--- buf[i] reads and writes items, #buf is the item count, buf:sub(i, j)
+--- returns items i..j as a Lua string and buf:ptr() the data pointer for FFI.
+--- Fields: nbytes, itemsize, format, readonly. Call buf:release() when done.
+--- @param obj table Python object supporting the buffer protocol
+--- @return userdata qelup.buffer
+function QELUP.buffer(obj)
+    return core.buffer(obj)
+end
+
+--- Wrap a strided buffer (NumPy array, memoryview) as an N-d view
+--- a[i] indexes the first axis (a sub-view, or an element when 1-D);
+--- a:get(i, j, ...) / a:set(i, j, ..., v) address single elements and
+--- a:slice(i, j, step, axis) makes a view without copying. Reductions
+--- a:sum(), a:min(), a:max(), a:mean() and a:dot(b) run in C.
+--- Fields: ndim, shape, strides, size, itemsize, format, contiguous.
+--- @param obj table Python object supporting the buffer protocol
+--- @return userdata qelup.ndarray
+function QELUP.ndarray(obj)
+    return core.ndarray(obj)
+end
+
+--- Import an Arrow array or record batch by pointer (pyarrow, polars, ...)
+--- Anything with __arrow_c_array__ works. #batch is the row count;
+--- batch:column(i | name) returns a column read in place: col[i] (nil
+--- for nulls), #col, col:totable(), col:ptr(). Fields: names, ncolumns.
+--- @param obj table Python object exporting Arrow data
+--- @return userdata qelup.arrow
+function QELUP.arrow(obj)
+    return core.arrow(obj)
+end
+
+--- Iterate the record batches of an Arrow stream (pyarrow Table, pandas
+--- DataFrame with __arrow_c_stream__, ...)
+--- @param obj table Python object exporting an Arrow stream
+--- @return function Iterator yielding qelup.arrow batches
+function QELUP.arrowstream(obj)
+    return core.arrowstream(obj)
+end
+
+--- Build an Arrow record batch from Lua column arrays
+--- Integers become int64, other numbers float64, strings utf8 and booleans
+--- bool; nil entries are nulls. Python reads the result through
+--- __arrow_c_array__, e.g. pyarrow.record_batch(batch).
+--- @param columns table Map of column name to Lua array
+--- @param names table|nil Column order (default: sorted names)
+--- @return table Python qelup.ArrowBatch
+function QELUP.toarrow(columns, names)
+    if names == nil then
+        names = {}
+        for name in pairs(columns) do
+            if type(name) == "string" then
+                names[#names + 1] = name
+            end
+        end
+        table.sort(names)
+    end
+    return core.toarrow(columns, names)
+end
+
+--- Stream a Python iterable (generator, cursor, file, ...) as a Lua iterator
+--- Yields (index, value); pulling `batch` elements per crossing.
+--- @param obj any Python iterable
+--- @param batch number|nil Elements fetched per bridge call (default 1)
+--- @return function Iterator for use in a generic for
+function QELUP.iter(obj, batch)
+    return core.iter(obj, batch)
+end
+
+--- Wrap a Lua table so Python reads it on access instead of copying it
+--- The view is only usable while a call from this Lua state is active.
+--- @param tbl table Lua table
+--- @param kind string|nil "list", "dict" or "auto" (default: list if t[1] ~= nil)
+--- @return table Python qelup.LuaList or qelup.LuaTable object
+function QELUP.view(tbl, kind)
+    if not QELUP._initialized then
+        QELUP.initialize()
+    end
+    
+    return core.view(tbl, kind)
+end
+
+--- Control attribute caching for one Python object
+--- Module and class attributes that are functions, classes or modules are
+--- cached by default; pass false for objects whose attributes change.
+--- @param obj table Python object
+--- @param enabled boolean|nil true caches every wrapped attribute, false none, nil restores the default
+function QELUP.attrcache(obj, enabled)
+    core.attrcache(obj, enabled)
+end
+
+--- Wrap a Python list, tuple or dict as a lazy view
+--- Elements are fetched from Python on access; call :totable() to copy.
+--- @param obj any Python object
+--- @return any Lazy view
+function QELUP.lazy(obj)
+    return core.lazy(obj)
+end
+
+--- Fully convert a lazy view or Python object into Lua tables
+--- @param obj any Lazy view or Python object
+--- @return any Converted value
+function QELUP.totable(obj)
+    return core.totable(obj)
+end
+
 -- ============================================================================
 -- Convenience Functions
 -- ============================================================================
@@ -201,6 +531,27 @@ function QELUP.pcall(fn, ...)
     return pcall(fn, ...)
 end
 
+--- Call a Python function, interrupting it once `ms` milliseconds pass
+--- The timeout is raised inside Python as lua.CallTimeout (a BaseException,
+--- so `except Exception` does not catch it) and reaches Lua as an error
+--- value QELUP.isTimeout recognizes.
+--- A single blocking C call is only interrupted when it returns.
+--- @param fn table Python callable
+--- @param ms number Deadline in milliseconds
+--- @param ... any Arguments
+--- @return any Result
+function QELUP.callWithTimeout(fn, ms, ...)
+    return core.call_with_timeout(fn, ms, ...)
+end
+
+--- Check whether an error came from an expired deadline
+--- Timeouts raise one unique value, so other errors never match.
+--- @param err any Error value from pcall
+--- @return boolean
+function QELUP.isTimeout(err)
+    return core.istimeout(err)
+end
+
 --- Create a Python object from Lua table
 --- @param tbl table Lua table
 --- @param as_list boolean|nil Force as list (default: auto-detect)
@@ -334,6 +685,347 @@ function QELUP.type(obj)
     return tostring(py_type)
 end
 
+-- ============================================================================
+-- Worker Pools
+-- ============================================================================
+
+-- Remote callables: proxy -> {pool, module, attr}
+local remote_targets = setmetatable({}, {__mode = "k"})
+local Remote = {}
+
+local function remote(pool, module, attr)
+    local proxy = setmetatable({}, Remote)
+    remote_targets[proxy] = {pool = pool, module = module, attr = attr}
+    return proxy
+end
+
+Remote.__index = function(self, key)
+    local target = remote_targets[self]
+    return remote(target.pool, target.module, target.attr and (target.attr .. "." .. key) or key)
+end
+
+Remote.__call = function(self, ...)
+    local target = remote_targets[self]
+    if not target.attr then
+        error("cannot call a worker module", 2)
+    end
+    return target.pool:call(target.module, target.attr, ...)
+end
+
+Remote.__tostring = function(self)
+    local target = remote_targets[self]
+    return "worker function " .. target.module .. (target.attr and ("." .. target.attr) or "")
+end
+
+local WorkerPool = {}
+WorkerPool.__index = WorkerPool
+
+--- Start a pool of `n` Python worker processes for CPU-bound calls
+--- Workers are separate interpreters, so calls run in parallel on all
+--- cores; arguments and results are copied (nil, booleans, numbers,
+--- strings and tables only). Workers do not share state with QELUP.eval.
+--- @param n number Number of processes
+--- @param python string|nil Interpreter to run (default: the one built against)
+--- @return table Pool with import, exec, map, close
+function QELUP.workers(n, python)
+    return setmetatable({_core = core.workers(n, python)}, WorkerPool)
+end
+
+--- Import a module in every worker; calling its functions runs them on
+--- the next worker in turn, e.g. pool:import("scoring").score(row)
+--- @param name string Module name
+--- @return table Remote module
+function WorkerPool:import(name)
+    self._core:import(name)
+    return remote(self._core, name, nil)
+end
+
+--- Run Python source in every worker; its definitions are reachable
+--- through pool:import("__main__")
+--- @param code string Python code
+function WorkerPool:exec(code)
+    self._core:exec(code)
+end
+
+--- Call a remote function once per item across all workers
+--- @param fn table Remote function from pool:import
+--- @param items table Array of single arguments
+--- @return table Results in item order
+function WorkerPool:map(fn, items)
+    local target = remote_targets[fn]
+    if not target or not target.attr then
+        error("pool:map expects a function from pool:import", 2)
+    end
+    return self._core:map(target.module, target.attr, items)
+end
+
+--- Stop the workers (also done when the pool is collected)
+function WorkerPool:close()
+    self._core:close()
+end
+
+WorkerPool.__len = function(self)
+    return #self._core
+end
+
+--- Start a pool of `n` subinterpreters, each with its own GIL and thread
+--- (Python 3.12+), for CPU-bound work inside this process. Methods:
+--- exec(code) in every interpreter, eval(expr), call(name, ...) by dotted
+--- name and map(name, items) across all of them, close(). Values are copied
+--- as for QELUP.workers. Elsewhere pool.isolated is false and one private
+--- namespace in the main interpreter runs the requests in turn.
+--- @param n number|nil Number of interpreters (default 1)
+--- @return userdata qelup.pool
+function QELUP.pool(n)
+    return core.pool(n)
+end
+
+-- ============================================================================
+-- Async Functions
+-- ============================================================================
+
+-- Coroutines driven by QELUP.run; only these may be yielded to wait
+local run_threads = setmetatable({}, {__mode = "k"})
+
+--- True inside a coroutine whose resumer is QELUP.run
+--- Any other coroutine's resumer would receive the future as a value.
+local function awaitable_thread()
+    local co = coroutine.running()
+    return co ~= nil and run_threads[co] == true
+end
+
+--- Run a Python awaitable on the bridge event loop
+--- Calling an async function already does this and returns the future.
+--- @param awaitable table Python coroutine, task or other awaitable
+--- @return userdata qelup.future with done(), result([timeout]), cancel()
+function QELUP.submit(awaitable)
+    return core.submit(awaitable)
+end
+
+--- Wait for a future and return its result (or raise its exception)
+--- Inside a coroutine run by QELUP.run this yields so other coroutines
+--- proceed; elsewhere it blocks.
+--- @param future userdata qelup.future
+--- @return any Result
+function QELUP.await(future)
+    if awaitable_thread() then
+        while not future:done() do
+            coroutine.yield(future)
+        end
+    end
+    return future:result()
+end
+
+--- Wait for several futures
+--- @param futures table Array of qelup.future
+--- @return table Results in the same order
+function QELUP.gather(futures)
+    local results = {}
+    for i = 1, #futures do
+        results[i] = QELUP.await(futures[i])
+    end
+    return results
+end
+
+--- Run functions as Lua coroutines until all finish; while every one is
+--- waiting on a future, block until the next future completes
+--- @param ... function Tasks (no arguments)
+--- @return table First return value of each task, in order
+function QELUP.run(...)
+    local tasks = {...}
+    local threads, waiting, results = {}, {}, {}
+    for i = 1, #tasks do
+        threads[i] = coroutine.create(tasks[i])
+        run_threads[threads[i]] = true
+    end
+
+    local remaining = #tasks
+    while remaining > 0 do
+        local pending = {}
+        for i = 1, #tasks do
+            local co = threads[i]
+            if co and (waiting[i] == nil or waiting[i]:done()) then
+                local ok, value = coroutine.resume(co)
+                if not ok then
+                    error(value, 0)
+                end
+                if coroutine.status(co) == "dead" then
+                    threads[i], waiting[i] = nil, nil
+                    results[i] = value
+                    remaining = remaining - 1
+                else
+                    waiting[i] = type(value) == "userdata" and value or nil
+                end
+            end
+            if threads[i] and waiting[i] then
+                pending[#pending + 1] = waiting[i]
+            end
+        end
+        -- Only sleep when nothing can run
+        if remaining > 0 and #pending == remaining then
+            core.wait(pending)
+        end
+    end
+    return results
+end
+
+-- ============================================================================
+-- FFI Fast Path
+-- ============================================================================
+
+-- LuaJIT binding of the qelup_ffi_* ABI: {ffi, C}, false when unavailable
+local fast = nil
+
+-- Keeps each Python callable alive as long as its fast wrapper
+local fast_owners = setmetatable({}, {__mode = "k"})
+
+local FAST_MAX_ARGS = 16
+
+local BUFFER_CTYPES = {
+    b = "int8_t", B = "uint8_t", h = "int16_t", H = "uint16_t",
+    i = "int32_t", I = "uint32_t", l = "long", L = "unsigned long",
+    q = "int64_t", Q = "uint64_t", f = "float", d = "double",
+}
+
+--- Load the FFI binding once (LuaJIT only)
+local function fast_backend()
+    if fast ~= nil then
+        return fast
+    end
+    fast = false
+    if not jit then
+        return fast
+    end
+
+    local ok, ffi = pcall(require, "ffi")
+    if not ok then
+        return fast
+    end
+    pcall(ffi.cdef, [[
+        typedef struct {
+            void *data;
+            int64_t len;
+            int64_t itemsize;
+            char format[8];
+            int readonly;
+            void *internal;
+        } qelup_FFIBuffer;
+        int qelup_ffi_version(void);
+        const char *qelup_ffi_error(void);
+        int qelup_ffi_call_double(void *fn, int nargs, const double *args, double *out);
+        int qelup_ffi_call_int(void *fn, int nargs, const int64_t *args, int64_t *out);
+        int qelup_ffi_call_string(void *fn, const char *arg, size_t len, const char **out, size_t *outlen);
+        int qelup_ffi_buffer(void *obj, qelup_FFIBuffer *buf);
+        void qelup_ffi_buffer_release(qelup_FFIBuffer *buf);
+    ]])
+
+    -- The module is already loaded; this only resolves its symbols
+    local path = package.searchpath and package.searchpath("qelup_core", package.cpath)
+    local loaded, lib = pcall(ffi.load, path or "qelup_core")
+    if loaded and lib.qelup_ffi_version() == 1 then
+        fast = {ffi = ffi, C = lib}
+    end
+    return fast
+end
+
+--- Check whether QELUP.fastCall and QELUP.fastBuffer use LuaJIT's FFI
+--- @return boolean
+function QELUP.hasFFI()
+    return fast_backend() ~= false
+end
+
+--- Wrap a Python callable for typed calls the LuaJIT compiler can trace
+--- "double" and "int" take up to 16 numbers and return a number; "string"
+--- takes one string and returns a string. Without the FFI (PUC Lua) the
+--- wrapper makes an ordinary call.
+--- @param fn table Python callable
+--- @param kind string "double", "int" or "string"
+--- @return function
+function QELUP.fastCall(fn, kind)
+    local backend = fast_backend()
+    local wrapper
+
+    if not backend then
+        if kind ~= "double" and kind ~= "int" and kind ~= "string" then
+            error("fastCall kind must be 'double', 'int' or 'string'", 2)
+        end
+        wrapper = function(...)
+            return fn(...)
+        end
+        fast_owners[wrapper] = fn
+        return wrapper
+    end
+
+    local ffi, C = backend.ffi, backend.C
+    local handle = ffi.cast("void*", core.handle(fn))
+
+    local function raise()
+        error(ffi.string(C.qelup_ffi_error()), 3)
+    end
+
+    if kind == "double" or kind == "int" then
+        local call = kind == "double" and C.qelup_ffi_call_double or C.qelup_ffi_call_int
+        local args = ffi.new(kind == "double" and "double[?]" or "int64_t[?]", FAST_MAX_ARGS)
+        local out = ffi.new(kind == "double" and "double[1]" or "int64_t[1]")
+        wrapper = function(...)
+            local n = select("#", ...)
+            if n > FAST_MAX_ARGS then
+                error("fastCall takes at most " .. FAST_MAX_ARGS .. " arguments", 2)
+            end
+            for i = 1, n do
+                args[i - 1] = (select(i, ...))
+            end
+            if call(handle, n, args, out) ~= 0 then
+                raise()
+            end
+            return tonumber(out[0])
+        end
+    elseif kind == "string" then
+        local out = ffi.new("const char*[1]")
+        local outlen = ffi.new("size_t[1]")
+        wrapper = function(s)
+            if C.qelup_ffi_call_string(handle, s, #s, out, outlen) ~= 0 then
+                raise()
+            end
+            return ffi.string(out[0], outlen[0])
+        end
+    else
+        error("fastCall kind must be 'double', 'int' or 'string'", 2)
+    end
+
+    fast_owners[wrapper] = fn
+    return wrapper
+end
+
+--- Map a Python buffer (bytes, array.array, NumPy array, ...) for direct access
+--- With the FFI this returns a typed, 0-based pointer, the item count and
+--- the export, which must stay referenced while the pointer is used.
+--- Without it, the 1-based QELUP.buffer view is returned instead.
+--- @param obj table Python object supporting the buffer protocol
+--- @return cdata|userdata Pointer (FFI) or buffer view
+--- @return number Item count
+--- @return cdata|userdata Export keeping the memory alive
+function QELUP.fastBuffer(obj)
+    local backend = fast_backend()
+    if not backend then
+        local buf = core.buffer(obj)
+        return buf, #buf, buf
+    end
+
+    local ffi, C = backend.ffi, backend.C
+    local export = ffi.gc(ffi.new("qelup_FFIBuffer"), C.qelup_ffi_buffer_release)
+    if C.qelup_ffi_buffer(ffi.cast("void*", core.handle(obj)), export) ~= 0 then
+        error(ffi.string(C.qelup_ffi_error()), 2)
+    end
+
+    -- Unknown formats are exposed as raw bytes
+    local ctype = BUFFER_CTYPES[(ffi.string(export.format):gsub("^[@=<>!]", ""))]
+    if not ctype then
+        return ffi.cast("uint8_t*", export.data), tonumber(export.len), export
+    end
+    return ffi.cast(ctype .. "*", export.data), tonumber(export.len / export.itemsize), export
+end
+
 -- ============================================================================
 -- Auto-initialization
 -- ============================================================================
@@ -1,9 +1,9 @@
 #!/usr/bin/env luajit
 --[[
     QELU Library Test Suite
-    Uses QELUTest framework to test QELU OOP library
+    Uses QELUTest framework to test QELU OOP library and the QELUP bridge
     
-    Run with: luajit test.lua
+    Run with: make test (or luajit test.lua once bindings/ is on LUA_CPATH)
 ]]
 
 -- Load both libraries
@@ -569,6 +569,1929 @@ describe("QELUTest Framework", function()
     end)
 end)
 
+-- ============================================================================
+-- QELUP Python Bridge Tests
+-- ============================================================================
+
+-- Skipped when the C extension has not been built
+local hasPython, py = pcall(require, "qelup")
+local describeBridge = hasPython and describe or xdescribe
+
+-- Run fn with some bridge settings changed, restoring them afterwards
+local function withConfig(options, fn)
+    local saved = py.config()
+    py.config(options)
+    local ok, result = pcall(fn)
+    py.config(saved)
+    if not ok then
+        error(result, 0)
+    end
+    return result
+end
+
+describeBridge("QELUP Python Bridge", function()
+    
+    beforeAll(function()
+        py.initialize()
+    end)
+    
+    -- ========================================================================
+    -- GIL Handling
+    -- ========================================================================
+    
+    describe("GIL Handling", function()
+        
+        -- Spin in Lua without entering the bridge
+        local function spin(seconds)
+            local start = py.now()
+            while py.now() - start < seconds do end
+        end
+        
+        beforeAll(function()
+            py.exec([[
+import threading
+import time
+
+gil_ticks = [0]
+gil_stop = threading.Event()
+
+def gil_tick():
+    while not gil_stop.is_set():
+        gil_ticks[0] += 1
+        time.sleep(0.001)
+
+gil_thread = threading.Thread(target=gil_tick)
+gil_thread.daemon = True
+gil_thread.start()
+
+gil_results = []
+
+def gil_job():
+    def run():
+        gil_results.append(sum(range(1000)))
+    worker = threading.Thread(target=run)
+    worker.daemon = True
+    worker.start()
+    return worker
+]])
+        end)
+        
+        afterAll(function()
+            py.exec("gil_stop.set()\ngil_thread.join()")
+        end)
+        
+        it("should let Python threads run between bridge calls", function()
+            local before = py.eval("gil_ticks[0]")
+            spin(0.2)
+            expect(py.eval("gil_ticks[0]")):toBeGreaterThan(before)
+        end)
+        
+        it("should release the GIL after a Python error", function()
+            expect(function() py.eval("1 / 0") end):toThrow("division")
+            local before = py.eval("gil_ticks[0]")
+            spin(0.2)
+            expect(py.eval("gil_ticks[0]")):toBeGreaterThan(before)
+        end)
+        
+        it("should let another thread's call finish after an error", function()
+            expect(function() py.eval("undefined_name") end):toThrow()
+            local worker = py.eval("gil_job")()
+            spin(0.2)
+            expect(worker.is_alive()):toBe(false)
+            expect(py.eval("gil_results")):toEqual({499500})
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Lazy Proxies
+    -- ========================================================================
+    
+    describe("Lazy Proxies", function()
+        
+        local function proxy(expr)
+            return withConfig({proxy = true}, function()
+                return py.eval(expr)
+            end)
+        end
+        
+        it("should copy containers unless proxy is enabled", function()
+            expect(py.eval("[1, 2, 3]")):toBeTable()
+            expect(proxy("[1, 2, 3]")):toBeUserdata()
+        end)
+        
+        it("should index sequences from 1", function()
+            local list = proxy("[10, 20, 30]")
+            expect(#list):toBe(3)
+            expect(list[1]):toBe(10)
+            expect(list[3]):toBe(30)
+            expect(list[0]):toBeNil()
+            expect(list[4]):toBeNil()
+            expect(proxy("('a', 'b')")[2]):toBe("b")
+        end)
+        
+        it("should index dicts by key", function()
+            local dict = proxy("{'name': 'qelu', 1: 'one'}")
+            expect(#dict):toBe(2)
+            expect(dict.name):toBe("qelu")
+            expect(dict[1]):toBe("one")
+            expect(dict.missing):toBeNil()
+        end)
+        
+        it("should iterate lists and dicts", function()
+            local list = proxy("[5, 6, 7]")
+            local sum, count = 0, 0
+            for i, v in getmetatable(list).__ipairs(list) do
+                sum, count = sum + v, i
+            end
+            expect(sum):toBe(18)
+            expect(count):toBe(3)
+            
+            local dict = proxy("{'a': 1, 'b': 2}")
+            local seen = {}
+            for k, v in getmetatable(dict).__pairs(dict) do
+                seen[k] = v
+            end
+            expect(seen):toEqual({a = 1, b = 2})
+        end)
+        
+        it("should keep nested containers lazy", function()
+            local nested = proxy("{'rows': [[1, 2], [3, 4]]}")
+            expect(nested.rows):toBeUserdata()
+            expect(nested.rows[2][1]):toBe(3)
+        end)
+        
+        it("should read the live Python container", function()
+            py.exec("lazy_data = [1, 2]")
+            local list = proxy("lazy_data")
+            py.exec("lazy_data.append(3)")
+            expect(#list):toBe(3)
+            expect(list[3]):toBe(3)
+        end)
+        
+        it("should copy on totable()", function()
+            local list = proxy("[1, [2, 3], {'k': 'v'}]")
+            expect(list:totable()):toEqual({1, {2, 3}, {k = "v"}})
+            expect(py.totable(list)):toEqual({1, {2, 3}, {k = "v"}})
+        end)
+        
+        it("should pass the original object back to Python", function()
+            py.exec("lazy_data = [1, 2]")
+            local list = proxy("lazy_data")
+            expect(py.eval("lambda x: x is lazy_data")(list)):toBe(true)
+        end)
+        
+        it("should wrap Python objects with lazy()", function()
+            local list = py.lazy(proxy("[4, 5]"))
+            expect(list):toBeUserdata()
+            expect(list[2]):toBe(5)
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Binary-Safe Strings
+    -- ========================================================================
+    
+    describe("Binary-Safe Strings", function()
+        
+        local function describeString(value)
+            return py.eval("lambda s: [type(s).__name__, len(s)]")(value)
+        end
+        
+        it("should round-trip embedded NULs", function()
+            local echo = py.eval("lambda s: s")
+            local value = "a\0b\0c"
+            expect(echo(value)):toBe(value)
+            expect(#echo(value)):toBe(5)
+            expect(describeString(value)[2]):toBe(5)
+        end)
+        
+        it("should round-trip large strings", function()
+            local value = string.rep("0123456789abcdef", 65536)
+            local echo = py.eval("lambda s: s")
+            expect(echo(value)):toBe(value)
+        end)
+        
+        it("should pass valid UTF-8 as str and invalid UTF-8 as bytes", function()
+            if py.version().major < 3 then return end
+            expect(describeString("h\195\169llo")):toEqual({"str", 5})
+            expect(describeString("\255\254")):toEqual({"bytes", 2})
+        end)
+        
+        it("should pass bytes() arguments as bytes", function()
+            if py.version().major < 3 then return end
+            expect(describeString(py.bytes("abc"))):toEqual({"bytes", 3})
+        end)
+        
+        it("should pass every string as bytes with config.bytes", function()
+            if py.version().major < 3 then return end
+            local described = withConfig({bytes = true}, function()
+                return describeString("abc")
+            end)
+            expect(described):toEqual({"bytes", 3})
+        end)
+        
+        it("should return bytes and bytearray as Lua strings", function()
+            expect(py.eval("b'\\x00\\xff\\x01'")):toBe("\0\255\1")
+            expect(py.eval("bytearray(b'ab\\x00')")):toBe("ab\0")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Calls and Keyword Arguments
+    -- ========================================================================
+    
+    describe("Calls and Keyword Arguments", function()
+        
+        beforeAll(function()
+            py.exec([[
+def call_shape(*args, **kwargs):
+    return [len(args), sum(args), sorted(kwargs.items())]
+
+class CallTarget:
+    def scale(self, x, factor=1):
+        return x * factor
+]])
+        end)
+        
+        it("should pass positional arguments", function()
+            local shape = py.eval("call_shape")
+            expect(shape()[1]):toBe(0)
+            expect(shape(1, 2, 3)[2]):toBe(6)
+        end)
+        
+        it("should pass more arguments than fit on the stack", function()
+            local shape = py.eval("call_shape")
+            local result = shape(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12)
+            expect(result[1]):toBe(12)
+            expect(result[2]):toBe(78)
+        end)
+        
+        it("should pass keyword arguments", function()
+            local shape = py.eval("call_shape")
+            local result = shape(1, py.kwargs({b = 2, a = "x"}))
+            expect(result[1]):toBe(1)
+            expect(result[3]):toEqual({{"a", "x"}, {"b", 2}})
+        end)
+        
+        it("should mix many positional and keyword arguments", function()
+            local shape = py.eval("call_shape")
+            local result = shape(1, 2, 3, 4, 5, 6, 7, 8, 9, py.kwargs({k = 1}))
+            expect(result[1]):toBe(9)
+            expect(result[3]):toEqual({{"k", 1}})
+        end)
+        
+        it("should pass keyword arguments to bound methods and builtins", function()
+            local target = py.eval("CallTarget()")
+            expect(target.scale(3, py.kwargs({factor = 4}))):toBe(12)
+            expect(py.builtins().sorted({3, 1, 2}, py.kwargs({reverse = true}))):toEqual({3, 2, 1})
+        end)
+        
+        it("should reject non-string keyword names", function()
+            local shape = py.eval("call_shape")
+            expect(function() shape(py.kwargs({"positional"})) end):toThrow("keyword argument names must be strings")
+        end)
+        
+        it("should raise Python errors for unexpected keywords", function()
+            local target = py.eval("CallTarget()")
+            expect(function() target.scale(1, py.kwargs({bogus = 1})) end):toThrow("bogus")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Compiled Code Cache
+    -- ========================================================================
+    
+    describe("Compiled Code Cache", function()
+        local capacity
+        
+        beforeEach(function()
+            capacity = py.codeCacheStats().capacity
+            py.clearCodeCache()
+        end)
+        
+        afterEach(function()
+            py.setCodeCacheSize(capacity)
+        end)
+        
+        it("should compile reusable eval handles", function()
+            local code = py.compile("x * 3")
+            expect(code.mode):toBe("eval")
+            expect(code:run({x = 2})):toBe(6)
+            expect(code({x = 5})):toBe(15)
+        end)
+        
+        it("should refuse locals that are not a mapping", function()
+            local code = py.compile("1 + 1")
+            expect(code:run({})):toBe(2)
+            expect(function() code:run({1, 2}) end):toThrow("locals must be a table with string keys")
+        end)
+        
+        it("should run exec handles in __main__", function()
+            local code = py.compile("compiled_total = 40 + 2", "exec")
+            expect(code.mode):toBe("exec")
+            expect(code:run()):toBe(true)
+            expect(py.eval("compiled_total")):toBe(42)
+        end)
+        
+        it("should raise syntax errors at compile time", function()
+            expect(function() py.compile("1 +") end):toThrow()
+            expect(function() py.compile("1", "bogus") end):toThrow()
+        end)
+        
+        it("should count hits and misses", function()
+            py.eval("1 + 1")
+            py.eval("1 + 1")
+            py.exec("cache_probe = 1")
+            local stats = py.codeCacheStats()
+            expect(stats.misses):toBe(2)
+            expect(stats.hits):toBe(1)
+            expect(stats.size):toBe(2)
+        end)
+        
+        it("should cache eval and exec of the same source separately", function()
+            py.exec("cache_probe")
+            py.eval("cache_probe")
+            expect(py.codeCacheStats().misses):toBe(2)
+        end)
+        
+        it("should evict the least recently used entry", function()
+            py.setCodeCacheSize(2)
+            py.eval("'a'")
+            py.eval("'b'")
+            py.eval("'a'")
+            py.eval("'c'")
+            expect(py.codeCacheStats().size):toBe(2)
+            
+            py.eval("'a'")
+            expect(py.codeCacheStats().hits):toBe(2)
+            py.eval("'b'")
+            expect(py.codeCacheStats().misses):toBe(4)
+        end)
+        
+        it("should shrink and disable the cache", function()
+            py.eval("1")
+            py.eval("2")
+            py.setCodeCacheSize(1)
+            expect(py.codeCacheStats().size):toBe(1)
+            
+            py.setCodeCacheSize(0)
+            expect(py.codeCacheStats().size):toBe(0)
+            expect(py.eval("3")):toBe(3)
+            expect(py.codeCacheStats().size):toBe(0)
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Batched Calls
+    -- ========================================================================
+    
+    describe("Batched Calls", function()
+        
+        it("should map a Python function over an array", function()
+            local square = py.eval("lambda x: x * x")
+            expect(py.map(square, {1, 2, 3})):toEqual({1, 4, 9})
+            expect(py.map(py.builtins().len, {"a", "bb", ""})):toEqual({1, 2, 0})
+            expect(py.map(square, {})):toEqual({})
+        end)
+        
+        it("should leave holes for None results", function()
+            local evens = py.eval("lambda x: x if int(x) % 2 == 0 else None")
+            local result = py.map(evens, {1, 2, 3, 4})
+            expect(result[1]):toBeNil()
+            expect(result[2]):toBe(2)
+            expect(result[3]):toBeNil()
+            expect(result[4]):toBe(4)
+        end)
+        
+        it("should unpack argument tables with starmap", function()
+            local add = py.eval("lambda a, b=0: a + b")
+            expect(py.starmap(add, {{1, 2}, {3, 4}, {5}})):toEqual({3, 7, 5})
+            expect(py.starmap(add, {{1, py.kwargs({b = 10})}})):toEqual({11})
+        end)
+        
+        it("should raise the first Python error", function()
+            local invert = py.eval("lambda x: 1 / x")
+            expect(function() py.map(invert, {1, 0, 2}) end):toThrow("division")
+            expect(function() py.starmap(invert, {{1}, {0}}) end):toThrow("division")
+        end)
+        
+        it("should reject elements that are not argument tables", function()
+            local add = py.eval("lambda a, b=0: a + b")
+            expect(function() py.starmap(add, {{1}, 2}) end):toThrow("element 2 is not a table of arguments")
+            expect(function() py.map(function() end, {1}) end):toThrow("expected Python callable")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Streaming Iterators
+    -- ========================================================================
+    
+    describe("Streaming Iterators", function()
+        
+        beforeAll(function()
+            py.exec([[
+iter_pulled = []
+
+def iter_counting(n):
+    for i in range(int(n)):
+        iter_pulled.append(i)
+        yield i
+
+def iter_failing():
+    yield 1
+    yield 2
+    raise ValueError("stream broke")
+]])
+        end)
+        
+        local function drain(iterator)
+            local values, last = {}, 0
+            local ok, err = pcall(function()
+                for i, v in iterator do
+                    values[#values + 1] = v
+                    last = i
+                end
+            end)
+            return values, last, ok, err
+        end
+        
+        it("should stream a generator with indices", function()
+            for _, batch in ipairs({1, 3, 100}) do
+                local values, last, ok = drain(py.iter(py.eval("(x * x for x in range(5))"), batch))
+                expect(ok):toBe(true)
+                expect(values):toEqual({0, 1, 4, 9, 16})
+                expect(last):toBe(5)
+            end
+        end)
+        
+        it("should pull one batch at a time", function()
+            py.exec("del iter_pulled[:]")
+            local step = py.iter(py.eval("iter_counting(10)"), 4)
+            local i, v = step()
+            expect(i):toBe(1)
+            expect(v):toBe(0)
+            expect(py.eval("len(iter_pulled)")):toBe(4)
+            for _ = 2, 5 do step() end
+            expect(py.eval("len(iter_pulled)")):toBe(8)
+        end)
+        
+        it("should yield buffered items before raising", function()
+            for _, batch in ipairs({1, 10}) do
+                local values, _, ok, err = drain(py.iter(py.eval("iter_failing()"), batch))
+                expect(values):toEqual({1, 2})
+                expect(ok):toBe(false)
+                expect(tostring(err)):toContain("stream broke")
+            end
+        end)
+        
+        it("should iterate lazy views", function()
+            local list = withConfig({proxy = true}, function()
+                return py.eval("['a', 'b']")
+            end)
+            expect((drain(py.iter(list)))):toEqual({"a", "b"})
+        end)
+        
+        it("should reject bad arguments", function()
+            expect(function() py.iter({1, 2}) end):toThrow("expected Python iterable")
+            expect(function() py.iter(py.eval("iter_counting(1)"), 0) end):toThrow("batch size must be positive")
+            expect(function() py.iter(py.eval("object()")) end):toThrow()
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Lua Table Views
+    -- ========================================================================
+    
+    describe("Lua Table Views", function()
+        
+        beforeAll(function()
+            py.exec([[
+import threading
+
+view_held = []
+
+def view_reversible(t):
+    try:
+        reversed(t)
+    except TypeError:
+        return False
+    return True
+
+def view_write(t):
+    t['added'] = 'yes'
+    del t['removed']
+
+def view_bad_keys(t):
+    errors = []
+    for key in (None, float('nan')):
+        try:
+            t[key] = 1
+        except TypeError as e:
+            errors.append(str(e))
+    return errors
+
+def view_from_thread(t):
+    errors = []
+    def run():
+        try:
+            len(t)
+        except RuntimeError as e:
+            errors.append(str(e))
+    worker = threading.Thread(target=run)
+    worker.start()
+    worker.join()
+    return errors[0]
+
+def view_release():
+    worker = threading.Thread(target=lambda: view_held.__delitem__(slice(None)))
+    worker.start()
+    worker.join()
+]])
+        end)
+        
+        it("should read mappings without copying", function()
+            local read = py.eval("lambda t: [t['name'], len(t), 'name' in t, 'nope' in t, t.get('nope', 0)]")
+            local view = py.view({name = "qelu", n = 1}, "dict")
+            expect(read(view)):toEqual({"qelu", 2, true, false, 0})
+        end)
+        
+        it("should read sequences with Python indexing", function()
+            local read = py.eval("lambda l: [len(l), l[0], l[-1], sum(l), 3 in l, list(l)]")
+            expect(read(py.view({1, 2, 3}))):toEqual({3, 1, 3, 6, true, {1, 2, 3}})
+            expect(function() py.eval("lambda l: l[5]")(py.view({1}, "list")) end):toThrow("out of range")
+        end)
+        
+        it("should write through to the Lua table", function()
+            local tbl = {removed = 1}
+            py.eval("view_write")(py.view(tbl, "dict"))
+            expect(tbl.added):toBe("yes")
+            expect(tbl.removed):toBeNil()
+            
+            local list = {1, 2}
+            py.eval("lambda l: l.__setitem__(0, 10)")(py.view(list, "list"))
+            expect(list[1]):toBe(10)
+        end)
+        
+        it("should reject nil and NaN keys on write", function()
+            local tbl = {}
+            local errors = py.eval("view_bad_keys")(py.view(tbl, "dict"))
+            expect(errors):toEqual({"Lua table keys cannot be nil or NaN", "Lua table keys cannot be nil or NaN"})
+            expect(next(tbl)):toBeNil()
+        end)
+        
+        it("should keep nested tables as views", function()
+            local kinds = py.eval("lambda t: [type(t['rows']).__name__, type(t['meta']).__name__, type(t.copy()).__name__]")
+            expect(kinds(py.view({rows = {1, 2}, meta = {k = 1}}, "dict"))):toEqual({"LuaList", "LuaTable", "dict"})
+        end)
+        
+        it("should pass tables as views with config.views", function()
+            local kind = py.eval("lambda t: type(t).__name__")
+            expect(kind({1, 2})):toBe("list")
+            withConfig({views = true}, function()
+                expect(kind({1, 2})):toBe("LuaList")
+                expect(kind({a = 1})):toBe("LuaTable")
+            end)
+        end)
+        
+        it("should return views to Lua as the original table", function()
+            local tbl = {}
+            expect(rawequal(py.eval("lambda t: t")(py.view(tbl, "dict")), tbl)):toBe(true)
+        end)
+        
+        it("should register views with collections.abc", function()
+            if py.version().major < 3 then return end
+            local abc = py.eval("lambda t: [isinstance(t, __import__('collections.abc').abc.Mapping), isinstance(t, __import__('collections.abc').abc.Sequence)]")
+            expect(abc(py.view({a = 1}, "dict"))):toEqual({true, false})
+            expect(abc(py.view({1}, "list"))):toEqual({false, true})
+        end)
+        
+        it("should only reverse list views", function()
+            local reversible = py.eval("view_reversible")
+            expect(reversible(py.view({a = 1}, "dict"))):toBe(false)
+            expect(reversible(py.view({1, 2}, "list"))):toBe(true)
+        end)
+        
+        it("should refuse access outside of a Lua call", function()
+            local message = py.eval("view_from_thread")(py.view({1}, "list"))
+            expect(message):toContain("outside of a Lua call")
+        end)
+        
+        it("should release views dropped on other threads", function()
+            local function marked()
+                local n = 0
+                for _, v in pairs(debug.getregistry()) do
+                    if type(v) == "table" and rawget(v, "qelup_view_mark") then
+                        n = n + 1
+                    end
+                end
+                return n
+            end
+            
+            local hold = py.eval("view_held.append")
+            for _ = 1, 50 do
+                hold(py.view({qelup_view_mark = true}, "dict"))
+            end
+            collectgarbage()
+            collectgarbage()
+            py.collect()
+            expect(marked()):toBe(50)
+            
+            py.eval("view_release")()
+            py.collect()
+            expect(marked()):toBe(0)
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Identity-Preserving Conversion
+    -- ========================================================================
+    
+    describe("Identity-Preserving Conversion", function()
+        
+        local function nested(depth)
+            local root = {}
+            local node = root
+            for _ = 2, depth do
+                node[1] = {}
+                node = node[1]
+            end
+            return root
+        end
+        
+        it("should convert Lua cycles without looping", function()
+            local tbl = {name = "root"}
+            tbl.self = tbl
+            local list = {1}
+            list[2] = list
+            expect(py.eval("lambda d: d['self'] is d and d['name'] == 'root'")(tbl)):toBe(true)
+            expect(py.eval("lambda l: l[1] is l")(list)):toBe(true)
+        end)
+        
+        it("should keep shared Lua subtables shared", function()
+            local shared = {1, 2}
+            local same = py.eval("lambda d: d['a'] is d['b']")
+            expect(same({a = shared, b = shared})):toBe(true)
+            expect(same({a = {1, 2}, b = {1, 2}})):toBe(false)
+        end)
+        
+        it("should convert Python cycles and shared objects", function()
+            py.exec("ident_cycle = {'n': 1}\nident_cycle['self'] = ident_cycle\nident_shared = [1]\nident_pair = [ident_shared, ident_shared]")
+            local cycle = py.eval("ident_cycle")
+            expect(rawequal(cycle.self, cycle)):toBe(true)
+            expect(cycle.n):toBe(1)
+            local pair = py.eval("ident_pair")
+            expect(rawequal(pair[1], pair[2])):toBe(true)
+        end)
+        
+        it("should round-trip deep nesting within maxdepth", function()
+            local echo = py.eval("lambda x: x")
+            local deep = echo(nested(50))
+            local depth = 0
+            while deep do
+                depth = depth + 1
+                deep = deep[1]
+            end
+            expect(depth):toBe(50)
+        end)
+        
+        it("should raise once nesting exceeds maxdepth", function()
+            local echo = py.eval("lambda x: x")
+            withConfig({maxdepth = 3}, function()
+                expect(function() echo(nested(2)) end):toNotThrow()
+                expect(function() echo(nested(10)) end):toThrow("Lua table nesting exceeds maximum depth (3)")
+                expect(function() py.eval("[[[[[[[[[[1]]]]]]]]]]") end):toThrow("Python object nesting exceeds maximum depth")
+            end)
+            expect(function() py.config({maxdepth = 0}) end):toThrow("maxdepth must be positive")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Attribute Cache
+    -- ========================================================================
+    
+    describe("Attribute Cache", function()
+        
+        beforeEach(function()
+            py.exec([[
+import types
+attr_mod = types.ModuleType('attr_mod')
+attr_mod.f = lambda: 1
+
+class AttrTarget:
+    def method(self):
+        return 'method'
+
+attr_obj = AttrTarget()
+attr_obj.g = lambda: 1
+]])
+        end)
+        
+        it("should cache callable module attributes", function()
+            local mod = py.eval("attr_mod")
+            expect(mod.f()):toBe(1)
+            py.exec("attr_mod.f = lambda: 2")
+            expect(mod.f()):toBe(1)
+        end)
+        
+        it("should not cache instance attributes by default", function()
+            local obj = py.eval("attr_obj")
+            expect(obj.g()):toBe(1)
+            py.exec("attr_obj.g = lambda: 2")
+            expect(obj.g()):toBe(2)
+        end)
+        
+        it("should not cache missing or scalar attributes", function()
+            local mod = py.eval("attr_mod")
+            expect(mod.value):toBeNil()
+            py.exec("attr_mod.value = 5")
+            expect(mod.value):toBe(5)
+            py.exec("attr_mod.value = 6")
+            expect(mod.value):toBe(6)
+        end)
+        
+        it("should drop the cached entry on assignment", function()
+            local mod = py.eval("attr_mod")
+            expect(mod.f()):toBe(1)
+            mod.f = py.eval("lambda: 3")
+            expect(mod.f()):toBe(3)
+        end)
+        
+        it("should honor per-object opt-out and opt-in", function()
+            local mod = py.eval("attr_mod")
+            expect(mod.f()):toBe(1)
+            py.attrcache(mod, false)
+            py.exec("attr_mod.f = lambda: 2")
+            expect(mod.f()):toBe(2)
+            
+            local obj = py.eval("attr_obj")
+            expect(rawequal(obj.method, obj.method)):toBe(false)
+            py.attrcache(obj, true)
+            expect(rawequal(obj.method, obj.method)):toBe(true)
+            expect(obj.method()):toBe("method")
+            py.attrcache(obj)
+        end)
+        
+        it("should bypass the cache when config.attrcache is off", function()
+            local mod = py.eval("attr_mod")
+            withConfig({attrcache = false}, function()
+                expect(mod.f()):toBe(1)
+                py.exec("attr_mod.f = lambda: 2")
+                expect(mod.f()):toBe(2)
+            end)
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Bridge Instrumentation
+    -- ========================================================================
+    
+    describe("Bridge Instrumentation", function()
+        
+        -- Builds with STATS=0 only report the decref counters
+        local function hasStats()
+            return py.stats().call ~= nil
+        end
+        
+        beforeAll(function()
+            py.exec("def stats_square(x):\n    return x * x\n\ndef stats_fail():\n    raise ValueError('stats')")
+        end)
+        
+        beforeEach(function()
+            py.resetStats()
+        end)
+        
+        it("should always report decref counters", function()
+            local stats = py.stats()
+            expect(stats.decref_pending):toBeNumber()
+            expect(stats.decref_batches):toBeNumber()
+            expect(stats.decref_released):toBeNumber()
+            expect(stats.decref_largest):toBeNumber()
+            expect(stats.enabled):toBe(false)
+        end)
+        
+        it("should not count while disabled", function()
+            if not hasStats() then return end
+            py.eval("stats_square")(2)
+            expect(py.stats().call.count):toBe(0)
+        end)
+        
+        it("should count calls, eval and exec", function()
+            if not hasStats() then return end
+            local square = py.eval("stats_square")
+            local stats = withConfig({stats = true}, function()
+                square(1)
+                square(2)
+                square(3)
+                py.eval("1")
+                py.exec("pass")
+                return py.stats()
+            end)
+            expect(stats.enabled):toBe(true)
+            expect(stats.call.count):toBe(3)
+            expect(stats.call.ns):toBeGreaterThan(0)
+            expect(stats.eval.count):toBe(1)
+            expect(stats.exec.count):toBe(1)
+        end)
+        
+        it("should count bytes and errors", function()
+            if not hasStats() then return end
+            local echo = py.eval("lambda s: s")
+            local fail = py.eval("stats_fail")
+            local stats = withConfig({stats = true}, function()
+                echo(string.rep("x", 1000))
+                pcall(fail)
+                return py.stats()
+            end)
+            expect(stats.bytes_to_python):toBeGreaterThanOrEqual(1000)
+            expect(stats.bytes_to_lua):toBeGreaterThanOrEqual(1000)
+            expect(stats.errors):toBe(1)
+        end)
+        
+        it("should keep per-callable histograms", function()
+            if not hasStats() then return end
+            local square = py.eval("stats_square")
+            local stats = withConfig({stats = true, histograms = true}, function()
+                for i = 1, 5 do square(i) end
+                return py.stats()
+            end)
+            
+            local entry
+            for _, h in ipairs(stats.histograms) do
+                if h.name == "stats_square" then entry = h end
+            end
+            expect(entry):toBeTable()
+            expect(entry.count):toBe(5)
+            local total = 0
+            for _, n in ipairs(entry.buckets) do total = total + n end
+            expect(total):toBe(5)
+        end)
+        
+        it("should zero counters on reset", function()
+            if not hasStats() then return end
+            withConfig({stats = true, histograms = true}, function()
+                py.eval("stats_square")(2)
+            end)
+            py.resetStats()
+            local stats = py.stats()
+            expect(stats.call.count):toBe(0)
+            expect(stats.eval.count):toBe(0)
+            expect(#stats.histograms):toBe(0)
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Benchmark Suite
+    -- ========================================================================
+    
+    describe("Benchmark Suite", function()
+        
+        it("should write one JSON result per line for every group", function()
+            -- Needs the interpreter running this file and a POSIX shell
+            local lua = arg and arg[-1]
+            if not lua or package.config:sub(1, 1) ~= "/" then return end
+            
+            local output = os.tmpname()
+            local status = os.execute(string.format("%s bench.lua 10 %s > /dev/null", lua, output))
+            expect(status == true or status == 0):toBe(true)
+            
+            local json = require("qeluj")
+            local groups = {}
+            for line in io.lines(output) do
+                local result = json.decode(line)
+                expect(result.name):toBeString()
+                expect(result.python):toBeString()
+                expect(result.iterations):toBeGreaterThanOrEqual(1)
+                expect(result.ns_per_op):toBeGreaterThanOrEqual(0)
+                groups[result.group] = true
+            end
+            os.remove(output)
+            
+            for _, group in ipairs({"call", "attr", "eval", "to_python", "to_lua", "string", "ffi", "gc", "workers"}) do
+                expect(groups):toContainKey(group)
+            end
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Typed Arrays
+    -- ========================================================================
+    
+    describe("Typed Arrays", function()
+        
+        local function elementTypes(list)
+            return py.eval("lambda l: sorted(set(type(x).__name__ for x in l))")(list)
+        end
+        
+        it("should convert homogeneous arrays on the fast paths", function()
+            local echo = py.eval("lambda x: x")
+            local ints = {}
+            for i = 1, 10000 do ints[i] = i end
+            expect(py.eval("sum")(ints)):toBe(50005000)
+            expect(echo(ints)):toEqual(ints)
+            expect(echo({0.5, 1.5, -2.25})):toEqual({0.5, 1.5, -2.25})
+            expect(echo({"a", "b", "c"})):toEqual({"a", "b", "c"})
+            expect(echo({1, "a", true, 2.5})):toEqual({1, "a", true, 2.5})
+            expect(echo({id = 1, name = "x", ok = false})):toEqual({id = 1, name = "x", ok = false})
+        end)
+        
+        it("should build typed Python lists", function()
+            if py.version().major < 3 then return end
+            expect(elementTypes(py.ints({1, 2, 3}))):toEqual({"int"})
+            expect(elementTypes(py.floats({1, 2.5}))):toEqual({"float"})
+            expect(elementTypes(py.strings({"a", "b"}))):toEqual({"str"})
+        end)
+        
+        it("should read typed Python sequences into Lua arrays", function()
+            expect(py.ints(py.ints({4, 5, 6}))):toEqual({4, 5, 6})
+            expect(py.floats(py.floats({0.5, 1}))):toEqual({0.5, 1})
+            expect(py.strings(py.strings({"x", "y\0z"}))):toEqual({"x", "y\0z"})
+            expect(py.floats(py.eval("__import__('array').array('d', [0.25, 0.75])"))):toEqual({0.25, 0.75})
+        end)
+        
+        it("should reject elements of the wrong type", function()
+            expect(function() py.ints({1, 2.5}) end):toThrow("element 2 is not an integer")
+            expect(function() py.floats({1, "x"}) end):toThrow("element 2 is not a number")
+            expect(function() py.strings({"a", 1}) end):toThrow("element 2 is not a string")
+            expect(function() py.strings(py.ints({1})) end):toThrow("element 0 is not a string")
+            expect(function() py.ints(py.strings({"a"})) end):toThrow()
+            expect(function() py.ints(42) end):toThrow("expected Python object or table")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Buffer Views
+    -- ========================================================================
+    
+    describe("Buffer Views", function()
+        
+        beforeEach(function()
+            py.exec("import array\nbuf_data = bytearray(b'abc')\nbuf_arr = array.array('d', [1.5, 2.5, 3.5])")
+        end)
+        
+        it("should read bytes in place", function()
+            local buf = py.buffer(py.bytes("hello"))
+            expect(#buf):toBe(5)
+            expect(buf[1]):toBe(104)
+            expect(buf:sub(2, 3)):toBe("el")
+            expect(buf:sub(-2)):toBe("lo")
+            expect(buf.nbytes):toBe(5)
+            expect(buf.itemsize):toBe(1)
+            expect(buf.format):toBe("B")
+            expect(buf.readonly):toBe(true)
+            expect(function() buf[1] = 1 end):toThrow("buffer is read-only")
+            buf:release()
+        end)
+        
+        it("should write through to a bytearray", function()
+            local buf = py.buffer(py.eval("memoryview(buf_data)"))
+            expect(buf.readonly):toBe(false)
+            buf[1] = 65
+            expect(py.eval("bytes(buf_data)")):toBe("Abc")
+            buf:release()
+        end)
+        
+        it("should read and write typed array items", function()
+            local arr = py.eval("buf_arr")
+            local buf = py.buffer(arr)
+            expect(#buf):toBe(3)
+            expect(buf.format):toBe("d")
+            expect(buf.itemsize):toBe(8)
+            expect(buf.nbytes):toBe(24)
+            expect(buf[2]):toBe(2.5)
+            buf[3] = 9.25
+            expect(py.eval("buf_arr[2]")):toBe(9.25)
+            expect(#buf:sub(1, 2)):toBe(16)
+            expect(py.eval("lambda x: x is buf_arr")(buf)):toBe(true)
+            buf:release()
+        end)
+        
+        it("should check item indexes", function()
+            local buf = py.buffer(py.eval("buf_arr"))
+            expect(function() return buf[0] end):toThrow("index out of range")
+            expect(function() return buf[4] end):toThrow("index out of range")
+            buf:release()
+        end)
+        
+        it("should lock the exporter until released", function()
+            local buf = py.buffer(py.eval("buf_arr"))
+            expect(function() py.exec("buf_arr.append(1.0)") end):toThrow()
+            buf:release()
+            expect(function() py.exec("buf_arr.append(1.0)") end):toNotThrow()
+        end)
+        
+        it("should refuse access after release", function()
+            local buf = py.buffer(py.eval("buf_arr"))
+            buf:release()
+            buf:release()
+            expect(buf.nbytes):toBe(0)
+            expect(tostring(buf)):toBe("qelup.buffer: released")
+            expect(function() return #buf end):toThrow("buffer has been released")
+            expect(function() return buf[1] end):toThrow("buffer has been released")
+            expect(function() return buf.format end):toThrow("buffer has been released")
+            expect(function() return buf.itemsize end):toThrow("buffer has been released")
+            expect(function() return buf.readonly end):toThrow("buffer has been released")
+            expect(function() buf:sub(1) end):toThrow("buffer has been released")
+        end)
+        
+        it("should reject objects without the buffer protocol", function()
+            expect(function() py.buffer(py.eval("object()")) end):toThrow()
+            expect(function() py.buffer({}) end):toThrow("expected Python object")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- N-Dimensional Arrays
+    -- ========================================================================
+    
+    describe("N-Dimensional Arrays", function()
+        
+        -- 3 x 4 float64 matrix holding 0..11 over a writable array.array
+        local function matrix()
+            py.exec("import array\nnd_data = array.array('d', range(12))\nnd_mat = memoryview(nd_data).cast('B').cast('d', [3, 4])")
+            return py.ndarray(py.eval("nd_mat"))
+        end
+        
+        it("should describe shape and strides", function()
+            if py.version().major < 3 then return end
+            local a = matrix()
+            expect(a.ndim):toBe(2)
+            expect(a.shape):toEqual({3, 4})
+            expect(a.strides):toEqual({32, 8})
+            expect(a.size):toBe(12)
+            expect(a.itemsize):toBe(8)
+            expect(a.format):toBe("d")
+            expect(a.contiguous):toBe(true)
+            expect(#a):toBe(3)
+        end)
+        
+        it("should index elements and rows", function()
+            if py.version().major < 3 then return end
+            local a = matrix()
+            expect(a:get(2, 3)):toBe(6)
+            local row = a[3]
+            expect(row.ndim):toBe(1)
+            expect(row[1]):toBe(8)
+            expect(row:sum()):toBe(38)
+        end)
+        
+        it("should reduce in C", function()
+            if py.version().major < 3 then return end
+            local a = matrix()
+            expect(a:sum()):toBe(66)
+            expect(a:mean()):toBe(5.5)
+            expect(a:min()):toBe(0)
+            expect(a:max()):toBe(11)
+            expect(a:dot(a)):toBe(506)
+        end)
+        
+        it("should slice without copying", function()
+            if py.version().major < 3 then return end
+            local a = matrix()
+            local cols = a:slice(1, -1, 2, 2)
+            expect(cols.shape):toEqual({3, 2})
+            expect(cols.contiguous):toBe(false)
+            expect(cols:sum()):toBe(30)
+            
+            local reversed = a:slice(-1, 1, -1)
+            expect(reversed:get(1, 1)):toBe(8)
+            expect(a:slice(3, 1).size):toBe(0)
+            expect(a:slice(3, 1):max()):toBeNil()
+        end)
+        
+        it("should write through to the exporter", function()
+            if py.version().major < 3 then return end
+            local a = matrix()
+            a:set(1, 2, 100)
+            expect(py.eval("nd_data[1]")):toBe(100)
+            
+            local ints = py.ndarray(py.eval("array.array('i', [3, -1, 2])"))
+            expect(ints:sum()):toBe(4)
+            expect(ints:min()):toBe(-1)
+            ints[2] = 5
+            expect(ints:sum()):toBe(10)
+        end)
+        
+        it("should check indices, shapes and steps", function()
+            if py.version().major < 3 then return end
+            local a = matrix()
+            expect(function() a:get(1) end):toThrow("expected 2 indices")
+            expect(function() a:get(4, 1) end):toThrow("index out of range")
+            expect(function() a:slice(1, 2, 0) end):toThrow("step must not be zero")
+            expect(function() a:dot(a[1]) end):toThrow("shape mismatch")
+            expect(function() a[1] = 0 end):toThrow("use a:set")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Arrow Interchange
+    -- ========================================================================
+    
+    describe("Arrow Interchange", function()
+        
+        local function sample()
+            return py.toarrow({
+                id = {1, 2, 3},
+                name = {"a", nil, "c"},
+                ok = {true, false, true},
+                score = {0.5, 1.5, 2.5},
+            })
+        end
+        
+        -- pyarrow 14 added the PyCapsule protocol these tests rely on
+        local function hasPyArrow()
+            return py.hasModule("pyarrow") and py.eval("hasattr(__import__('pyarrow').Array, '__arrow_c_array__')")
+        end
+        
+        it("should export Lua columns and read them back in place", function()
+            local batch = py.arrow(sample())
+            expect(#batch):toBe(3)
+            expect(batch.format):toBe("+s")
+            expect(batch.ncolumns):toBe(4)
+            expect(batch.names):toEqual({"id", "name", "ok", "score"})
+            
+            local id = batch:column("id")
+            expect(id.type):toBe("l")
+            expect(id[2]):toBe(2)
+            expect(id:totable()):toEqual({1, 2, 3})
+            
+            local name = batch:column(2)
+            expect(name.type):toBe("u")
+            expect(name.nulls):toBe(1)
+            expect(name[2]):toBeNil()
+            expect(name[3]):toBe("c")
+            
+            expect(batch:column("ok")[2]):toBe(false)
+            expect(batch:column("score").type):toBe("g")
+            expect(batch:column("score")[3]):toBe(2.5)
+        end)
+        
+        it("should keep the given column order", function()
+            local batch = py.arrow(py.toarrow({a = {1}, b = {2}}, {"b", "a"}))
+            expect(batch.names):toEqual({"b", "a"})
+        end)
+        
+        it("should reject unsupported columns", function()
+            expect(function() py.toarrow({x = {1, "a"}}) end):toThrow("column 'x' mixes number and string values")
+            expect(function() py.toarrow({x = {{}}}) end):toThrow("unsupported table values")
+            expect(function() py.toarrow({}, {1}) end):toThrow("column name 1 is not a string")
+            local batch = py.arrow(sample())
+            expect(function() batch:column("missing") end):toThrow("no column named 'missing'")
+            expect(function() batch:column(5) end):toThrow("column index out of range")
+            expect(function() return batch:column(1)[4] end):toThrow("index out of range")
+        end)
+        
+        it("should refuse access after release", function()
+            local batch = py.arrow(sample())
+            local id = batch:column("id")
+            batch:release()
+            expect(tostring(batch)):toBe("qelup.arrow: released")
+            expect(function() return #batch end):toThrow("Arrow batch has been released")
+            expect(function() return id[1] end):toThrow("Arrow batch has been released")
+        end)
+        
+        it("should interoperate with pyarrow", function()
+            if not hasPyArrow() then return end
+            local pa = py.import("pyarrow")
+            expect(pa.record_batch(sample()).num_rows):toBe(3)
+            
+            local rows = 0
+            for batch in py.arrowstream(py.eval("__import__('pyarrow').table({'x': [1, 2, 3]})")) do
+                rows = rows + #batch
+                expect(batch:column("x"):totable()):toEqual({1, 2, 3})
+            end
+            expect(rows):toBe(3)
+        end)
+        
+        it("should refuse dictionary-encoded columns", function()
+            if not hasPyArrow() then return end
+            local encoded = py.arrow(py.eval("__import__('pyarrow').array(['a', 'b', 'a']).dictionary_encode()"))
+            expect(function() return encoded:column(1)[1] end):toThrow("dictionary-encoded Arrow columns are not supported")
+        end)
+        
+        it("should read sliced struct arrays through the parent", function()
+            if not hasPyArrow() then return end
+            local sliced = py.arrow(py.eval([[__import__('pyarrow').StructArray.from_arrays(
+                [__import__('pyarrow').array([1, 2, 3, 4]), __import__('pyarrow').array(['a', 'b', 'c', 'd'])],
+                names=['x', 'y'], mask=__import__('pyarrow').array([False, True, False, False])).slice(1, 3)]]))
+            local x, y = sliced:column("x"), sliced:column("y")
+            expect(#x):toBe(3)
+            expect(x.nulls):toBe(1)
+            expect(x[1]):toBeNil()
+            expect(x[2]):toBe(3)
+            expect(y:totable()):toEqual({nil, "c", "d"})
+            expect(function() return y[4] end):toThrow("index out of range")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Worker Pools
+    -- ========================================================================
+    
+    describe("Worker Pools", function()
+        -- Worker processes are started with fork()
+        local posix = package.config:sub(1, 1) == "/"
+        local pool, remote
+        
+        beforeEach(function()
+            if not posix then return end
+            pool = py.workers(2)
+            pool:exec([[
+import os
+
+def wsq(x):
+    return int(x) * int(x)
+
+def wpid(_):
+    return os.getpid()
+
+def wecho(x):
+    return x
+
+def wfail(_):
+    raise ValueError('worker broke')
+]])
+            remote = pool:import("__main__")
+        end)
+        
+        afterEach(function()
+            if pool then
+                pool:close()
+                pool = nil
+            end
+        end)
+        
+        it("should call functions in worker processes", function()
+            if not posix then return end
+            expect(#pool):toBe(2)
+            expect(remote.wsq(3)):toBe(9)
+            local pid = py.import("os").getpid()
+            local pids = pool:map(remote.wpid, {0, 0, 0, 0})
+            for i = 1, 4 do
+                expect(pids[i] ~= pid):toBe(true)
+            end
+        end)
+        
+        it("should map in item order", function()
+            if not posix then return end
+            expect(pool:map(remote.wsq, {1, 2, 3, 4, 5})):toEqual({1, 4, 9, 16, 25})
+            expect(pool:map(remote.wsq, {})):toEqual({})
+        end)
+        
+        it("should copy tables, strings and booleans", function()
+            if not posix then return end
+            local value = {name = "x\0y", flags = {true, false}, nested = {n = 1.5}}
+            expect(remote.wecho(value)):toEqual(value)
+        end)
+        
+        it("should raise worker errors and stay usable", function()
+            if not posix then return end
+            expect(function() remote.wfail(0) end):toThrow("worker broke")
+            expect(function() pool:map(remote.wfail, {1, 2}) end):toThrow("worker broke")
+            expect(remote.wsq(2)):toBe(4)
+        end)
+        
+        it("should reject misuse", function()
+            if not posix then return end
+            expect(function() pool:map(print, {1}) end):toThrow("pool:map expects a function from pool:import")
+            expect(function() remote() end):toThrow("cannot call a worker module")
+            pool:close()
+            expect(function() remote.wsq(1) end):toThrow("worker pool has been closed")
+            expect(function() py.workers(0) end):toThrow("worker count out of range")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Initialization Options
+    -- ========================================================================
+    
+    describe("Initialization Options", function()
+        
+        it("should report start-up time", function()
+            expect(py.version().init_ms):toBeNumber()
+            expect(py.version().init_ms):toBeGreaterThanOrEqual(0)
+            expect(py.initialize()):toBe(true)
+        end)
+        
+        it("should apply isolated, site, path and preimport in a fresh interpreter", function()
+            -- Options only apply to the first start, so this runs in a child process
+            local lua = arg and arg[-1]
+            local version = py.version()
+            if not lua or package.config:sub(1, 1) ~= "/" then return end
+            if version.major < 3 or (version.major == 3 and version.minor < 8) then return end
+            
+            local paths = {}
+            for i, entry in ipairs(py.eval("[p for p in __import__('sys').path if p]")) do
+                paths[i] = string.format("%q", entry)
+            end
+            
+            local script = os.tmpname()
+            local file = assert(io.open(script, "w"))
+            file:write("local paths = {", table.concat(paths, ", "), "}\n", [[
+local py = require("qelup")
+py.initialize({isolated = true, site = false, path = paths, preimport = {"json"}})
+assert(py.version().init_ms >= 0, "init_ms")
+assert(py.eval("__import__('sys').flags.isolated") == 1, "isolated")
+assert(py.eval("'site' not in __import__('sys').modules"), "site")
+local path = py.eval("list(__import__('sys').path)")
+assert(#path == #paths and path[1] == paths[1], "path")
+py.exec("[t.join() for t in __import__('threading').enumerate() if t.name == 'qelup-preimport']")
+assert(py.eval("'json' in __import__('sys').modules"), "preimport")
+print("init ok")
+]])
+            file:close()
+            
+            local child = io.popen(string.format("%s %s 2>&1", lua, script))
+            local output = child:read("*a")
+            child:close()
+            os.remove(script)
+            expect(output):toContain("init ok")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Lua Functions and the lua Module
+    -- ========================================================================
+    
+    describe("Lua Functions and the lua Module", function()
+        
+        beforeAll(function()
+            py.exec([[
+import threading
+import lua
+
+def lf_catch(f, *args):
+    try:
+        return f(*args)
+    except Exception as e:
+        return type(e).__name__ + ': ' + str(e)
+
+def lf_from_thread():
+    errors = []
+    def run():
+        try:
+            lua.call('print')
+        except RuntimeError as e:
+            errors.append(str(e))
+    worker = threading.Thread(target=run)
+    worker.start()
+    worker.join()
+    return errors[0]
+]])
+        end)
+        
+        afterEach(function()
+            qelup_test_global = nil
+        end)
+        
+        it("should pass Lua functions as Python callables", function()
+            local sorted = py.builtins().sorted
+            expect(sorted({3, 1, 2}, py.kwargs({key = function(x) return -x end}))):toEqual({3, 2, 1})
+            expect(py.eval("lambda f: f(2) + 1")(function(x) return x * 10 end)):toBe(21)
+        end)
+        
+        it("should map Lua results to None, a value or a tuple", function()
+            local call = py.eval("lambda f: [f()]")
+            expect(call(function() end)):toEqual({})
+            expect(call(function() return "one" end)):toEqual({"one"})
+            expect(call(function() return 1, 2 end)):toEqual({{1, 2}})
+        end)
+        
+        it("should raise Lua errors as lua.LuaError", function()
+            local catch = py.eval("lf_catch")
+            expect(catch(function() error("boom", 0) end)):toBe("LuaError: boom")
+            expect(catch(py.eval("lambda f: f(x=1)"), function() end)):toContain("no keyword arguments")
+        end)
+        
+        it("should return Lua functions to Lua unchanged", function()
+            local fn = function() end
+            expect(rawequal(py.eval("lambda f: f")(fn), fn)):toBe(true)
+        end)
+        
+        it("should reach Lua globals from the lua module", function()
+            qelup_test_global = 41
+            expect(py.eval("__import__('lua').call('string.format', '%d-%s', 5, 'x')")):toBe("5-x")
+            expect(py.eval("__import__('lua').globals()['qelup_test_global']")):toBe(41)
+            if py.version().major == 3 and py.version().minor >= 7 then
+                expect(py.eval("__import__('lua').qelup_test_global + 1")):toBe(42)
+            end
+        end)
+        
+        it("should raise for undefined globals and outside Lua calls", function()
+            local catch = py.eval("lf_catch")
+            expect(catch(py.eval("__import__('lua').call"), "no_such_global")):toBe("NameError: Lua global 'no_such_global' is not defined")
+            expect(py.eval("lf_from_thread")()):toBe("lua module used outside of a Lua call")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Wrapper Identity
+    -- ========================================================================
+    
+    describe("Wrapper Identity", function()
+        
+        beforeAll(function()
+            py.exec("ident_a = object()\nident_b = object()")
+        end)
+        
+        it("should return one wrapper per live Python object", function()
+            local a = py.eval("ident_a")
+            expect(rawequal(a, py.eval("ident_a"))):toBe(true)
+            expect(rawequal(a, py.eval("ident_b"))):toBe(false)
+            expect(rawequal(py.builtins().len, py.builtins().len)):toBe(true)
+        end)
+        
+        it("should work as table keys", function()
+            local seen = {}
+            seen[py.eval("ident_a")] = "a"
+            seen[py.eval("ident_b")] = "b"
+            expect(seen[py.eval("ident_a")]):toBe("a")
+            expect(seen[py.eval("ident_b")]):toBe("b")
+        end)
+        
+        it("should share one metatable", function()
+            expect(getmetatable(py.eval("ident_a"))):toBe(getmetatable(py.eval("object()")))
+        end)
+        
+        it("should make a fresh wrapper after collection", function()
+            local a = py.eval("ident_a")
+            local text = tostring(a)
+            a = nil
+            collectgarbage()
+            collectgarbage()
+            py.collect()
+            local again = py.eval("ident_a")
+            expect(tostring(again)):toBe(text)
+            expect(py.eval("lambda x: x is ident_a")(again)):toBe(true)
+        end)
+        
+        it("should count reused wrappers", function()
+            if py.stats().call == nil then return end
+            local a = py.eval("ident_a")
+            py.resetStats()
+            local stats = withConfig({stats = true}, function()
+                for _ = 1, 3 do py.eval("ident_a") end
+                return py.stats()
+            end)
+            expect(stats.wrapper_hits):toBeGreaterThanOrEqual(3)
+            expect(a):toBeUserdata()
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Interpreter Pools
+    -- ========================================================================
+    
+    describe("Interpreter Pools", function()
+        local pool
+        
+        beforeEach(function()
+            pool = py.pool(2)
+            pool:exec("import math\n\ndef sq(x):\n    return int(x) * int(x)\n\ndef echo(x):\n    return x\n\npool_only = 1")
+        end)
+        
+        afterEach(function()
+            pool:close()
+        end)
+        
+        it("should report its interpreters", function()
+            expect(#pool):toBe(pool.isolated and 2 or 1)
+            expect(tostring(pool)):toStartWith("qelup.pool: ")
+        end)
+        
+        it("should eval, call and map by name", function()
+            expect(pool:eval("1 + 2")):toBe(3)
+            expect(pool:call("sq", 4)):toBe(16)
+            expect(pool:call("math.sqrt", 16)):toBe(4)
+            expect(pool:map("sq", {1, 2, 3, 4})):toEqual({1, 4, 9, 16})
+        end)
+        
+        it("should copy values in and out", function()
+            local value = {name = "pool", list = {1, 2.5, "three", true}}
+            expect(pool:call("echo", value)):toEqual(value)
+        end)
+        
+        it("should keep its namespace apart from __main__", function()
+            expect(pool:eval("pool_only")):toBe(1)
+            expect(py.eval("'pool_only' in globals()")):toBe(false)
+        end)
+        
+        it("should raise Python errors", function()
+            expect(function() pool:eval("1 / 0") end):toThrow("division")
+            expect(function() pool:call("missing_function") end):toThrow()
+            expect(function() pool:map("sq", {1, "x"}) end):toThrow()
+            expect(pool:call("sq", 3)):toBe(9)
+        end)
+        
+        it("should refuse requests after close", function()
+            pool:close()
+            expect(function() pool:eval("1") end):toThrow("interpreter pool has been closed")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Async Functions
+    -- ========================================================================
+    
+    describe("Async Functions", function()
+        local hasAsyncio = py.version().major >= 3 and (py.version().major > 3 or py.version().minor >= 7)
+        
+        beforeAll(function()
+            py.exec([[
+import asyncio
+
+async def async_value(x, delay=0):
+    await asyncio.sleep(delay)
+    return x
+
+async def async_fail():
+    await asyncio.sleep(0)
+    raise ValueError("async broke")
+]])
+        end)
+        
+        it("should return a future from an async function", function()
+            if not hasAsyncio then return end
+            local future = py.eval("async_value")(42)
+            expect(tostring(future)):toStartWith("qelup.future: ")
+            expect(py.await(future)):toBe(42)
+            expect(future:done()):toBe(true)
+            expect(future:result()):toBe(42)
+        end)
+        
+        it("should submit coroutines when config.async is off", function()
+            if not hasAsyncio then return end
+            local coro = withConfig({async = false}, function()
+                return py.eval("async_value")("later")
+            end)
+            expect(coro):toBeUserdata()
+            expect(py.await(py.submit(coro))):toBe("later")
+        end)
+        
+        it("should raise the coroutine's exception", function()
+            if not hasAsyncio then return end
+            local future = py.eval("async_fail")()
+            expect(function() py.await(future) end):toThrow("async broke")
+            expect(future:done()):toBe(true)
+        end)
+        
+        it("should gather results in order", function()
+            if not hasAsyncio then return end
+            local value = py.eval("async_value")
+            local futures = {value("a", 0.05), value("b", 0), value("c", 0.01)}
+            expect(py.gather(futures)):toEqual({"a", "b", "c"})
+        end)
+        
+        it("should interleave tasks in py.run", function()
+            if not hasAsyncio then return end
+            local value = py.eval("async_value")
+            local order = {}
+            local results = py.run(
+                function()
+                    local r = py.await(value("slow", 0.2))
+                    order[#order + 1] = r
+                    return r
+                end,
+                function()
+                    local r = py.await(value("fast", 0.01))
+                    order[#order + 1] = r
+                    return r
+                end
+            )
+            expect(results):toEqual({"slow", "fast"})
+            expect(order):toEqual({"fast", "slow"})
+        end)
+        
+        it("should block instead of yielding outside py.run", function()
+            if not hasAsyncio then return end
+            local value = py.eval("async_value")
+            local co = coroutine.create(function()
+                return py.await(value("blocked", 0.01))
+            end)
+            local ok, result = coroutine.resume(co)
+            expect(ok):toBe(true)
+            expect(result):toBe("blocked")
+            expect(coroutine.status(co)):toBe("dead")
+        end)
+        
+        it("should time out and cancel pending futures", function()
+            if not hasAsyncio then return end
+            local future = py.eval("async_value")("never", 10)
+            expect(function() future:result(0.01) end):toThrow()
+            expect(future:done()):toBe(false)
+            expect(future:cancel()):toBe(true)
+            expect(future:done()):toBe(true)
+            expect(function() future:result() end):toThrow()
+        end)
+        
+        it("should reject non-Python values in py.submit", function()
+            if not hasAsyncio then return end
+            expect(function() py.submit(42) end):toThrow()
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Deferred Decrefs
+    -- ========================================================================
+    
+    describe("Deferred Decrefs", function()
+        local make, saved
+        
+        -- Create n wrapped objects, drop them and let Lua collect the wrappers
+        local function drop(n)
+            local keep = {}
+            for i = 1, n do keep[i] = make() end
+            keep = nil
+            collectgarbage("collect")
+            collectgarbage("collect")
+        end
+        
+        local function released()
+            return py.eval("tracked_released[0]")
+        end
+        
+        beforeAll(function()
+            py.exec([[
+tracked_released = [0]
+
+class Tracked(object):
+    def __del__(self):
+        tracked_released[0] += 1
+]])
+            make = py.eval("Tracked")
+        end)
+        
+        beforeEach(function()
+            saved = py.config().decref_batch
+            py.collect()
+        end)
+        
+        afterEach(function()
+            py.config({decref_batch = saved})
+        end)
+        
+        it("should queue collected wrappers until the next bridge call", function()
+            py.config({decref_batch = 1000})
+            local before = released()
+            drop(10)
+            expect(py.stats().decref_pending):toBeGreaterThanOrEqual(10)
+            expect(released() - before):toBe(10)
+            expect(py.stats().decref_pending):toBe(0)
+        end)
+        
+        it("should release the queue on py.collect", function()
+            py.config({decref_batch = 1000})
+            local before = released()
+            drop(20)
+            expect(py.collect()):toBeGreaterThanOrEqual(20)
+            expect(py.collect()):toBe(0)
+            expect(released() - before):toBe(20)
+        end)
+        
+        it("should drain inline once the batch is full", function()
+            py.config({decref_batch = 5})
+            py.resetStats()
+            drop(12)
+            local stats = py.stats()
+            expect(stats.decref_pending < 5):toBe(true)
+            expect(stats.decref_batches):toBeGreaterThanOrEqual(2)
+            expect(stats.decref_largest):toBeGreaterThanOrEqual(5)
+            expect(stats.decref_released):toBeGreaterThanOrEqual(10)
+        end)
+        
+        it("should release at once with decref_batch 0", function()
+            py.config({decref_batch = 0})
+            local before = released()
+            drop(10)
+            expect(py.stats().decref_pending):toBe(0)
+            expect(py.collect()):toBe(0)
+            expect(released() - before):toBe(10)
+        end)
+        
+        it("should reject a negative decref_batch", function()
+            expect(function() py.config({decref_batch = -1}) end):toThrow("decref_batch must not be negative")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- Call Deadlines
+    -- ========================================================================
+    
+    describe("Call Deadlines", function()
+        local hasDeadlines = py.version().major >= 3
+        
+        beforeAll(function()
+            py.exec([[
+import time
+import lua
+
+def dl_spin():
+    while True:
+        pass
+
+def dl_swallow():
+    try:
+        while True:
+            pass
+    except Exception:
+        return "swallowed"
+
+def dl_catch():
+    try:
+        while True:
+            pass
+    except lua.CallTimeout:
+        return "caught"
+
+def dl_add(a, b):
+    return a + b
+
+def dl_sleep(seconds):
+    time.sleep(seconds)
+    return "slept"
+]])
+        end)
+        
+        it("should return results that beat the deadline", function()
+            if not hasDeadlines then return end
+            expect(py.callWithTimeout(py.eval("dl_add"), 1000, 2, 3)):toBe(5)
+        end)
+        
+        it("should interrupt a call past its deadline", function()
+            if not hasDeadlines then return end
+            local start = py.now()
+            local ok, err = pcall(py.callWithTimeout, py.eval("dl_spin"), 50)
+            expect(ok):toBe(false)
+            expect(py.isTimeout(err)):toBe(true)
+            expect(tostring(err)):toBe("Python call timed out")
+            expect(py.now() - start < 5):toBe(true)
+        end)
+        
+        it("should not be swallowed by except Exception", function()
+            if not hasDeadlines then return end
+            local ok, err = pcall(py.callWithTimeout, py.eval("dl_swallow"), 50)
+            expect(ok):toBe(false)
+            expect(py.isTimeout(err)):toBe(true)
+        end)
+        
+        it("should be catchable as lua.CallTimeout", function()
+            if not hasDeadlines then return end
+            expect(py.callWithTimeout(py.eval("dl_catch"), 50)):toBe("caught")
+        end)
+        
+        it("should not fire after the call returns", function()
+            if not hasDeadlines then return end
+            expect(py.callWithTimeout(py.eval("dl_add"), 20, 1, 1)):toBe(2)
+            expect(py.eval("dl_sleep")(0.1)):toBe("slept")
+        end)
+        
+        it("should tell timeouts from other errors", function()
+            local ok, err = pcall(py.eval, "1 / 0")
+            expect(ok):toBe(false)
+            expect(py.isTimeout(err)):toBe(false)
+            expect(py.isTimeout("Python call timed out")):toBe(false)
+            expect(py.isTimeout(nil)):toBe(false)
+        end)
+        
+        it("should bound exec, eval and calls with config.timeout", function()
+            if not hasDeadlines then return end
+            withConfig({timeout = 50}, function()
+                local ok, err = pcall(py.exec, "while True:\n    pass")
+                expect(py.isTimeout(err)):toBe(true)
+                ok, err = pcall(py.eval, "dl_spin()")
+                expect(py.isTimeout(err)):toBe(true)
+                ok, err = pcall(py.eval("dl_spin"))
+                expect(py.isTimeout(err)):toBe(true)
+                expect(py.eval("dl_add")(1, 2)):toBe(3)
+            end)
+            expect(py.config().timeout):toBe(0)
+        end)
+        
+        it("should reject bad deadlines", function()
+            expect(function() py.callWithTimeout(py.eval("dl_add"), 0, 1, 2) end):toThrow("timeout must be positive")
+            expect(function() py.config({timeout = -1}) end):toThrow("timeout must not be negative")
+        end)
+    end)
+    
+    -- ========================================================================
+    -- FFI Fast Path
+    -- ========================================================================
+    
+    describe("FFI Fast Path", function()
+        local ffiPath
+        
+        beforeAll(function()
+            ffiPath = py.hasFFI()
+            py.exec([[
+import array
+import ctypes
+
+def fast_add(*args):
+    return sum(args)
+
+def fast_mul(a, b):
+    return a * b
+
+def fast_upper(s):
+    return s.upper()
+
+def fast_echo(s):
+    return s
+
+def fast_fail(*args):
+    raise ValueError("fast broke")
+
+def fast_text(*args):
+    return "text"
+
+class FastPoint(ctypes.Structure):
+    _fields_ = [("x", ctypes.c_int), ("y", ctypes.c_int)]
+
+fast_doubles = array.array('d', [1.5, 2.5, 3.5])
+fast_point = FastPoint(1, 2)
+]])
+        end)
+        
+        it("should only report the FFI under LuaJIT", function()
+            expect(ffiPath):toBeBoolean()
+            if not jit then
+                expect(ffiPath):toBe(false)
+            end
+        end)
+        
+        it("should make typed calls", function()
+            local add = py.fastCall(py.eval("fast_add"), "double")
+            local mul = py.fastCall(py.eval("fast_mul"), "int")
+            local upper = py.fastCall(py.eval("fast_upper"), "string")
+            expect(add(1.5, 2)):toBe(3.5)
+            expect(add()):toBe(0)
+            expect(mul(6, 7)):toBe(42)
+            expect(upper("hello")):toBe("HELLO")
+        end)
+        
+        it("should pass binary strings through", function()
+            local echo = py.fastCall(py.eval("fast_echo"), "string")
+            expect(echo("a\0b")):toBe("a\0b")
+            expect(echo("")):toBe("")
+        end)
+        
+        it("should raise Python errors", function()
+            expect(function() py.fastCall(py.eval("fast_fail"), "double")(1) end):toThrow("fast broke")
+            expect(function() py.fastCall(py.eval("fast_fail"), "string")("x") end):toThrow("fast broke")
+        end)
+        
+        it("should check result types on the FFI path", function()
+            if not ffiPath then return end
+            expect(function() py.fastCall(py.eval("fast_text"), "double")() end):toThrow()
+            expect(function() py.fastCall(py.eval("fast_add"), "string")("x") end):toThrow()
+            expect(function() py.fastCall(py.eval("fast_mul"), "string")("x") end):toThrow("expected a str result")
+        end)
+        
+        it("should limit typed calls to 16 arguments on the FFI path", function()
+            if not ffiPath then return end
+            local add = py.fastCall(py.eval("fast_add"), "int")
+            expect(add(1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1)):toBe(16)
+            expect(function() add(1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1) end):toThrow("fastCall takes at most 16 arguments")
+        end)
+        
+        it("should reject unknown kinds", function()
+            expect(function() py.fastCall(py.eval("fast_add"), "float") end):toThrow("fastCall kind must be 'double', 'int' or 'string'")
+        end)
+        
+        it("should map buffers for reading and writing", function()
+            local ptr, n, export = py.fastBuffer(py.eval("fast_doubles"))
+            local base = ffiPath and 0 or 1
+            expect(n):toBe(3)
+            expect(export):toBeDefined()
+            expect(ptr[base]):toBe(1.5)
+            expect(ptr[base + 2]):toBe(3.5)
+            ptr[base + 1] = 9.25
+            expect(py.eval("fast_doubles[1]")):toBe(9.25)
+        end)
+        
+        it("should refuse buffer formats too long to describe", function()
+            if not ffiPath then return end
+            expect(function() py.fastBuffer(py.eval("fast_point")) end):toThrow("is too long")
+        end)
+        
+        it("should leave queued decrefs for the next bridge call", function()
+            if not ffiPath then return end
+            local add = py.fastCall(py.eval("fast_add"), "double")
+            local make = py.eval("object")
+            withConfig({decref_batch = 1000}, function()
+                py.collect()
+                local keep = {}
+                for i = 1, 10 do keep[i] = make() end
+                keep = nil
+                collectgarbage("collect")
+                collectgarbage("collect")
+                expect(add(1, 2)):toBe(3)
+                expect(py.stats().decref_pending):toBeGreaterThanOrEqual(10)
+                expect(py.collect()):toBeGreaterThanOrEqual(10)
+            end)
+        end)
+    end)
+end)
+
 -- ============================================================================
 -- Run All Tests
 -- ============================================================================